@@ -58,6 +58,12 @@ private:
 
     void FreePageTable(void* vaddr, paddr_t paddr, uint page_size_shift) TA_REQ(lock_);
 
+    // Replace the block descriptor at |page_table[index]| with a table of
+    // next level entries that map the same range with the same attributes.
+    volatile pte_t* SplitBlock(vaddr_t vaddr, vaddr_t index, uint index_shift,
+                               uint page_size_shift, volatile pte_t* page_table,
+                               uint asid) TA_REQ(lock_);
+
     ssize_t MapPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                          paddr_t paddr_in, size_t size_in, pte_t attrs,
                          uint index_shift, uint page_size_shift,
@@ -363,6 +363,55 @@ volatile pte_t* ArmArchVmAspace::GetPageTable(vaddr_t index, uint page_size_shif
     }
 }
 
+volatile pte_t* ArmArchVmAspace::SplitBlock(vaddr_t vaddr, vaddr_t index, uint index_shift,
+                                            uint page_size_shift, volatile pte_t* page_table,
+                                            uint asid) {
+    const pte_t pte = page_table[index];
+    DEBUG_ASSERT((pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK);
+    DEBUG_ASSERT(index_shift > page_size_shift);
+
+    paddr_t paddr;
+    zx_status_t ret = AllocPageTable(&paddr, page_size_shift);
+    if (ret) {
+        TRACEF("failed to allocate page table\n");
+        return NULL;
+    }
+    volatile pte_t* next_page_table = static_cast<volatile pte_t*>(paddr_to_physmap(paddr));
+
+    const uint next_shift = index_shift - (page_size_shift - 3);
+    const pte_t attrs = pte & ~(MMU_PTE_OUTPUT_ADDR_MASK | MMU_PTE_DESCRIPTOR_MASK);
+    const pte_t descriptor = (next_shift > page_size_shift) ? MMU_PTE_L012_DESCRIPTOR_BLOCK
+                                                            : MMU_PTE_L3_DESCRIPTOR_PAGE;
+    const paddr_t block_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
+    const size_t count = 1U << (page_size_shift - 3);
+    for (size_t i = 0; i < count; i++) {
+        next_page_table[i] = (block_paddr + (i << next_shift)) | attrs | descriptor;
+    }
+
+    LTRACEF("splitting block pte %p[%#" PRIxPTR "] = %#" PRIx64 " into table %#" PRIxPTR "\n",
+            page_table, index, pte, paddr);
+
+    // Break-before-make: the block entry must be invalidated and flushed from
+    // the TLB before the table that replaces it becomes visible.
+    page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
+    __asm__ volatile("dmb ishst" ::: "memory");
+    if (flags_ & ARCH_ASPACE_FLAG_GUEST) {
+        paddr_t vttbr = arm64_vttbr(asid_, tt_phys_);
+        __UNUSED zx_status_t status = arm64_el2_tlbi_ipa(vttbr, vaddr >> 12);
+        DEBUG_ASSERT(status == ZX_OK);
+    } else if (asid == MMU_ARM64_GLOBAL_ASID) {
+        ARM64_TLBI(vaae1is, vaddr >> 12);
+    } else {
+        ARM64_TLBI(vae1is, vaddr >> 12 | (vaddr_t)asid << 48);
+    }
+    DSB;
+
+    page_table[index] = paddr | MMU_PTE_L012_DESCRIPTOR_TABLE;
+    __asm__ volatile("dmb ishst" ::: "memory");
+
+    return next_page_table;
+}
+
 static bool page_table_is_clear(volatile pte_t* page_table, uint page_size_shift) {
     int i;
     int count = 1U << (page_size_shift - 3);
@@ -408,6 +457,16 @@ ssize_t ArmArchVmAspace::UnmapPageTable(vaddr_t vaddr, vaddr_t vaddr_rel,
 
         pte = page_table[index];
 
+        // A block that is only partially covered is split so the rest of
+        // it stays mapped. If that fails the whole block is unmapped below,
+        // which is safe since the VM layer refaults anything it still needs.
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            if (SplitBlock(vaddr, index, index_shift, page_size_shift, page_table, asid)) {
+                pte = page_table[index];
+            }
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
@@ -569,6 +628,14 @@ int ArmArchVmAspace::ProtectPageTable(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         index = vaddr_rel >> index_shift;
         pte = page_table[index];
 
+        if (index_shift > page_size_shift && chunk_size != block_size &&
+            (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_BLOCK) {
+            if (!SplitBlock(vaddr, index, index_shift, page_size_shift, page_table, asid)) {
+                goto err;
+            }
+            pte = page_table[index];
+        }
+
         if (index_shift > page_size_shift &&
             (pte & MMU_PTE_DESCRIPTOR_MASK) == MMU_PTE_L012_DESCRIPTOR_TABLE) {
             page_table_paddr = pte & MMU_PTE_OUTPUT_ADDR_MASK;
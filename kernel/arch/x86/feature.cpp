@@ -223,9 +223,12 @@ void x86_feature_debug(void)
         { X86_FEATURE_SMEP, "smep" },
         { X86_FEATURE_SMAP, "smap" },
         { X86_FEATURE_ERMS, "erms" },
+        { X86_FEATURE_FSRM, "fsrm" },
         { X86_FEATURE_RDRAND, "rdrand" },
         { X86_FEATURE_RDSEED, "rdseed" },
         { X86_FEATURE_PKU, "pku" },
+        { X86_FEATURE_PCID, "pcid" },
+        { X86_FEATURE_INVPCID, "invpcid" },
         { X86_FEATURE_SYSCALL, "syscall" },
         { X86_FEATURE_NX, "nx" },
         { X86_FEATURE_HUGE_PAGE, "huge" },
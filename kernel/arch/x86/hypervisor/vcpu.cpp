@@ -676,6 +676,9 @@ zx_status_t Vcpu::Resume(zx_port_packet_t* packet) {
     do {
         AutoVmcs vmcs(vmcs_page_.PhysicalAddress());
         local_apic_maybe_interrupt(&vmcs, &local_apic_state_);
+        // The PCID of our address space may have been reassigned since the
+        // last VM exit, so refresh the CR3 that will be restored on the next.
+        vmcs.Write(VmcsFieldXX::HOST_CR3, x86_get_cr3());
         if (x86_feature_test(X86_FEATURE_XSAVE)) {
             // Save the host XCR0, and load the guest XCR0.
             vmx_state_.host_state.xcr0 = x86_xgetbv(0);
@@ -41,7 +41,7 @@ private:
     IntermediatePtFlags intermediate_flags() final;
     PtFlags terminal_flags(PageTableLevel level, uint flags) final;
     PtFlags split_flags(PageTableLevel level, PtFlags flags) final;
-    void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page) final;
+    void TlbInvalidate(PendingTlbInvalidation* pending) final;
     uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) final;
     bool needs_cache_flushes() final { return false; }
 
@@ -63,7 +63,7 @@ private:
     IntermediatePtFlags intermediate_flags() final;
     PtFlags terminal_flags(PageTableLevel level, uint flags) final;
     PtFlags split_flags(PageTableLevel level, PtFlags flags) final;
-    void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page) final;
+    void TlbInvalidate(PendingTlbInvalidation* pending) final;
     uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) final;
     bool needs_cache_flushes() final { return false; }
 };
@@ -96,6 +96,11 @@ public:
 
     int active_cpus() { return active_cpus_.load(); }
 
+    // Called before a TLB shootdown of this aspace: every CPU must flush its
+    // PCID on the next switch in, unless the shootdown reaches it first.
+    void MarkPcidStale() { stale_cpus_.store(-1); }
+    void ClearPcidStale(int mask) { stale_cpus_.fetch_and(~mask); }
+
     IoBitmap& io_bitmap() { return io_bitmap_; }
 
     static void ContextSwitch(X86ArchVmAspace* from, X86ArchVmAspace* to);
@@ -129,6 +134,17 @@ private:
     // CPUs that are currently executing in this aspace.
     // Actually an mp_cpu_mask_t, but header dependencies.
     fbl::atomic_int active_cpus_{0};
+
+    // Returns the PCID to run this aspace with on |cpu|, allocating a new
+    // one if it hasn't got one in the current generation.
+    uint64_t AssignPcid(uint cpu);
+
+    // Generation and PCID currently assigned to this aspace, or 0 if none.
+    fbl::atomic<uint64_t> pcid_state_{0};
+
+    // CPUs that may hold TLB entries for this aspace's PCID that predate a
+    // shootdown they did not take part in.
+    fbl::atomic_int stale_cpus_{0};
 };
 
 using ArchVmAspace = X86ArchVmAspace;
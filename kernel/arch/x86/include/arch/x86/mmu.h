@@ -100,6 +100,9 @@ void x86_mmu_percpu_init(void);
 void x86_mmu_early_init(void);
 void x86_mmu_init(void);
 
+/* invalidate every TLB entry, global or not, for every PCID */
+void x86_tlb_global_invalidate(void);
+
 paddr_t x86_kernel_cr3(void);
 
 __END_CDECLS
@@ -16,7 +16,10 @@
 #include <arch/x86/feature.h>
 #include <arch/x86/mmu.h>
 #include <arch/x86/mmu_mem_types.h>
+#include <fbl/atomic.h>
+#include <kernel/cmdline.h>
 #include <kernel/mp.h>
+#include <kernel/spinlock.h>
 #include <vm/arch_vm_aspace.h>
 #include <vm/pmm.h>
 #include <vm/vm.h>
@@ -33,6 +36,24 @@ uint8_t g_paddr_width = 32;
 /* True if the system supports 1GB pages */
 static bool supports_huge_pages = false;
 
+/* True if user address spaces are tagged with process-context identifiers */
+static bool pcid_enabled = false;
+
+/* PCIDs are handed out to address spaces from a global counter.  When the
+ * counter runs out the generation is bumped: an address space holding a PCID
+ * from an older generation gets a new one the next time it is switched to, and
+ * each cpu flushes every PCID from its TLB the first time it sees the new
+ * generation.  PCID 0 is reserved for the kernel page table. */
+static SpinLock pcid_lock;
+static uint64_t pcid_next TA_GUARDED(pcid_lock) = 1;
+static fbl::atomic<uint64_t> pcid_generation(1);
+
+/* The generation each cpu last flushed all PCIDs for.  Only touched by the
+ * owning cpu, with interrupts disabled. */
+static uint64_t pcid_cpu_generation[SMP_MAX_CPUS];
+
+static constexpr uint kPcidBits = 12;
+
 /* top level kernel page tables, initialized in start.S */
 volatile pt_entry_t pml4[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE);
 volatile pt_entry_t pdp[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE); /* temporary */
@@ -106,68 +127,125 @@ static bool x86_mmu_check_paddr(paddr_t paddr) {
 }
 
 /**
- * @brief  invalidate all TLB entries, including global entries
+ * @brief  invalidate all TLB entries, including global entries, for every PCID
  */
-static void x86_tlb_global_invalidate() {
-    /* See Intel 3A section 4.10.4.1 */
-    ulong cr4 = x86_get_cr4();
-    if (likely(cr4 & X86_CR4_PGE)) {
-        x86_set_cr4(cr4 & ~X86_CR4_PGE);
-        x86_set_cr4(cr4);
+void x86_tlb_global_invalidate() {
+    /* With PCIDs enabled a CR3 reload only flushes the current PCID, so
+     * use INVPCID, which PCIDs are never enabled without.
+     * See Intel 3A section 4.10.4.1 */
+    if (x86_feature_test(X86_FEATURE_INVPCID)) {
+        /* Type 2: all contexts, including global translations */
+        struct {
+            uint64_t pcid;
+            uint64_t addr;
+        } desc = {0, 0};
+        __asm__ volatile("invpcid %0, %1" ::"m"(desc), "r"(2ul)
+                         : "memory");
     } else {
-        x86_set_cr3(x86_get_cr3());
+        /* Never set PGE here; the MTRR update runs with it cleared */
+        ulong cr4 = x86_get_cr4();
+        if (likely(cr4 & X86_CR4_PGE)) {
+            x86_set_cr4(cr4 & ~X86_CR4_PGE);
+            x86_set_cr4(cr4);
+        } else {
+            x86_set_cr3(x86_get_cr3());
+        }
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct TlbInvalidatePage_context {
+/**
+ * @brief  invalidate all non-global TLB entries, for every PCID
+ */
+static void x86_tlb_invalidate_all_pcids() {
+    DEBUG_ASSERT(pcid_enabled);
+    /* Type 3: all contexts, retaining global translations */
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = {0, 0};
+    __asm__ volatile("invpcid %0, %1" ::"m"(desc), "r"(3ul)
+                     : "memory");
+}
+
+/* Task used for invalidating TLB entries on each CPU */
+struct TlbInvalidate_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum PageTableLevel level;
-    bool global_page;
+    const PendingTlbInvalidation* pending;
+    X86ArchVmAspace* aspace;
 };
-static void TlbInvalidatePage_task(void* raw_context) {
+static void TlbInvalidate_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    TlbInvalidatePage_context* context = (TlbInvalidatePage_context*)raw_context;
+    TlbInvalidate_context* context = (TlbInvalidate_context*)raw_context;
 
-    ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
-        /* This invalidation doesn't apply to this CPU, ignore it */
+    ulong cr3 = x86_get_cr3() & X86_CR3_BASE_MASK;
+    if (context->target_cr3 != cr3 && !context->pending->contains_global) {
+        /* This invalidation doesn't apply to this CPU, ignore it.  If it is
+         * tagged with a PCID, the aspace has been marked stale for us and
+         * will be flushed when we next switch to it. */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    if (context->target_cr3 == cr3 && context->aspace != nullptr) {
+        /* We are flushing this aspace's entries right now, so there is no need
+         * to flush its PCID again on the next switch. */
+        context->aspace->ClearPcidStale(cpu_num_to_mask(arch_curr_cpu_num()));
+    }
+
+    if (context->pending->full_shootdown) {
+        if (context->pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else {
+            /* Reloading cr3 without the no-flush bit drops all non-global
+             * entries of the current PCID */
+            x86_set_cr3(x86_get_cr3());
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < context->pending->count; ++i) {
+        const auto& item = context->pending->items[i];
+        if (!item.is_global && context->target_cr3 != cr3) {
+            /* Only the global entries apply to this CPU */
+            continue;
+        }
+        if (pcid_enabled && item.is_global && item.level != PT_L) {
+            /* invlpg only drops the paging-structure caches of the current
+             * PCID, and an unlinked kernel page table may be cached under
+             * any of them. */
+            x86_tlb_global_invalidate();
+            return;
+        }
+        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)item.addr));
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Execute a queued TLB invalidation
  *
- * @param pt The page table we're invalidating for (if NULL, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * All of the invalidations generated by a single page table operation are
+ * issued with one mp_sync_exec, rather than one per page.
  *
- * TODO(ZX-979): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @param pt The page table we're invalidating for (if NULL, assume for current one)
+ * @param pending The planned invalidation
  */
-static void x86_tlb_invalidate_page(X86PageTableBase* pt, vaddr_t vaddr,
-                                    enum PageTableLevel level, bool global_page) {
-    ulong cr3 = pt ? pt->phys() : x86_get_cr3();
-    struct TlbInvalidatePage_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
+static void x86_tlb_invalidate(X86PageTableBase* pt, const PendingTlbInvalidation* pending) {
+    if (pending->empty()) {
+        return;
+    }
+
+    ulong cr3 = pt ? pt->phys() : x86_get_cr3() & X86_CR3_BASE_MASK;
+    X86ArchVmAspace* aspace = pt ? static_cast<X86ArchVmAspace*>(pt->ctx()) : nullptr;
+    struct TlbInvalidate_context task_context = {
+        .target_cr3 = cr3, .pending = pending, .aspace = aspace,
     };
 
+    /* CPUs that are not running this aspace still hold its entries under its
+     * PCID.  Mark it stale everywhere before sampling active_cpus, so that any
+     * CPU that misses the IPI below flushes the PCID when it next switches in. */
+    if (pcid_enabled && aspace != nullptr && !pending->contains_global) {
+        aspace->MarkPcidStale();
+    }
+
     /* Target only CPUs this aspace is active on.  It may be the case that some
      * other CPU will become active in it after this load, or will have left it
      * just before this load.  In the former case, it is becoming active after
@@ -175,14 +253,14 @@ static void x86_tlb_invalidate_page(X86PageTableBase* pt, vaddr_t vaddr,
      * case, it will get a spurious request to flush. */
     mp_ipi_target_t target;
     cpu_mask_t target_mask = 0;
-    if (global_page || pt == nullptr) {
+    if (pending->contains_global || pt == nullptr) {
         target = MP_IPI_TARGET_ALL;
     } else {
         target = MP_IPI_TARGET_MASK;
-        target_mask = static_cast<X86ArchVmAspace*>(pt->ctx())->active_cpus();
+        target_mask = aspace->active_cpus();
     }
 
-    mp_sync_exec(target, target_mask, TlbInvalidatePage_task, &task_context);
+    mp_sync_exec(target, target_mask, TlbInvalidate_task, &task_context);
 }
 
 bool X86PageTableMmu::check_paddr(paddr_t paddr) {
@@ -282,8 +360,8 @@ X86PageTableBase::PtFlags X86PageTableMmu::split_flags(PageTableLevel level,
     return flags;
 }
 
-void X86PageTableMmu::TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page) {
-    x86_tlb_invalidate_page(this, vaddr, level, global_page);
+void X86PageTableMmu::TlbInvalidate(PendingTlbInvalidation* pending) {
+    x86_tlb_invalidate(this, pending);
 }
 
 uint X86PageTableMmu::pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) {
@@ -391,7 +469,7 @@ X86PageTableBase::PtFlags X86PageTableEpt::split_flags(PageTableLevel level,
     return flags;
 }
 
-void X86PageTableEpt::TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page) {
+void X86PageTableEpt::TlbInvalidate(PendingTlbInvalidation* pending) {
     // TODO(ZX-981): Implement this.
 }
 
@@ -418,7 +496,9 @@ void x86_mmu_early_init() {
 
     // Unmap the lower identity mapping.
     pml4[0] = 0;
-    x86_tlb_invalidate_page(nullptr, 0, PML4_L, false);
+    PendingTlbInvalidation tlb;
+    tlb.enqueue(0, PML4_L, /* global */ false);
+    x86_tlb_invalidate(nullptr, &tlb);
 
     /* get the address width from the CPU */
     uint8_t vaddr_width = x86_linear_address_width();
@@ -437,9 +517,29 @@ void x86_mmu_early_init() {
     LTRACEF("paddr_width %u vaddr_width %u\n", g_paddr_width, g_vaddr_width);
 }
 
-void x86_mmu_init(void) {}
+/* PCIDE may only be set while the current PCID is 0 */
+static void x86_pcid_percpu_enable() {
+    if (!pcid_enabled)
+        return;
+
+    x86_set_cr3(x86_get_cr3() & X86_CR3_BASE_MASK);
+    x86_set_cr4(x86_get_cr4() | X86_CR4_PCIDE);
+    pcid_cpu_generation[arch_curr_cpu_num()] = 0;
+}
+
+void x86_mmu_init(void) {
+    /* Secondary cpus pick this up from x86_mmu_percpu_init() once they boot.
+     * Flushing every PCID without INVPCID means toggling CR4.PGE, which the
+     * MTRR update can't do, so PCIDs need both. */
+    if (x86_feature_test(X86_FEATURE_PCID) && x86_feature_test(X86_FEATURE_INVPCID) &&
+        cmdline_get_bool("kernel.x86.pcid", true)) {
+        pcid_enabled = true;
+        x86_pcid_percpu_enable();
+    }
+}
 
 X86PageTableBase::X86PageTableBase() {
+    list_initialize(&freed_tables_);
 }
 
 X86PageTableBase::~X86PageTableBase() {
@@ -579,21 +679,61 @@ zx_status_t X86ArchVmAspace::Protect(vaddr_t vaddr, size_t count, uint mmu_flags
     return pt_->ProtectPages(vaddr, count, mmu_flags);
 }
 
+uint64_t X86ArchVmAspace::AssignPcid(uint cpu) {
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    uint64_t generation = pcid_generation.load();
+    uint64_t state = pcid_state_.load();
+    if (state >> kPcidBits != generation || pcid_cpu_generation[cpu] != generation) {
+        pcid_lock.Acquire();
+        generation = pcid_generation.load();
+        state = pcid_state_.load();
+        if (state >> kPcidBits != generation) {
+            if (pcid_next > X86_CR3_PCID_MASK) {
+                pcid_generation.store(++generation);
+                pcid_next = 1;
+            }
+            state = (generation << kPcidBits) | pcid_next++;
+            pcid_state_.store(state);
+        }
+        if (pcid_cpu_generation[cpu] != generation) {
+            x86_tlb_invalidate_all_pcids();
+            pcid_cpu_generation[cpu] = generation;
+        }
+        pcid_lock.Release();
+    }
+    return state & X86_CR3_PCID_MASK;
+}
+
 void X86ArchVmAspace::ContextSwitch(X86ArchVmAspace* old_aspace, X86ArchVmAspace* aspace) {
-    cpu_mask_t cpu_bit = cpu_num_to_mask(arch_curr_cpu_num());
+    cpu_num_t cpu = arch_curr_cpu_num();
+    cpu_mask_t cpu_bit = cpu_num_to_mask(cpu);
     if (aspace != nullptr) {
         aspace->canary_.Assert();
         paddr_t phys = aspace->pt_phys();
         LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, phys);
-        x86_set_cr3(phys);
+
+        /* Become visible to shootdowns before checking whether one has left
+         * our copy of this aspace's PCID stale. */
+        aspace->active_cpus_.fetch_or(cpu_bit);
+
+        ulong cr3 = phys;
+        if (pcid_enabled) {
+            cr3 |= aspace->AssignPcid(cpu);
+            if (!(aspace->stale_cpus_.fetch_and(~cpu_bit) & cpu_bit)) {
+                cr3 |= X86_CR3_NOFLUSH;
+            }
+        }
+        x86_set_cr3(cr3);
 
         if (old_aspace != nullptr) {
             old_aspace->active_cpus_.fetch_and(~cpu_bit);
         }
-        aspace->active_cpus_.fetch_or(cpu_bit);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
-        x86_set_cr3(kernel_pt_phys);
+        /* The kernel page table only holds global mappings, so PCID 0 never
+         * needs flushing on the way in. */
+        x86_set_cr3(pcid_enabled ? kernel_pt_phys | X86_CR3_NOFLUSH : kernel_pt_phys);
         if (old_aspace != nullptr) {
             old_aspace->active_cpus_.fetch_and(~cpu_bit);
         }
@@ -631,6 +771,8 @@ void x86_mmu_percpu_init(void) {
         cr4 |= X86_CR4_SMAP;
     x86_set_cr4(cr4);
 
+    x86_pcid_percpu_enable();
+
     // Set NXE bit in X86_MSR_IA32_EFER.
     uint64_t efer_msr = read_msr(X86_MSR_IA32_EFER);
     efer_msr |= X86_EFER_NXE;
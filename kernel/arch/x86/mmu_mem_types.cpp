@@ -162,9 +162,10 @@ static void x86_pat_sync_task(void *raw_context)
     cr4 &= ~X86_CR4_PGE;
     x86_set_cr4(cr4);
 
-    /* Step 7: If the PGE flag wasn't set, flush the TLB via CR3 */
+    /* Step 7: If the PGE flag wasn't set, flush the TLB. A CR3 reload would
+     * only flush the current PCID. */
     if (!pge_was_set) {
-        x86_set_cr3(x86_get_cr3());
+        x86_tlb_global_invalidate();
     }
 
     /* Step 8: Disable MTRRs */
@@ -209,7 +210,7 @@ static void x86_pat_sync_task(void *raw_context)
 
     /* Step 11: Flush all cache and the TLB again */
     __asm volatile ("wbinvd" ::: "memory");
-    x86_set_cr3(x86_get_cr3());
+    x86_tlb_global_invalidate();
 
     /* Step 12: Enter the normal cache mode */
     cr0 = x86_get_cr0();
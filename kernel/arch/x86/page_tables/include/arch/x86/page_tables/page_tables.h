@@ -8,6 +8,7 @@
 
 #include <fbl/canary.h>
 #include <fbl/mutex.h>
+#include <list.h>
 
 typedef uint64_t pt_entry_t;
 #define PRIxPTE PRIx64
@@ -22,6 +23,37 @@ enum PageTableLevel {
     PML4_L,
 };
 
+// Collects the TLB invalidations generated by a single page table operation
+// so that they can be issued together once the operation is complete, rather
+// than with one shootdown per modified entry.
+struct PendingTlbInvalidation {
+    struct Item {
+        vaddr_t addr;
+        PageTableLevel level;
+        bool is_global;
+    };
+
+    // Beyond this many pages it is cheaper to flush the whole TLB than to
+    // invalidate each page individually.
+    static constexpr size_t kMaxPages = 32;
+
+    // Add an address to be invalidated.
+    void enqueue(vaddr_t v, PageTableLevel level, bool is_global);
+
+    // Reset to the empty state.
+    void clear();
+
+    bool empty() const { return count == 0 && !full_shootdown; }
+
+    // Number of valid entries in |items|.
+    size_t count = 0;
+    // If true, ignore |items| and invalidate the entire TLB.
+    bool full_shootdown = false;
+    // If true, at least one of the pending invalidations is a global page.
+    bool contains_global = false;
+    Item items[kMaxPages];
+};
+
 class X86PageTableBase {
 public:
     X86PageTableBase();
@@ -76,8 +108,9 @@ protected:
     // Return the hardware flags to use on smaller pages after a splitting a
     // large page with flags |flags|.
     virtual PtFlags split_flags(PageTableLevel level, PtFlags flags) = 0;
-    // Invalidate a single page at the given level
-    virtual void TlbInvalidatePage(PageTableLevel level, vaddr_t vaddr, bool global_page) = 0;
+    // Perform all of the invalidations in |pending|.  Called once per page
+    // table operation, after all of the entries have been updated.
+    virtual void TlbInvalidate(PendingTlbInvalidation* pending) = 0;
     // Convert PtFlags to ARCH_MMU_* flags.
     virtual uint pt_flags_to_mmu_flags(PtFlags flags, PageTableLevel level) = 0;
     // Returns true if a cache flush is necessary for pagetable changes to be
@@ -135,8 +168,20 @@ private:
 
     void UnmapEntry(PageTableLevel level, vaddr_t vaddr, volatile pt_entry_t* pte) TA_REQ(lock_);
 
+    // Issue the invalidations accumulated by the current operation and free
+    // any page tables it unlinked.
+    void FlushPending() TA_REQ(lock_);
+
     fbl::Canary<fbl::magic("X86P")> canary_;
 
     // low lock to protect the mmu code
     fbl::Mutex lock_;
+
+    // Invalidations owed by the operation currently holding |lock_|.
+    PendingTlbInvalidation pending_tlb_ TA_GUARDED(lock_);
+
+    // Page tables unlinked by the current operation.  Other cpus may still
+    // be walking them through their paging-structure caches, so they are
+    // only returned to the pmm after |pending_tlb_| has been flushed.
+    list_node freed_tables_ TA_GUARDED(lock_);
 };
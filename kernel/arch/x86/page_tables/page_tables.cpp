@@ -9,6 +9,7 @@
 #include <arch/x86/feature.h>
 #include <arch/x86/page_tables/constants.h>
 #include <assert.h>
+#include <fbl/algorithm.h>
 #include <fbl/auto_call.h>
 #include <fbl/auto_lock.h>
 #include <trace.h>
@@ -132,6 +133,29 @@ PageTableLevel lower_level(PageTableLevel level) {
 
 } // namespace
 
+void PendingTlbInvalidation::enqueue(vaddr_t v, PageTableLevel level, bool is_global) {
+    if (is_global) {
+        contains_global = true;
+    }
+
+    // We mark PML4_L entries as full shootdowns, since it's going to be
+    // expensive one way or another.
+    if (count >= fbl::count_of(items) || level == PML4_L) {
+        full_shootdown = true;
+        return;
+    }
+    items[count].addr = v;
+    items[count].level = level;
+    items[count].is_global = is_global;
+    count++;
+}
+
+void PendingTlbInvalidation::clear() {
+    count = 0;
+    full_shootdown = false;
+    contains_global = false;
+}
+
 struct MappingCursor {
 public:
     /**
@@ -169,9 +193,9 @@ void X86PageTableBase::UpdateEntry(PageTableLevel level, vaddr_t vaddr, volatile
     /* set the new entry */
     *pte = paddr | flags | X86_MMU_PG_P;
 
-    /* attempt to invalidate the page */
+    /* queue an invalidation, issued once the whole operation is done */
     if (IS_PAGE_PRESENT(olde)) {
-        TlbInvalidatePage(level, vaddr, is_kernel_address(vaddr));
+        pending_tlb_.enqueue(vaddr, level, is_kernel_address(vaddr));
     }
 }
 
@@ -182,9 +206,9 @@ void X86PageTableBase::UnmapEntry(PageTableLevel level, vaddr_t vaddr, volatile
 
     *pte = 0;
 
-    /* attempt to invalidate the page */
+    /* queue an invalidation, issued once the whole operation is done */
     if (IS_PAGE_PRESENT(olde)) {
-        TlbInvalidatePage(level, vaddr, is_kernel_address(vaddr));
+        pending_tlb_.enqueue(vaddr, level, is_kernel_address(vaddr));
     }
 }
 
@@ -416,7 +440,9 @@ bool X86PageTableBase::RemoveMapping(volatile pt_entry_t* table, PageTableLevel
                              "page %p state %u, paddr %#" PRIxPTR "\n", page, page->state,
                              X86_VIRT_TO_PHYS(next_table));
 
-            pmm_free_page(page);
+            // Defer freeing until the TLB shootdown for this operation
+            // has completed.
+            list_add_tail(&freed_tables_, &page->free.node);
             pages_--;
             unmapped = true;
         }
@@ -720,6 +746,9 @@ zx_status_t X86PageTableBase::UnmapPages(vaddr_t vaddr, const size_t count,
         return ZX_OK;
 
     fbl::AutoLock a(&lock_);
+    auto flush = fbl::MakeAutoCall([&]() TA_NO_THREAD_SAFETY_ANALYSIS {
+        FlushPending();
+    });
     DEBUG_ASSERT(virt_);
 
     MappingCursor start = {
@@ -756,6 +785,11 @@ zx_status_t X86PageTableBase::MapPages(vaddr_t vaddr, paddr_t* phys, size_t coun
         return ZX_ERR_INVALID_ARGS;
 
     fbl::AutoLock a(&lock_);
+    // Declared before |undo| so that any invalidations it generates are
+    // flushed as well.
+    auto flush = fbl::MakeAutoCall([&]() TA_NO_THREAD_SAFETY_ANALYSIS {
+        FlushPending();
+    });
     DEBUG_ASSERT(virt_);
 
     PageTableLevel top = top_level();
@@ -817,6 +851,9 @@ zx_status_t X86PageTableBase::MapPagesContiguous(vaddr_t vaddr, paddr_t paddr,
         return ZX_ERR_INVALID_ARGS;
 
     fbl::AutoLock a(&lock_);
+    auto flush = fbl::MakeAutoCall([&]() TA_NO_THREAD_SAFETY_ANALYSIS {
+        FlushPending();
+    });
     DEBUG_ASSERT(virt_);
 
     MappingCursor start = {
@@ -851,6 +888,9 @@ zx_status_t X86PageTableBase::ProtectPages(vaddr_t vaddr, size_t count, uint mmu
         return ZX_ERR_INVALID_ARGS;
 
     fbl::AutoLock a(&lock_);
+    auto flush = fbl::MakeAutoCall([&]() TA_NO_THREAD_SAFETY_ANALYSIS {
+        FlushPending();
+    });
 
     MappingCursor start = {
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
@@ -913,6 +953,15 @@ zx_status_t X86PageTableBase::QueryVaddr(vaddr_t vaddr, paddr_t* paddr, uint* mm
     return ZX_OK;
 }
 
+void X86PageTableBase::FlushPending() {
+    TlbInvalidate(&pending_tlb_);
+    pending_tlb_.clear();
+
+    if (!list_is_empty(&freed_tables_)) {
+        pmm_free(&freed_tables_);
+    }
+}
+
 void X86PageTableBase::Destroy(vaddr_t base, size_t size) {
     canary_.Assert();
 
@@ -21,6 +21,7 @@
 
 CODE_TEMPLATE(kStacInstruction, "stac");
 CODE_TEMPLATE(kClacInstruction, "clac");
+CODE_TEMPLATE(kRepMovsbInstruction, "rep movsb");
 static const uint8_t kNopInstruction = 0x90;
 
 extern "C" {
@@ -47,6 +48,16 @@ void fill_out_clac_instruction(const CodePatchInfo* patch) {
     }
 }
 
+void fill_out_user_copy_large_patch(const CodePatchInfo* patch) {
+    const size_t kSize = kRepMovsbInstructionEnd - kRepMovsbInstruction;
+    DEBUG_ASSERT(patch->dest_size >= kSize);
+    // Without ERMS, keep the default quadword copy.
+    if (x86_feature_test(X86_FEATURE_ERMS)) {
+        memcpy(patch->dest_addr, kRepMovsbInstruction, kSize);
+        memset(patch->dest_addr + kSize, kNopInstruction, patch->dest_size - kSize);
+    }
+}
+
 }
 
 static inline bool ac_flag(void)
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <arch/ops.h>
+#include <kernel/spinlock.h>
 #include <kernel/stats.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
@@ -18,14 +19,21 @@ __BEGIN_CDECLS
 struct percpu {
     /* per cpu timer queue */
     struct list_node timer_queue;
+    struct list_node timer_skip[TIMER_SKIP_LEVELS];
 
     /* per cpu preemption timer */
     timer_t preempt_timer;
 
-    /* per cpu run queue and bitmap to indicate which queues are non empty */
+    /* per cpu run queue and bitmap to indicate which queues are non empty.
+     * guarded by run_queue_lock, see the lock ordering notes in sched.c.
+     */
+    spin_lock_t run_queue_lock;
     struct list_node run_queue[NUM_PRIORITIES];
     uint32_t run_queue_bitmap;
 
+    /* number of threads in the run queue, used by idle balancing */
+    uint32_t run_queue_len;
+
     /* timestamp of the last reschedule IPI sent to this cpu */
     /* 0 means no pending IPI */
     zx_time_t ipi_timestamp;
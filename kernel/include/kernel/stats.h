@@ -19,6 +19,8 @@ struct cpu_stats {
     ulong irq_preempts;
     ulong preempts;
     ulong yields;
+    ulong steals; /* threads pulled from another cpu's run queue when going idle */
+    ulong handoffs; /* threads woken straight onto this cpu by a synchronous call or reply */
 
     /* cpu level interrupts and exceptions */
     ulong interrupts;  /* hardware interrupts, minus timer interrupts or inter-processor interrupts */
@@ -78,6 +78,12 @@ typedef void (*thread_tls_callback_t)(void* tls_value);
 
 struct vmm_aspace;
 
+enum thread_handoff {
+    THREAD_HANDOFF_NONE = 0,
+    THREAD_HANDOFF_ARMED, /* hand the cpu to the next thread we wake */
+    THREAD_HANDOFF_GIVEN, /* done, or given up on, until disarmed */
+};
+
 typedef struct thread {
     int magic;
     struct list_node thread_list_node;
@@ -98,6 +104,12 @@ typedef struct thread {
     cpu_num_t last_cpu;      /* last cpu the thread ran on, INVALID_CPU if it's never run */
     cpu_mask_t cpu_affinity; /* mask of cpus that this thread can run on */
 
+    /* cpu handoff on synchronous ipc, see thread_handoff_arm() */
+    enum thread_handoff handoff;
+    uint64_t handoff_id;    /* never reused, unlike the thread's address */
+    uint64_t handoff_donor; /* handoff_id of the thread that handed us its cpu, 0 if none */
+    zx_duration_t handoff_saved_slice; /* our own slice while running on the donor's */
+
     /* pointer to the kernel address space this thread is associated with */
     struct vmm_aspace* aspace;
 
@@ -213,6 +225,14 @@ void thread_preempt(void);    /* get preempted at irq time */
 void thread_reschedule(void); /* revaluate the run queue on the current cpu,
                                  can be used after waking up threads */
 
+/* Bracket a wakeup that the current thread is about to block behind, such as
+ * the request half of a synchronous call. The first thread woken while armed
+ * is queued to run next on this cpu with what is left of our time slice, and
+ * when it later wakes us back it hands the cpu and the rest of the slice back
+ * the same way. */
+void thread_handoff_arm(void);
+void thread_handoff_disarm(void);
+
 void thread_owner_name(thread_t* t, char out_name[THREAD_NAME_LENGTH]);
 
 // print the backtrace on the current thread
@@ -22,6 +22,14 @@ typedef enum handler_return (*timer_callback)(struct timer*, zx_time_t now, void
 
 #define TIMER_MAGIC (0x74696D72) //'timr'
 
+// Each cpu's timer queue is a sorted list of timers with a skip list index
+// over it, so that inserting a timer costs O(log n) instead of a walk over
+// every pending timer. A timer is linked into the index levels with
+// probability 1/TIMER_SKIP_FANOUT per level.
+#define TIMER_SKIP_LEVELS (4)
+#define TIMER_SKIP_FANOUT_SHIFT (3)
+#define TIMER_SKIP_FANOUT (1u << TIMER_SKIP_FANOUT_SHIFT)
+
 enum slack_mode {
     TIMER_SLACK_CENTER, // slack is centered arround dealine
     TIMER_SLACK_LATE,   // slack interval is [deadline, dealine + slack)
@@ -31,6 +39,7 @@ enum slack_mode {
 typedef struct timer {
     int magic;
     struct list_node node;
+    struct list_node skip[TIMER_SKIP_LEVELS];
 
     zx_time_t scheduled_time;
     int64_t slack; // Stores the applied slack adjustment from
@@ -42,16 +51,17 @@ typedef struct timer {
     volatile bool cancel;    // true if cancel is pending
 } timer_t;
 
-#define TIMER_INITIAL_VALUE(t)              \
-    {                                       \
-        .magic = TIMER_MAGIC,               \
-        .node = LIST_INITIAL_CLEARED_VALUE, \
-        .scheduled_time = 0,                \
-        .slack = 0,                         \
-        .callback = NULL,                   \
-        .arg = NULL,                        \
-        .active_cpu = -1,                   \
-        .cancel = false,                    \
+#define TIMER_INITIAL_VALUE(t)                \
+    {                                         \
+        .magic = TIMER_MAGIC,                 \
+        .node = LIST_INITIAL_CLEARED_VALUE,   \
+        .skip = {LIST_INITIAL_CLEARED_VALUE}, \
+        .scheduled_time = 0,                  \
+        .slack = 0,                           \
+        .callback = NULL,                     \
+        .arg = NULL,                          \
+        .active_cpu = -1,                     \
+        .cancel = false,                      \
     }
 
 /* Rules for Timers:
@@ -23,37 +23,28 @@ struct ktrace_probe_info {
     uint32_t num;
 } __ALIGNED(16); // align on multiple of 16 to match linker packing of the ktrace_probe section
 
-void* ktrace_open(uint32_t tag);
 void ktrace_tiny(uint32_t tag, uint32_t arg);
-static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
-    uint32_t* data = (uint32_t*) ktrace_open(tag);
-    if (data) {
-        data[0] = a; data[1] = b; data[2] = c; data[3] = d;
-    }
-}
+// Only the first KTRACE_LEN(tag) - 16 bytes of the arguments are recorded.
+// Returns false if the record was not written.
+bool ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
 #define _ktrace_probe_prologue(_name) \
     static ktrace_probe_info_t info = { NULL, _name, 0 };       \
     __USED __SECTION(".data.rel.ro.ktrace_probe")               \
     static ktrace_probe_info_t *const register_info = &info
 #define ktrace_probe0(_name) do {                               \
     _ktrace_probe_prologue(_name);                              \
-    ktrace_open(TAG_PROBE_16(info.num));                        \
+    ktrace(TAG_PROBE_16(info.num), 0, 0, 0, 0);                 \
 } while (0)
 #define ktrace_probe2(_name,arg0,arg1) do {                  \
     _ktrace_probe_prologue(_name);                           \
-    uint32_t* args = ktrace_open(TAG_PROBE_24(info.num));    \
-    if (args) {                                              \
-      args[0] = arg0;                                        \
-      args[1] = arg1;                                        \
-    }                                                        \
+    ktrace(TAG_PROBE_24(info.num), arg0, arg1, 0, 0);        \
 } while (0)
 void ktrace_name(uint32_t tag, uint32_t id, uint32_t arg, const char* name);
 int ktrace_read_user(void* ptr, uint32_t off, uint32_t len);
 zx_status_t ktrace_control(uint32_t action, uint32_t options, void* ptr);
 #else
-static inline void* ktrace_open(uint32_t tag) { return NULL; }
 static inline void ktrace_tiny(uint32_t tag, uint32_t arg) {}
-static inline void ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {}
+static inline bool ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) { return false; }
 static inline void ktrace_probe0(const char* name) {}
 static inline void ktrace_probe2(const char* name, uint32_t arg0, uint32_t arg1) {}
 static inline void ktrace_name(uint32_t tag, uint32_t id, uint32_t arg, const char* name) {}
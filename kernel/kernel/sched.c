@@ -194,14 +194,41 @@ static cpu_mask_t find_cpu_mask(thread_t* t) {
     return mask;
 }
 
+/* run queue locking.
+ * each cpu's run queue lists, bitmap and length are guarded by that cpu's
+ * run_queue_lock, so queue manipulation and inspection on one cpu only touch
+ * that cpu's cache lines. the ordering is:
+ *
+ *   thread_lock -> percpu[cpu].run_queue_lock
+ *
+ * a run queue lock may be taken with or without thread_lock held, always with
+ * interrupts disabled, but thread_lock must never be acquired while holding
+ * one. at most one run queue lock is held at a time; paths that move a thread
+ * between cpus (migration, stealing) drop the source cpu's lock before taking
+ * the destination's. a READY thread's queue_node and curr_cpu change only with
+ * both thread_lock and the run queue lock of the cpu it is queued on held, so
+ * either lock is enough to read them.
+ */
+static inline void run_queue_lock(cpu_num_t cpu) {
+    DEBUG_ASSERT(arch_ints_disabled());
+    spin_lock(&percpu[cpu].run_queue_lock);
+}
+
+static inline void run_queue_unlock(cpu_num_t cpu) {
+    spin_unlock(&percpu[cpu].run_queue_lock);
+}
+
 /* run queue manipulation */
 static void insert_in_run_queue_head(cpu_num_t cpu, thread_t* t) {
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
 
     int ep = effec_priority(t);
 
+    run_queue_lock(cpu);
     list_add_head(&percpu[cpu].run_queue[ep], &t->queue_node);
     percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_len++;
+    run_queue_unlock(cpu);
 
     /* mark the cpu as busy since the run queue now has at least one item in it */
     mp_set_cpu_busy(cpu);
@@ -212,33 +239,62 @@ static void insert_in_run_queue_tail(cpu_num_t cpu, thread_t* t) {
 
     int ep = effec_priority(t);
 
+    run_queue_lock(cpu);
     list_add_tail(&percpu[cpu].run_queue[ep], &t->queue_node);
     percpu[cpu].run_queue_bitmap |= (1u << ep);
+    percpu[cpu].run_queue_len++;
+    run_queue_unlock(cpu);
 
     /* mark the cpu as busy since the run queue now has at least one item in it */
     mp_set_cpu_busy(cpu);
 }
 
+/* pull a ready thread out of the run queue of the cpu it is waiting on */
+static void remove_from_run_queue(thread_t* t) {
+    DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
+    DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
+
+    cpu_num_t cpu = t->curr_cpu;
+    struct percpu* c = &percpu[cpu];
+    int pri = effec_priority(t);
+
+    run_queue_lock(cpu);
+    list_delete(&t->queue_node);
+    c->run_queue_len--;
+    if (list_is_empty(&c->run_queue[pri])) {
+        c->run_queue_bitmap &= ~(1u << pri);
+    }
+    run_queue_unlock(cpu);
+}
+
 static thread_t* sched_get_top_thread(cpu_num_t cpu) {
     /* pop the head of the highest priority queue with any threads
      * queued up on the passed in cpu.
      */
     struct percpu* c = &percpu[cpu];
+    thread_t* newthread = NULL;
+
+    run_queue_lock(cpu);
     if (likely(c->run_queue_bitmap)) {
         uint highest_queue = HIGHEST_PRIORITY - __builtin_clz(c->run_queue_bitmap) -
                              (sizeof(c->run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
 
-        thread_t* newthread = list_remove_head_type(&c->run_queue[highest_queue], thread_t, queue_node);
+        newthread = list_remove_head_type(&c->run_queue[highest_queue], thread_t, queue_node);
 
         DEBUG_ASSERT(newthread);
+
+        c->run_queue_len--;
+        if (list_is_empty(&c->run_queue[highest_queue]))
+            c->run_queue_bitmap &= ~(1u << highest_queue);
+    }
+    run_queue_unlock(cpu);
+
+    if (likely(newthread)) {
         DEBUG_ASSERT_MSG(newthread->cpu_affinity & cpu_num_to_mask(cpu),
                          "thread %p name %s, aff %#x cpu %u\n", newthread, newthread->name,
                          newthread->cpu_affinity, cpu);
         DEBUG_ASSERT(newthread->curr_cpu == cpu);
 
-        if (list_is_empty(&c->run_queue[highest_queue]))
-            c->run_queue_bitmap &= ~(1u << highest_queue);
-
         LOCAL_KTRACE2("sched_get_top", newthread->priority_boost, newthread->base_priority);
 
         return newthread;
@@ -248,6 +304,114 @@ static thread_t* sched_get_top_thread(cpu_num_t cpu) {
     return &c->idle_thread;
 }
 
+/* maximum number of queued threads to examine on the victim cpu when stealing */
+#define STEAL_SCAN_LIMIT 16
+
+/* find the cpu other than |cpu| with the deepest run queue, or INVALID_CPU if every
+ * other queue is empty.
+ */
+static cpu_num_t find_busiest_cpu(cpu_num_t cpu) {
+    cpu_mask_t active = mp_get_active_mask() & ~cpu_num_to_mask(cpu);
+    cpu_num_t busiest = INVALID_CPU;
+    uint32_t busiest_len = 0;
+
+    while (active) {
+        cpu_num_t i = lowest_cpu_set(active);
+        active &= ~cpu_num_to_mask(i);
+
+        /* a racy read, taking every cpu's run queue lock just to pick a victim
+         * isn't worth it; sched_steal_thread rechecks under the victim's lock */
+        uint32_t len = __atomic_load_n(&percpu[i].run_queue_len, __ATOMIC_RELAXED);
+        if (len > busiest_len) {
+            busiest = i;
+            busiest_len = len;
+        }
+    }
+    return busiest;
+}
+
+/* called when |cpu| has nothing to run: pull a ready thread off the busiest other
+ * cpu's run queue, if there is one this cpu is allowed to run.
+ * only the highest priority queue holding an eligible thread is considered, so a lower
+ * priority thread is never taken ahead of a higher priority one. within it, prefer one
+ * that last ran here (its cache state may still be warm), then one that did not last run
+ * on the victim, then anything eligible.
+ */
+static thread_t* sched_steal_thread(cpu_num_t cpu) {
+    cpu_num_t victim = find_busiest_cpu(cpu);
+    if (victim == INVALID_CPU)
+        return NULL;
+
+    struct percpu* c = &percpu[victim];
+    cpu_mask_t cpu_mask = cpu_num_to_mask(cpu);
+    thread_t* best = NULL;
+    int best_rank = 0;
+    uint scanned = 0;
+
+    run_queue_lock(victim);
+    uint32_t bitmap = c->run_queue_bitmap;
+    while (bitmap && scanned < STEAL_SCAN_LIMIT && !best) {
+        uint queue = HIGHEST_PRIORITY - __builtin_clz(bitmap) -
+                     (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
+        bitmap &= ~(1u << queue);
+
+        thread_t* t;
+        list_for_every_entry (&c->run_queue[queue], t, thread_t, queue_node) {
+            if (++scanned > STEAL_SCAN_LIMIT)
+                break;
+            if (!(t->cpu_affinity & cpu_mask))
+                continue;
+
+            int rank = (t->last_cpu == cpu) ? 3 : (t->last_cpu != victim) ? 2 : 1;
+            if (rank > best_rank) {
+                best = t;
+                best_rank = rank;
+                if (rank == 3)
+                    break;
+            }
+        }
+    }
+
+    if (best) {
+        int pri = effec_priority(best);
+        list_delete(&best->queue_node);
+        c->run_queue_len--;
+        if (list_is_empty(&c->run_queue[pri]))
+            c->run_queue_bitmap &= ~(1u << pri);
+        best->curr_cpu = cpu;
+    }
+    run_queue_unlock(victim);
+
+    if (best) {
+        ktrace_probe2("sched_steal", victim, (uint32_t)best->user_tid);
+        CPU_STATS_INC(steals);
+    }
+
+    return best;
+}
+
+/* true if |oldthread| was put back in this cpu's run queue and is not the thread
+ * about to run, so it waits behind |newthread|.
+ */
+static inline bool oldthread_requeued(thread_t* oldthread, thread_t* newthread) {
+    return oldthread->state == THREAD_READY && oldthread != newthread &&
+           !thread_is_idle(oldthread);
+}
+
+/* |t| is waiting in |cpu|'s run queue. if an idle cpu that may run it is sitting in
+ * its idle loop, send it a reschedule so that it steals work from us rather than
+ * staying idle. idle cpus otherwise only look for work when something wakes them.
+ */
+static void sched_kick_idle_cpu(cpu_num_t cpu, thread_t* t) {
+    cpu_mask_t idle = mp_get_idle_mask() & mp_get_active_mask() & t->cpu_affinity &
+                      ~cpu_num_to_mask(cpu);
+    if (idle == 0)
+        return;
+
+    LOCAL_KTRACE2("sched_kick_idle", cpu, lowest_cpu_set(idle));
+    mp_reschedule(MP_IPI_TARGET_MASK, cpu_num_to_mask(lowest_cpu_set(idle)), 0);
+}
+
 void sched_block(void) {
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
@@ -287,6 +451,73 @@ static void find_cpu_and_insert(thread_t* t, bool* local_resched, cpu_mask_t* ac
     }
 }
 
+/* A thread running on a slice donated by its handoff_donor goes back to its own
+ * slice, as saved when it was handed the cpu. It is charged for the time it
+ * has run since it was last switched in, which was spent on the donated slice,
+ * so credit that back.
+ */
+static void sched_end_handoff(thread_t* t, zx_duration_t used) {
+    t->handoff_donor = 0;
+    t->remaining_time_slice = t->handoff_saved_slice + used;
+}
+
+/* If the current thread is handing its cpu over on a synchronous call, or is
+ * waking the thread that handed it the cpu, queue |t| to run next on this cpu
+ * with what is left of the current time slice rather than placing it by load.
+ * The slice is donated: the caller keeps none of it, and the server gets its
+ * own back once it replies. Returns false if |t| still needs a cpu found for
+ * it.
+ */
+static bool sched_try_handoff(thread_t* t, bool* local_resched) {
+    if (arch_in_int_handler())
+        return false;
+
+    thread_t* current_thread = get_current_thread();
+    /* compared by id, since the donor may have exited and its memory been
+     * reused for |t| */
+    bool reply = (t->handoff_id == current_thread->handoff_donor);
+
+    if (current_thread->handoff != THREAD_HANDOFF_ARMED && !reply)
+        return false;
+
+    zx_duration_t used = current_time() - current_thread->last_started_running;
+    zx_duration_t left = current_thread->remaining_time_slice -
+                         MIN(used, current_thread->remaining_time_slice);
+
+    /* only once per arm, and only between ordinary threads */
+    if (reply)
+        sched_end_handoff(current_thread, used);
+    else
+        current_thread->handoff = THREAD_HANDOFF_GIVEN;
+    if (thread_is_real_time_or_idle(current_thread) || thread_is_real_time_or_idle(t))
+        return false;
+
+    cpu_num_t curr_cpu = arch_curr_cpu_num();
+    if (!(t->cpu_affinity & cpu_num_to_mask(curr_cpu)) || !mp_is_cpu_active(curr_cpu))
+        return false;
+
+    if (left == 0)
+        return false;
+
+    if (!reply) {
+        /* what is left goes to |t|; charging us for it empties our slice */
+        current_thread->remaining_time_slice = used;
+        t->handoff_saved_slice = t->remaining_time_slice;
+        t->handoff_donor = current_thread->handoff_id;
+    }
+    t->remaining_time_slice = left;
+    t->curr_cpu = curr_cpu;
+    insert_in_run_queue_head(curr_cpu, t);
+
+    /* on a call the caller is about to block, which will switch to |t| */
+    if (reply)
+        *local_resched = true;
+
+    LOCAL_KTRACE2("sched_handoff", (uint32_t)t->user_tid, reply);
+    CPU_STATS_INC(handoffs);
+    return true;
+}
+
 bool sched_unblock(thread_t* t) {
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
@@ -302,7 +533,8 @@ bool sched_unblock(thread_t* t) {
 
     bool local_resched = false;
     cpu_mask_t mask = 0;
-    find_cpu_and_insert(t, &local_resched, &mask);
+    if (!sched_try_handoff(t, &local_resched))
+        find_cpu_and_insert(t, &local_resched, &mask);
 
     if (mask)
         mp_reschedule(MP_IPI_TARGET_MASK, mask, 0);
@@ -328,7 +560,8 @@ bool sched_unblock_list(struct list_node* list) {
 
         /* stuff the new thread in the run queue */
         t->state = THREAD_READY;
-        find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
+        if (!sched_try_handoff(t, &local_resched))
+            find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
     }
 
     if (accum_cpu_mask)
@@ -522,16 +755,7 @@ void sched_migrate(thread_t* t) {
         }
 
         // it's sitting in a run queue somewhere, so pull it out of that one and find a new home
-        DEBUG_ASSERT_MSG(list_in_list(&t->queue_node), "thread %p name %s curr_cpu %u\n", t, t->name, t->curr_cpu);
-        list_delete(&t->queue_node);
-
-        DEBUG_ASSERT(is_valid_cpu_num(t->curr_cpu));
-
-        struct percpu* c = &percpu[t->curr_cpu];
-        int pri = effec_priority(t);
-        if (list_is_empty(&c->run_queue[pri])) {
-            c->run_queue_bitmap &= ~(1u << pri);
-        }
+        remove_from_run_queue(t);
 
         find_cpu_and_insert(t, &local_resched, &accum_cpu_mask);
         break;
@@ -609,6 +833,22 @@ void sched_resched_internal(void) {
     /* pick a new thread to run */
     thread_t* newthread = sched_get_top_thread(cpu);
 
+    /* about to go or stay idle, see if another cpu has work queued up we could take.
+     * this covers both a busy cpu running out of work and an idle cpu kicked by
+     * sched_kick_idle_cpu() below. */
+    if (thread_is_idle(newthread) && mp_is_cpu_active(cpu)) {
+        thread_t* stolen = sched_steal_thread(cpu);
+        if (stolen) {
+            newthread = stolen;
+            /* we may have been marked idle already */
+            mp_set_cpu_busy(cpu);
+        }
+    }
+
+    /* the old thread went back in our queue behind other work: let an idle cpu pull it */
+    if (oldthread_requeued(current_thread, newthread))
+        sched_kick_idle_cpu(current_thread->curr_cpu, current_thread);
+
     DEBUG_ASSERT(newthread);
 
     newthread->state = THREAD_RUNNING;
@@ -638,8 +878,13 @@ void sched_resched_internal(void) {
     newthread->last_started_running = now;
 
     /* mark the cpu ownership of the threads */
-    if (oldthread->state != THREAD_READY)
+    if (oldthread->state != THREAD_READY) {
         oldthread->curr_cpu = INVALID_CPU;
+        /* a server that blocks again before replying gives up the handoff,
+         * and with it the rest of the donated slice */
+        if (oldthread->handoff_donor != 0)
+            sched_end_handoff(oldthread, 0);
+    }
     newthread->last_cpu = cpu;
     newthread->curr_cpu = cpu;
 
@@ -733,7 +978,9 @@ void sched_resched_internal(void) {
 
 void sched_init_early(void) {
     /* initialize the run queues */
-    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init(&percpu[cpu].run_queue_lock);
         for (unsigned int i = 0; i < NUM_PRIORITIES; i++)
             list_initialize(&percpu[cpu].run_queue[i]);
+    }
 }
@@ -63,6 +63,9 @@ static struct list_node thread_list = LIST_INITIAL_VALUE(thread_list);
 /* master thread spinlock */
 spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
 
+/* source of thread_t::handoff_id */
+static uint64_t thread_next_handoff_id;
+
 /* local routines */
 static int idle_thread_routine(void*) __NO_RETURN;
 static void thread_exit_locked(thread_t* current_thread, int retcode) __NO_RETURN;
@@ -71,6 +74,7 @@ static void thread_do_suspend(void);
 static void init_thread_struct(thread_t* t, const char* name) {
     memset(t, 0, sizeof(thread_t));
     t->magic = THREAD_MAGIC;
+    t->handoff_id = atomic_add_u64(&thread_next_handoff_id, 1) + 1;
     strlcpy(t->name, name, sizeof(t->name));
     wait_queue_init(&t->retcode_wait_queue);
 }
@@ -817,6 +821,10 @@ void thread_reschedule(void) {
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(!arch_in_int_handler());
 
+    /* about to block behind a handoff, which will switch soon enough */
+    if (current_thread->handoff != THREAD_HANDOFF_NONE)
+        return;
+
     THREAD_LOCK(state);
 
     sched_reschedule();
@@ -824,6 +832,19 @@ void thread_reschedule(void) {
     THREAD_UNLOCK(state);
 }
 
+void thread_handoff_arm(void) {
+    thread_t* current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    current_thread->handoff = THREAD_HANDOFF_ARMED;
+}
+
+void thread_handoff_disarm(void) {
+    get_current_thread()->handoff = THREAD_HANDOFF_NONE;
+}
+
 /* timer callback to wake up a sleeping thread */
 static enum handler_return thread_sleep_handler(timer_t* timer, zx_time_t now, void* arg) {
     thread_t* t = (thread_t*)arg;
@@ -43,6 +43,76 @@ void timer_init(timer_t* timer) {
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
+// The timer queue is made of TIMER_QUEUE_LEVELS sorted lists. Level 0 is the
+// full queue, threaded through timer->node, and each level above it holds a
+// sparser subset of the level below, threaded through timer->skip[].
+#define TIMER_QUEUE_LEVELS (TIMER_SKIP_LEVELS + 1)
+
+// State of the generator used to pick skip levels, guarded by timer_lock.
+static uint32_t timer_skip_seed = 1;
+
+static struct list_node* queue_level_head(uint cpu, uint level) {
+    return (level == 0) ? &percpu[cpu].timer_queue : &percpu[cpu].timer_skip[level - 1];
+}
+
+static struct list_node* timer_level_node(timer_t* timer, uint level) {
+    return (level == 0) ? &timer->node : &timer->skip[level - 1];
+}
+
+static timer_t* level_node_to_timer(struct list_node* node, uint level) {
+    return (level == 0) ? containerof(node, timer_t, node)
+                        : (timer_t*)((uintptr_t)(node - (level - 1)) - offsetof(timer_t, skip));
+}
+
+// Finds, on every level of |cpu|'s queue, the last node scheduled before
+// |deadline|, or at |deadline| if |inclusive| is set. A level with no such
+// node yields its list head.
+static void timer_queue_search(uint cpu, zx_time_t deadline, bool inclusive,
+                               struct list_node* preds[TIMER_QUEUE_LEVELS]) {
+    timer_t* pred = NULL;
+
+    for (int level = TIMER_QUEUE_LEVELS - 1; level >= 0; level--) {
+        struct list_node* head = queue_level_head(cpu, level);
+        struct list_node* pos = pred ? timer_level_node(pred, level) : head;
+
+        while (pos->next != head) {
+            timer_t* next = level_node_to_timer(pos->next, level);
+            if (next->scheduled_time > deadline ||
+                (!inclusive && next->scheduled_time == deadline)) {
+                break;
+            }
+            pred = next;
+            pos = pos->next;
+        }
+        preds[level] = pos;
+    }
+}
+
+// Links |timer| after |preds| on level 0 and on a random number of the
+// levels above it.
+static void timer_queue_link(timer_t* timer, struct list_node* preds[TIMER_QUEUE_LEVELS]) {
+    uint32_t x = timer_skip_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    timer_skip_seed = x;
+
+    list_add_after(preds[0], &timer->node);
+    for (uint level = 1; level < TIMER_QUEUE_LEVELS; level++) {
+        if ((x & (TIMER_SKIP_FANOUT - 1)) != 0)
+            break;
+        list_add_after(preds[level], &timer->skip[level - 1]);
+        x >>= TIMER_SKIP_FANOUT_SHIFT;
+    }
+}
+
+static void timer_queue_remove(timer_t* timer) {
+    list_delete(&timer->node);
+    for (uint i = 0; i < TIMER_SKIP_LEVELS && list_in_list(&timer->skip[i]); i++) {
+        list_delete(&timer->skip[i]);
+    }
+}
+
 static void insert_timer_in_queue(uint cpu, timer_t* timer,
                                   uint64_t early_slack, uint64_t late_slack) {
 
@@ -53,108 +123,73 @@ static void insert_timer_in_queue(uint cpu, timer_t* timer,
     zx_time_t latest_deadline = timer->scheduled_time + late_slack;
 
     // For inserting the timer we consider several cases. In general we
-    // want to coalesce with the current timer unless we can prove that
+    // want to coalesce with an existing timer unless we can prove that
     // either that:
-    //  1- there is no slack overlap with current timer OR
-    //  2- the next timer is a better fit.
+    //  1- there is no slack overlap with it OR
+    //  2- the following timer is a better fit.
+    //
+    // Only the two timers around the new deadline can be candidates, so
+    // find them through the index rather than walking the queue.
     //
     // In diagrams that follow
-    // - Let |e| be the current (existing) timer deadline
+    // - Let |e| be the last timer deadline before |t|, if any
     // - Let |t| be the deadline of the timer we are inserting
-    // - Let |n| be the next timer deadline if any
-    // - Let |x| be the end of the list (not a timer)
+    // - Let |n| be the timer deadline following |e|, if any
     // - Let |(| and |)| the earliest_deadline and latest_deadline.
     //
-    timer_t* entry;
-
-    list_for_every_entry (&percpu[cpu].timer_queue, entry, timer_t, node) {
-        if (entry->scheduled_time > latest_deadline) {
-            // New timer latest is earlier than the current timer.
-            // Just add upfront as is, without slack.
-            //
-            //   ---------t---)--e-------------------------------> time
-            //
-            timer->slack = 0ull;
-            list_add_before(&entry->node, &timer->node);
-            return;
-        }
+    struct list_node* preds[TIMER_QUEUE_LEVELS];
+    timer_queue_search(cpu, timer->scheduled_time, false, preds);
 
-        if (entry->scheduled_time >= timer->scheduled_time) {
-            //  New timer slack overlaps and is to the left (or equal). We
-            //  coalesce with current by scheduling late.
-            //
-            //  --------(----t---e-)----------------------------> time
-            //
-            timer->slack = entry->scheduled_time - timer->scheduled_time;
-            timer->scheduled_time = entry->scheduled_time;
-            list_add_after(&entry->node, &timer->node);
-            return;
-        }
+    struct list_node* queue = &percpu[cpu].timer_queue;
+    timer_t* entry = (preds[0] != queue) ? containerof(preds[0], timer_t, node) : NULL;
+    timer_t* next = list_next_type(queue, preds[0], timer_t, node);
 
-        if (entry->scheduled_time < earliest_deadline) {
-            // new timer earliest is later than the current timer. This case
-            // is handled in a future iteration.
-            //
-            //   ----------------e--(---t-----------------------> time
-            //
-            continue;
-        }
-
-        // New timer is to the right of current timer and there is overlap
-        // with the current timer, but could the next timer (if any) be
-        // a better fit?
+    if (entry != NULL && entry->scheduled_time >= earliest_deadline) {
+        // New timer is to the right of |e| and there is overlap with it,
+        // but could the next timer (if any) be a better fit?
         //
         //  -------------(--e---t-----?-------------------> time
         //
-
-        const timer_t* next =
-            list_next_type(&percpu[cpu].timer_queue, &entry->node, timer_t, node);
-
-        if (next != NULL) {
-            if (next->scheduled_time <= timer->scheduled_time) {
-                // The new timer is to the right of the next timer. There is no
-                // chance the current timer is a better fit.
-                //
-                //  -------------(--e---n---t----------------------> time
-                //
-                continue;
-            }
-
-            if (next->scheduled_time < latest_deadline) {
-                // There is slack overlap with the next timer, and also with the
-                // current timer. Which coalescing is a better match?
-                //
-                //  --------------(-e---t---n-)-----------------------> time
-                //
-                zx_duration_t delta_entry = timer->scheduled_time - entry->scheduled_time;
-                zx_duration_t delta_next = next->scheduled_time - timer->scheduled_time;
-                if (delta_next < delta_entry) {
-                    // New timer is closer to the next timer, handle it in the
-                    // next iteration.
-                    continue;
-                }
-            }
+        // We coalesce by scheduling early unless
+        //
+        //  --------------(-e---t---n-)-----------------------> time
+        //
+        // the next timer is due exactly when the new one is, or there is
+        // slack overlap with it too and the new timer is strictly closer to it.
+        bool next_is_closer =
+            next != NULL &&
+            (next->scheduled_time == timer->scheduled_time ||
+             (next->scheduled_time < latest_deadline &&
+              (next->scheduled_time - timer->scheduled_time) <
+                  (timer->scheduled_time - entry->scheduled_time)));
+
+        if (!next_is_closer) {
+            timer->slack = entry->scheduled_time - timer->scheduled_time;
+            timer->scheduled_time = entry->scheduled_time;
+            timer_queue_link(timer, preds);
+            return;
         }
+    }
 
-        // Handles the remaining cases, note that there is overlap with
-        // the current timer.
-        //
-        //  1- this is the last timer (next == NULL) or
-        //  2- there is no overlap with the next timer, or
-        //  3- there is overlap with both current and next but
-        //     current is closer.
+    if (next != NULL && next->scheduled_time <= latest_deadline) {
+        //  New timer slack overlaps and is to the left (or equal). We
+        //  coalesce with |n| by scheduling late.
         //
-        //  So we coalesce by scheduling early.
+        //  --------(----t---n-)----------------------------> time
         //
-        timer->slack = entry->scheduled_time - timer->scheduled_time;
-        timer->scheduled_time = entry->scheduled_time;
-        list_add_after(&entry->node, &timer->node);
+        timer->slack = next->scheduled_time - timer->scheduled_time;
+        timer->scheduled_time = next->scheduled_time;
+        timer_queue_search(cpu, timer->scheduled_time, true, preds);
+        timer_queue_link(timer, preds);
         return;
     }
 
-    // Walked off the end of the list and there was no overlap.
+    // There is no overlap with a neighbor. Just add it as is, without slack.
+    //
+    //   ---e---(---t---)--n-------------------------------> time
+    //
     timer->slack = 0ull;
-    list_add_tail(&percpu[cpu].timer_queue, &timer->node);
+    timer_queue_link(timer, preds);
 }
 
 void timer_set(timer_t* timer, zx_time_t deadline,
@@ -253,7 +288,7 @@ void timer_reset_oneshot_local(timer_t* timer, zx_time_t deadline, timer_callbac
 
     /* remove it from the queue if it was present */
     if (list_in_list(&timer->node))
-        list_delete(&timer->node);
+        timer_queue_remove(timer);
 
     /* set up the structure */
     timer->scheduled_time = deadline;
@@ -312,7 +347,7 @@ bool timer_cancel(timer_t* timer) {
         timer_t* oldhead = list_peek_head_type(&percpu[cpu].timer_queue, timer_t, node);
 
         /* remove our timer from the queue */
-        list_delete(&timer->node);
+        timer_queue_remove(timer);
 
         /* TODO(cpu): if  after removing |timer| there is one other single timer with
            the same scheduled_time and slack non-zero then it is possible to return
@@ -378,7 +413,7 @@ enum handler_return timer_tick(zx_time_t now) {
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                          "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                          timer, (uint)timer->magic);
-        list_delete(&timer->node);
+        timer_queue_remove(timer);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
@@ -451,7 +486,7 @@ void timer_transition_off_cpu(uint old_cpu) {
     timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
     list_for_every_entry_safe (&percpu[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+        timer_queue_remove(entry);
         // We lost the original asymmetric slack information so when we combine them
         // with the other timer queue they are not coalesced again.
         // TODO(cpu): figure how important this case is.
@@ -487,6 +522,9 @@ void timer_queue_init(void) {
     timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
         list_initialize(&percpu[i].timer_queue);
+        for (uint level = 0; level < TIMER_SKIP_LEVELS; level++) {
+            list_initialize(&percpu[i].timer_skip[level]);
+        }
     }
 }
 
@@ -26,6 +26,26 @@
     .quad size_in_bytes; /* dest_size field */                            \
     .popsection
 
+// Like APPLY_CODE_PATCH_FUNC, but the placeholder holds working default
+// code, padded to |size_in_bytes| with |fill_byte|, rather than traps.  This
+// is for code that may run before patches are applied, such as memcpy.  The
+// patch function may leave the default code in place.
+#define APPLY_CODE_PATCH_FUNC_WITH_DEFAULT(patch_func, size_in_bytes,    \
+                                           fill_byte, default_code...)   \
+    0:                                                                    \
+    default_code;                                                         \
+    1:                                                                    \
+    .if (1b - 0b) > size_in_bytes;                                        \
+    .error "default code does not fit in the patch placeholder";          \
+    .endif;                                                               \
+    .fill size_in_bytes - (1b - 0b), 1, fill_byte;                        \
+    .pushsection code_patch_table,"a",%progbits;                          \
+    .balign 8;                                                            \
+    .quad patch_func; /* apply_func field */                              \
+    .quad 0b; /* dest_addr field */                                       \
+    .quad size_in_bytes; /* dest_size field */                            \
+    .popsection
+
 #else
 
 #include <stdint.h>
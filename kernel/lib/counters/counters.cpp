@@ -5,12 +5,16 @@
 // https://opensource.org/licenses/MIT
 
 #include <lib/counters.h>
+#include <lib/counters/vmo.h>
 
 #include <string.h>
 
 #include <arch/ops.h>
 #include <kernel/cmdline.h>
 #include <kernel/percpu.h>
+#include <vm/vm.h>
+#include <vm/vm_object_paged.h>
+#include <zircon/kcounters.h>
 
 #include <lk/init.h>
 
@@ -51,6 +55,63 @@ static void counters_init(unsigned level) {
     }
 }
 
+fbl::RefPtr<VmObject> kcounters_desc_vmo;
+fbl::RefPtr<VmObject> kcounters_arena_vmo;
+
+static zx_status_t make_desc_vmo(fbl::RefPtr<VmObject>* out) {
+    const size_t num_counters = get_num_counters();
+    const size_t size = sizeof(kcounters_desc_t) + num_counters * sizeof(kcounter_desc_entry_t);
+
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, ROUNDUP_PAGE_SIZE(size), &vmo);
+    if (status != ZX_OK)
+        return status;
+
+    size_t actual;
+    const kcounters_desc_t header = {
+        KCOUNTERS_MAGIC, SMP_MAX_CPUS, static_cast<uint32_t>(num_counters)};
+    status = vmo->Write(&header, 0, sizeof(header), &actual);
+    for (size_t ix = 0; ix != num_counters && status == ZX_OK; ++ix) {
+        kcounter_desc_entry_t entry = {};
+        if (strlcpy(entry.name, kcountdesc_begin[ix].name, sizeof(entry.name)) >=
+            sizeof(entry.name)) {
+            printf("kcounters: name truncated: %s\n", kcountdesc_begin[ix].name);
+        }
+        status = vmo->Write(&entry, sizeof(header) + ix * sizeof(entry), sizeof(entry), &actual);
+    }
+    if (status != ZX_OK)
+        return status;
+
+    *out = fbl::move(vmo);
+    return ZX_OK;
+}
+
+// Wrap the names and the arena in VMOs so that userspace can sample the
+// counters without going through the console. kernel.ld gives the arena
+// whole pages of its own, so nothing else in .bss is exposed. The VMO
+// takes the arena's pages as its own, so our reference must never be
+// dropped.
+static void counters_vmo_init(unsigned level) {
+    static const char kDescName[] = "counters/desc";
+    static const char kArenaName[] = "counters/arena";
+
+    zx_status_t status = make_desc_vmo(&kcounters_desc_vmo);
+    if (status == ZX_OK) {
+        kcounters_desc_vmo->set_name(kDescName, sizeof(kDescName) - 1);
+
+        const size_t arena_size = get_num_counters() * SMP_MAX_CPUS * sizeof(uint64_t);
+        status = VmObjectPaged::CreateFromROData(kcounters_arena,
+                                                 ROUNDUP_PAGE_SIZE(arena_size),
+                                                 &kcounters_arena_vmo);
+    }
+    if (status != ZX_OK) {
+        printf("kcounters: cannot create VMOs: %d\n", status);
+        kcounters_desc_vmo.reset();
+        return;
+    }
+    kcounters_arena_vmo->set_name(kArenaName, sizeof(kArenaName) - 1);
+}
+
 static void dump_counter(const k_counter_desc* desc) {
     size_t counter_index = kcounter_index(desc);
 
@@ -107,6 +168,7 @@ static int get_counter(int argc, const cmd_args* argv, uint32_t flags) {
 }
 
 LK_INIT_HOOK(kcounters, counters_init, LK_INIT_LEVEL_PLATFORM_EARLY);
+LK_INIT_HOOK(kcounters_vmo, counters_vmo_init, LK_INIT_LEVEL_VM);
 
 STATIC_COMMAND_START
 STATIC_COMMAND("counters", "get counter", &get_counter)
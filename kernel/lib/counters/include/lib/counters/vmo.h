@@ -0,0 +1,16 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <fbl/ref_ptr.h>
+#include <vm/vm_object.h>
+
+// These are read in kernel/lib/userboot/userboot.cpp, in order to pass the
+// VmObjects on to devmgr (where they're added to the filesystem). See
+// <zircon/kcounters.h> for their layout.
+extern fbl::RefPtr<VmObject> kcounters_desc_vmo;
+extern fbl::RefPtr<VmObject> kcounters_arena_vmo;
@@ -38,6 +38,13 @@ public:
         return data_.InRange(static_cast<char*>(addr));
     }
 
+    // Like in_range(), but may be called without the caller's lock. Data
+    // slots are never handed back to their pool, so an address that has
+    // been in range stays in range and stays committed.
+    bool in_range_unlocked(void* addr) const {
+        return data_.InRangeUnlocked(static_cast<char*>(addr));
+    }
+
     void* start() const { return data_.start(); }
     void* end() const { return data_.end(); }
 
@@ -87,6 +94,12 @@ private:
             return (addr >= start_ && addr < top_);
         }
 
+        // Like InRange, but safe against a concurrent Pop.
+        bool InRangeUnlocked(void* addr) const {
+            return (addr >= start_ &&
+                    addr < __atomic_load_n(&top_, __ATOMIC_ACQUIRE));
+        }
+
         // The lowest address of the memory managed by this Pool.
         // Pop will only return values > |start| (besides nullptr).
         char* start() const { return start_; }
@@ -15,11 +15,15 @@
 #include <err.h>
 #include <list.h>
 #include <arch/ops.h>
+#include <kernel/auto_lock.h>
 #include <kernel/spinlock.h>
 #include <vm/vm.h>
 #include <vm/pmm.h>
 #include <lib/cmpctmalloc.h>
 #include <lib/console.h>
+#include <lib/counters.h>
+#include <lk/init.h>
+#include <pow2.h>
 
 #define LOCAL_TRACE 0
 
@@ -38,6 +42,198 @@ static bool heap_trace = false;
 #define heap_trace (false)
 #endif
 
+KCOUNTER(heap_cache_hit_count, "kernel.heap.cache.hit");
+KCOUNTER(heap_cache_miss_count, "kernel.heap.cache.miss");
+KCOUNTER(heap_lock_count, "kernel.heap.lock");
+
+/*
+ * Per-cpu caches of small free blocks in front of cmpctmalloc, one stack of
+ * blocks per power of two size bucket. malloc and free of small sizes are
+ * normally satisfied by the current cpu's cache under a cpu local spinlock;
+ * the heap lock is only taken to move a batch of blocks at a time. Cached
+ * blocks are still allocated as far as cmpctmalloc is concerned.
+ *
+ * The caches are enabled once kcounters are up, before that everything goes
+ * straight to cmpctmalloc.
+ */
+namespace {
+
+/* buckets are 16, 32, ..., 1024 bytes */
+constexpr size_t kHeapCacheMinShift = 4;
+constexpr size_t kHeapCacheMaxShift = 10;
+constexpr size_t kHeapCacheBuckets = kHeapCacheMaxShift - kHeapCacheMinShift + 1;
+/* blocks moved between a cache and the heap at once */
+constexpr size_t kHeapCacheBatch = 16;
+/* most blocks a bucket holds; freeing into a full bucket returns a batch */
+constexpr size_t kHeapCacheMax = 2 * kHeapCacheBatch;
+
+struct HeapCacheBucket {
+    size_t count;
+    void *blocks[kHeapCacheMax];
+};
+
+struct HeapCache {
+    SpinLock lock;
+    HeapCacheBucket buckets[kHeapCacheBuckets] TA_GUARDED(lock);
+} __CPU_ALIGN;
+
+HeapCache heap_cache[SMP_MAX_CPUS];
+bool heap_cache_enabled;
+
+/* the bucket whose blocks can hold |size| bytes */
+size_t heap_cache_alloc_bucket(size_t size)
+{
+    if (size <= (1u << kHeapCacheMinShift))
+        return 0;
+    return log2_ulong_ceil(size) - kHeapCacheMinShift;
+}
+
+/* the bucket a free block of |usable| bytes belongs in, or kHeapCacheBuckets if none */
+size_t heap_cache_free_bucket(size_t usable)
+{
+    if (usable < (1u << kHeapCacheMinShift) || usable >= (2u << kHeapCacheMaxShift))
+        return kHeapCacheBuckets;
+    return log2_ulong_floor(usable) - kHeapCacheMinShift;
+}
+
+/* pops a block from |bucket| of the current cpu's cache, or returns nullptr if it is empty */
+void *heap_cache_pop(size_t bucket)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HeapCache &cache = heap_cache[arch_curr_cpu_num()];
+
+    void *ptr = nullptr;
+    cache.lock.Acquire();
+    HeapCacheBucket &b = cache.buckets[bucket];
+    if (b.count > 0)
+        ptr = b.blocks[--b.count];
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return ptr;
+}
+
+/*
+ * pushes |count| blocks into |bucket| of the current cpu's cache. Whatever
+ * does not fit, plus a batch of the bucket's coldest blocks to leave room for
+ * later frees, is moved to |overflow|; returns the number of blocks moved there.
+ */
+size_t heap_cache_push(size_t bucket, void *const *ptrs, size_t count, void **overflow)
+{
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HeapCache &cache = heap_cache[arch_curr_cpu_num()];
+
+    size_t spilled = 0;
+    cache.lock.Acquire();
+    HeapCacheBucket &b = cache.buckets[bucket];
+    size_t i = 0;
+    while (i < count && b.count < kHeapCacheMax)
+        b.blocks[b.count++] = ptrs[i++];
+    if (i < count) {
+        for (; spilled < kHeapCacheBatch; spilled++)
+            overflow[spilled] = b.blocks[spilled];
+        for (size_t j = kHeapCacheBatch; j < b.count; j++)
+            b.blocks[j - kHeapCacheBatch] = b.blocks[j];
+        b.count -= kHeapCacheBatch;
+        while (i < count && b.count < kHeapCacheMax)
+            b.blocks[b.count++] = ptrs[i++];
+        while (i < count)
+            overflow[spilled++] = ptrs[i++];
+    }
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return spilled;
+}
+
+void *heap_cache_alloc(size_t size)
+{
+    size_t bucket = heap_cache_alloc_bucket(size);
+    void *ptr = heap_cache_pop(bucket);
+    if (likely(ptr)) {
+        kcounter_add(heap_cache_hit_count, 1);
+        return ptr;
+    }
+    kcounter_add(heap_cache_miss_count, 1);
+    kcounter_add(heap_lock_count, 1);
+
+    /* refill with blocks of the full bucket size, so they come back to the same bucket */
+    void *ptrs[kHeapCacheBatch];
+    size_t count = cmpct_alloc_batch(1u << (bucket + kHeapCacheMinShift), ptrs, kHeapCacheBatch);
+    if (count == 0)
+        return nullptr;
+
+    void *overflow[kHeapCacheMax];
+    size_t spilled = heap_cache_push(bucket, ptrs + 1, count - 1, overflow);
+    if (spilled > 0) {
+        kcounter_add(heap_lock_count, 1);
+        cmpct_free_batch(overflow, spilled);
+    }
+    return ptrs[0];
+}
+
+void heap_cache_free(void *ptr, size_t bucket)
+{
+    void *overflow[kHeapCacheMax];
+    size_t spilled = heap_cache_push(bucket, &ptr, 1, overflow);
+    if (spilled > 0) {
+        kcounter_add(heap_lock_count, 1);
+        cmpct_free_batch(overflow, spilled);
+    }
+}
+
+/* returns every cached block to the heap */
+void heap_cache_drain_all() TA_NO_THREAD_SAFETY_ANALYSIS
+{
+    for (auto &cache : heap_cache) {
+        for (size_t bucket = 0; bucket < kHeapCacheBuckets; bucket++) {
+            void *ptrs[kHeapCacheMax];
+            size_t count;
+            {
+                AutoSpinLockIrqSave guard(&cache.lock);
+                HeapCacheBucket &b = cache.buckets[bucket];
+                count = b.count;
+                memcpy(ptrs, b.blocks, count * sizeof(void *));
+                b.count = 0;
+            }
+            if (count > 0)
+                cmpct_free_batch(ptrs, count);
+        }
+    }
+}
+
+/* returns the number of bytes held by the caches, read racily */
+size_t heap_cache_bytes() TA_NO_THREAD_SAFETY_ANALYSIS
+{
+    size_t bytes = 0;
+    for (const auto &cache : heap_cache) {
+        for (size_t bucket = 0; bucket < kHeapCacheBuckets; bucket++)
+            bytes += cache.buckets[bucket].count << (bucket + kHeapCacheMinShift);
+    }
+    return bytes;
+}
+
+void heap_cache_init(uint level)
+{
+    heap_cache_enabled = true;
+}
+
+} // namespace
+
+LK_INIT_HOOK(heap_cache, &heap_cache_init, LK_INIT_LEVEL_HEAP);
+
+static void *heap_alloc(size_t size)
+{
+    if (likely(heap_cache_enabled) && size > 0 && size <= (1u << kHeapCacheMaxShift))
+        return heap_cache_alloc(size);
+
+    if (heap_cache_enabled)
+        kcounter_add(heap_lock_count, 1);
+    return cmpct_alloc(size);
+}
+
 void heap_init(void)
 {
     cmpct_init();
@@ -45,6 +241,8 @@ void heap_init(void)
 
 void heap_trim(void)
 {
+    if (heap_cache_enabled)
+        heap_cache_drain_all();
     cmpct_trim();
 }
 
@@ -54,7 +252,7 @@ void *malloc(size_t size)
 
     LTRACEF("size %zu\n", size);
 
-    void *ptr = cmpct_alloc(size);
+    void *ptr = heap_alloc(size);
     if (unlikely(heap_trace))
         printf("caller %p malloc %zu -> %p\n", __GET_CALLER(), size, ptr);
 
@@ -90,7 +288,7 @@ void *calloc(size_t count, size_t size)
 
     size_t realsize = count * size;
 
-    void *ptr = cmpct_alloc(realsize);
+    void *ptr = heap_alloc(realsize);
     if (likely(ptr))
         memset(ptr, 0, realsize);
     if (unlikely(heap_trace))
@@ -123,12 +321,22 @@ void free(void *ptr)
     if (unlikely(heap_trace))
         printf("caller %p free %p\n", __GET_CALLER(), ptr);
 
+    if (likely(heap_cache_enabled) && ptr) {
+        size_t bucket = heap_cache_free_bucket(cmpct_usable_size(ptr));
+        if (bucket < kHeapCacheBuckets) {
+            heap_cache_free(ptr, bucket);
+            return;
+        }
+        kcounter_add(heap_lock_count, 1);
+    }
+
     cmpct_free(ptr);
 }
 
 static void heap_dump(bool panic_time)
 {
     cmpct_dump(panic_time);
+    printf("\tper-cpu caches hold %zu bytes\n", heap_cache_bytes());
 }
 
 void heap_get_info(size_t *size_bytes, size_t *free_bytes) {
@@ -11,7 +11,11 @@
 
 #include <arch/ops.h>
 #include <arch/user_copy.h>
+#include <fbl/algorithm.h>
+#include <fbl/atomic.h>
 #include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
 #include <vm/vm_aspace.h>
 #include <lib/ktrace.h>
 #include <lk/init.h>
@@ -77,87 +81,334 @@ static void ktrace_report_probes(void) {
     mutex_release(&probe_list_lock);
 }
 
-typedef struct ktrace_state {
-    // where the next record will be written
-    int offset;
+// Each cpu's buffer is carved into blocks and records never straddle a block
+// boundary; a writer that would cross one leaves a zero tag behind and starts
+// the next block. That is what lets a reader of a circular buffer find the
+// first whole record of the oldest block that has not been overwritten.
+static constexpr uint64_t kBlockSize = 4096;
+
+// KTRACE_LEN() of the largest possible record.
+static constexpr uint32_t kMaxRecordSize = 0xF << 3;
+
+// Name records have no timestamp; they are written to the per-cpu buffers
+// with the other records so that they are kept, streamed and lost along
+// with the records they describe.
+static bool ktrace_is_name(uint32_t tag) {
+    return KTRACE_GROUP(tag) == KTRACE_GRP_META &&
+           KTRACE_EVENT(tag) >= KTRACE_EVENT(TAG_KTHREAD_NAME) &&
+           KTRACE_EVENT(tag) <= KTRACE_EVENT(TAG_PROBE_NAME);
+}
+
+typedef struct ktrace_cpu {
+    // this cpu's slice of the trace buffer
+    uint8_t* buffer;
 
+    // bytes ever written to the buffer, including block padding. Only this
+    // cpu writes records, with interrupts disabled, and it publishes each one
+    // by advancing head once the record is complete.
+    fbl::atomic<uint64_t> head;
+} __CPU_ALIGN ktrace_cpu_t;
+
+typedef struct ktrace_state {
     // mask of groups we allow, 0 == tracing disabled
     int grpmask;
 
-    // total size of the trace buffer
-    uint32_t bufsize;
+    // if set, each cpu's buffer wraps around and keeps its newest records
+    // instead of tracing stopping once any buffer fills
+    bool circular;
 
-    // offset where tracing was stopped, 0 if tracing active
-    uint32_t marker;
+    // set by KTRACE_ACTION_REWIND while tracing is stopped; the buffers are
+    // only reset by the next start so that the trace stays readable until
+    // then
+    bool rewind_pending;
 
-    // raw trace buffer
-    uint8_t* buffer;
+    // number of cpus with a buffer, and the size of each, a multiple of
+    // kBlockSize
+    uint32_t ncpus;
+    uint32_t cpu_bufsize;
+
+    // version and tick rate records. These are kept apart from the per-cpu
+    // buffers so circular tracing can never overwrite them, and are
+    // returned ahead of all other records.
+    ktrace_rec_32b_t meta[2];
+
+    ktrace_cpu_t cpu[SMP_MAX_CPUS];
 } ktrace_state_t;
 
 static ktrace_state_t KTRACE_STATE;
 
-int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
-    ktrace_state_t* ks = &KTRACE_STATE;
+// The single reader cursor into the merged trace stream.
+typedef struct ktrace_reader {
+    // stream offset of the next byte to be returned
+    uint32_t offset;
+
+    // next unread metadata record
+    uint32_t meta_pos;
+
+    // next unread position in each cpu's buffer, and the record last copied
+    // out of it that is waiting for its turn in the merge, if any
+    uint64_t pos[SMP_MAX_CPUS];
+    struct {
+        uint64_t data[kMaxRecordSize / sizeof(uint64_t)];
+        uint32_t len;
+    } pending[SMP_MAX_CPUS];
+
+    // the record being returned and how many of its bytes already have been
+    uint64_t cur[kMaxRecordSize / sizeof(uint64_t)];
+    uint32_t cur_len;
+    uint32_t cur_done;
+} ktrace_reader_t;
+
+static mutex_t reader_lock = MUTEX_INITIAL_VALUE(reader_lock);
+static ktrace_reader_t KTRACE_READER TA_GUARDED(reader_lock);
+
+// Returns the oldest position of a cpu's buffer that is safe to read given
+// its |head|. A writer may be filling the block at head and the one after
+// it, so in circular mode only data at least two blocks further back than
+// one buffer length can be trusted.
+static uint64_t ktrace_cpu_tail(const ktrace_state_t* ks, uint64_t head) {
+    if (!ks->circular) {
+        return 0;
+    }
+    uint64_t window = ks->cpu_bufsize - 2 * kBlockSize;
+    return head <= window ? 0 : ROUNDUP(head - window, kBlockSize);
+}
 
-    // Buffer size is limited by the marker if set,
-    // otherwise limited by offset (last written point).
-    // Offset can end up pointing past the end, so clip
-    // it to the actual buffer size to be safe.
-    uint32_t max;
-    if (ks->marker) {
-        max = ks->marker;
-    } else {
-        max = ks->offset;
-        if (max > ks->bufsize) {
-            max = ks->bufsize;
+static void ktrace_reader_reset(ktrace_reader_t* rd) TA_REQ(reader_lock) {
+    rd->offset = 0;
+    rd->meta_pos = 0;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        rd->pos[i] = 0;
+        rd->pending[i].len = 0;
+    }
+    rd->cur_len = 0;
+    rd->cur_done = 0;
+}
+
+// Copies the next record of cpu |i| into the reader's pending slot. Returns
+// false if the cpu has nothing more to read at the moment.
+static bool ktrace_peek_cpu(ktrace_state_t* ks, ktrace_reader_t* rd, uint32_t i)
+    TA_REQ(reader_lock) {
+    ktrace_cpu_t* kc = &ks->cpu[i];
+    for (;;) {
+        uint64_t head = kc->head.load(fbl::memory_order_acquire);
+        uint64_t tail = ktrace_cpu_tail(ks, head);
+        if (rd->pos[i] < tail) {
+            // the writer has lapped us, skip what was lost
+            rd->pos[i] = tail;
+        }
+        if (rd->pos[i] >= head) {
+            return false;
+        }
+
+        uint64_t pos = rd->pos[i];
+        uint32_t room = static_cast<uint32_t>(kBlockSize - pos % kBlockSize);
+        const uint8_t* src = kc->buffer + pos % ks->cpu_bufsize;
+        uint32_t len = KTRACE_LEN(*reinterpret_cast<const volatile uint32_t*>(src));
+        bool pad = (len < KTRACE_HDRSIZE) || (len > room);
+        if (!pad) {
+            memcpy(rd->pending[i].data, src, len);
+        }
+
+        // In circular mode the writer may have come around and overwritten
+        // what we just copied; if so start over from the new tail.
+        if (ks->circular) {
+            fbl::atomic_thread_fence(fbl::memory_order_acquire);
+            head = kc->head.load(fbl::memory_order_relaxed);
+            if (pos < ktrace_cpu_tail(ks, head)) {
+                continue;
+            }
+        }
+
+        if (pad) {
+            rd->pos[i] = pos + room;
+            continue;
         }
+        rd->pos[i] = pos + len;
+        rd->pending[i].len = len;
+        return true;
     }
+}
 
-    // null read is a query for trace buffer size
+// Loads the next record of the merged stream into rd->cur: metadata first,
+// then the per-cpu records in timestamp order. A name record is returned as
+// soon as it is the next one on its cpu. While tracing is running a cpu can
+// still publish a record older than one already returned, so a streamed
+// trace is only ordered within each read. Returns false if no record is
+// available.
+static bool ktrace_next_record(ktrace_state_t* ks, ktrace_reader_t* rd) TA_REQ(reader_lock) {
+    if (rd->meta_pos < fbl::count_of(ks->meta)) {
+        memcpy(rd->cur, &ks->meta[rd->meta_pos], KTRACE_RECSIZE);
+        rd->meta_pos++;
+        rd->cur_len = KTRACE_RECSIZE;
+        rd->cur_done = 0;
+        return true;
+    }
+
+    uint32_t best = UINT32_MAX;
+    uint64_t best_ts = 0;
+    for (uint32_t i = 0; i < ks->ncpus; i++) {
+        if (rd->pending[i].len == 0 && !ktrace_peek_cpu(ks, rd, i)) {
+            continue;
+        }
+        auto hdr = reinterpret_cast<const ktrace_header_t*>(rd->pending[i].data);
+        if (ktrace_is_name(hdr->tag)) {
+            best = i;
+            break;
+        }
+        if (best == UINT32_MAX || hdr->ts < best_ts) {
+            best = i;
+            best_ts = hdr->ts;
+        }
+    }
+    if (best == UINT32_MAX) {
+        return false;
+    }
+
+    memcpy(rd->cur, rd->pending[best].data, rd->pending[best].len);
+    rd->cur_len = rd->pending[best].len;
+    rd->cur_done = 0;
+    rd->pending[best].len = 0;
+    return true;
+}
+
+// Returns up to |len| bytes of the stream to |ptr|, or just skips them if
+// |ptr| is null.
+static int ktrace_copy_out(ktrace_state_t* ks, ktrace_reader_t* rd, uint8_t* ptr, uint32_t len)
+    TA_REQ(reader_lock) {
+    uint32_t done = 0;
+    while (done < len) {
+        if (rd->cur_done == rd->cur_len && !ktrace_next_record(ks, rd)) {
+            break;
+        }
+        uint32_t n = fbl::min(rd->cur_len - rd->cur_done, len - done);
+        if (ptr != nullptr &&
+            arch_copy_to_user(ptr + done, reinterpret_cast<uint8_t*>(rd->cur) + rd->cur_done,
+                              n) != ZX_OK) {
+            return ZX_ERR_INVALID_ARGS;
+        }
+        rd->cur_done += n;
+        rd->offset += n;
+        done += n;
+    }
+    return done;
+}
+
+int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+
+    // null read is a query for trace buffer size. This counts the block
+    // padding in the per-cpu buffers, so it is an upper bound.
     if (ptr == nullptr) {
-        return max;
+        uint64_t max = sizeof(ks->meta);
+        for (uint32_t i = 0; i < ks->ncpus; i++) {
+            uint64_t head = ks->cpu[i].head.load(fbl::memory_order_acquire);
+            max += head - ktrace_cpu_tail(ks, head);
+        }
+        return static_cast<int>(fbl::min<uint64_t>(max, INT32_MAX));
     }
 
-    // constrain read to available buffer
-    if (off >= max) {
-        return 0;
+    mutex_acquire(&reader_lock);
+    ktrace_reader_t* rd = &KTRACE_READER;
+
+    // A read normally picks up where the previous one ended, which is how
+    // records are streamed out while tracing keeps running. Any other
+    // offset is reached by replaying the merge from the start. The offset
+    // wraps at 4GB along with the caller's, so a stream can run forever.
+    if (off != rd->offset) {
+        if (off < rd->offset) {
+            ktrace_reader_reset(rd);
+        }
+        ktrace_copy_out(ks, rd, nullptr, off - rd->offset);
+        if (off != rd->offset) {
+            mutex_release(&reader_lock);
+            return 0;
+        }
     }
-    if (len > (max - off)) {
-        len = max - off;
+    int result = ktrace_copy_out(ks, rd, static_cast<uint8_t*>(ptr), len);
+    mutex_release(&reader_lock);
+    return result;
+}
+
+// Discards everything but the version and tick rate records and reports the
+// syscall and probe names again. Called with tracing stopped.
+static void ktrace_rewind(ktrace_state_t* ks) {
+    mutex_acquire(&reader_lock);
+    for (uint32_t i = 0; i < ks->ncpus; i++) {
+        ks->cpu[i].head.store(0, fbl::memory_order_release);
     }
+    ktrace_reader_reset(&KTRACE_READER);
+    mutex_release(&reader_lock);
 
-    if (arch_copy_to_user(ptr, ks->buffer + off, len) != ZX_OK) {
-        return ZX_ERR_INVALID_ARGS;
+    ks->rewind_pending = false;
+    ktrace_report_syscalls(kt_syscall_info);
+    ktrace_report_probes();
+}
+
+// Records are written with interrupts disabled, so once every cpu has run
+// this no write that started before it is still in progress.
+static void ktrace_sync_task(void* context) {}
+
+// Returns true if a circular trace has lost its oldest records, and with
+// them possibly the names reported when it started.
+static bool ktrace_wrapped(ktrace_state_t* ks) {
+    for (uint32_t i = 0; i < ks->ncpus; i++) {
+        uint64_t head = ks->cpu[i].head.load(fbl::memory_order_relaxed);
+        if (ktrace_cpu_tail(ks, head) > 0) {
+            return true;
+        }
     }
-    return len;
+    return false;
 }
 
 zx_status_t ktrace_control(uint32_t action, uint32_t options, void* ptr) {
     ktrace_state_t* ks = &KTRACE_STATE;
     switch (action) {
     case KTRACE_ACTION_START:
+    case KTRACE_ACTION_START_CIRCULAR: {
+        if (ks->cpu_bufsize == 0) {
+            return ZX_ERR_BAD_STATE;
+        }
+        bool circular = (action == KTRACE_ACTION_START_CIRCULAR);
+        if (ks->rewind_pending || circular != ks->circular) {
+            // Stop tracing, and let any record being written on another
+            // cpu finish, before resetting the buffers under it.
+            atomic_store(&ks->grpmask, 0);
+            mp_sync_exec(MP_IPI_TARGET_ALL_BUT_LOCAL, 0, ktrace_sync_task, nullptr);
+            ks->circular = circular;
+            ktrace_rewind(ks);
+        }
         options = KTRACE_GRP_TO_MASK(options);
-        ks->marker = 0;
         atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
         ktrace_report_live_processes();
         ktrace_report_live_threads();
         break;
-    case KTRACE_ACTION_STOP: {
+    }
+    case KTRACE_ACTION_STOP:
+        if (atomic_load(&ks->grpmask) && ktrace_wrapped(ks)) {
+            // Report the live names again while the groups are still
+            // enabled, so the records that remain can be attributed.
+            ktrace_report_syscalls(kt_syscall_info);
+            ktrace_report_probes();
+            ktrace_report_live_processes();
+            ktrace_report_live_threads();
+        }
         atomic_store(&ks->grpmask, 0);
-        uint32_t n = ks->offset;
-        if (n > ks->bufsize) {
-            ks->marker = ks->bufsize;
+        break;
+    case KTRACE_ACTION_REWIND: {
+        // roll back to just after the metadata
+        int grpmask = atomic_load(&ks->grpmask);
+        if (grpmask) {
+            atomic_store(&ks->grpmask, 0);
+            mp_sync_exec(MP_IPI_TARGET_ALL_BUT_LOCAL, 0, ktrace_sync_task, nullptr);
+            ktrace_rewind(ks);
+            atomic_store(&ks->grpmask, grpmask);
         } else {
-            ks->marker = n;
+            // a stopped trace stays readable until tracing starts again
+            ks->rewind_pending = true;
         }
         break;
     }
-    case KTRACE_ACTION_REWIND:
-        // roll back to just after the metadata
-        atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
-        ktrace_report_syscalls(kt_syscall_info);
-        ktrace_report_probes();
-        break;
     case KTRACE_ACTION_NEW_PROBE: {
         ktrace_probe_info_t* probe;
         mutex_acquire(&probe_list_lock);
@@ -197,19 +448,41 @@ void ktrace_init(unsigned level) {
 
     mb *= (1024*1024);
 
+    // The buffer is split evenly between the cpus.
+    uint32_t ncpus = arch_max_num_cpus();
+    uint32_t cpu_bufsize = static_cast<uint32_t>(ROUNDDOWN(mb / ncpus, kBlockSize));
+    if (cpu_bufsize < 4 * kBlockSize) {
+        dprintf(INFO, "ktrace: buffer too small for %u cpus\n", ncpus);
+        return;
+    }
+
     zx_status_t status;
+    uint8_t* buffer;
     VmAspace* aspace = VmAspace::kernel_aspace();
-    if ((status = aspace->Alloc("ktrace", mb, (void**)&ks->buffer, 0, VmAspace::VMM_FLAG_COMMIT,
+    if ((status = aspace->Alloc("ktrace", mb, (void**)&buffer, 0, VmAspace::VMM_FLAG_COMMIT,
                                 ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE)) < 0) {
         dprintf(INFO, "ktrace: cannot alloc buffer %d\n", status);
         return;
     }
 
-    // The last packet written can overhang the end of the buffer,
-    // so we reduce the reported size by the max size of a record
-    ks->bufsize = mb - 256;
+    for (uint32_t i = 0; i < ncpus; i++) {
+        ks->cpu[i].buffer = buffer + i * cpu_bufsize;
+    }
+    ks->ncpus = ncpus;
+    ks->cpu_bufsize = cpu_bufsize;
+    ks->circular = cmdline_get_bool("ktrace.circular", false);
+
+    dprintf(INFO, "ktrace: buffer at %p (%u bytes, %u per cpu%s)\n",
+            buffer, mb, cpu_bufsize, ks->circular ? ", circular" : "");
 
-    dprintf(INFO, "ktrace: buffer at %p (%u bytes)\n", ks->buffer, mb);
+    // write metadata to the first two event slots
+    uint64_t n = ktrace_ticks_per_ms();
+    ktrace_rec_32b_t* rec = ks->meta;
+    rec[0].tag = TAG_VERSION;
+    rec[0].a = KTRACE_VERSION;
+    rec[1].tag = TAG_TICKS_PER_MS;
+    rec[1].a = (uint32_t)n;
+    rec[1].b = (uint32_t)(n >> 32);
 
     // register all static probes
     mutex_acquire(&probe_list_lock);
@@ -220,19 +493,8 @@ void ktrace_init(unsigned level) {
     }
     mutex_release(&probe_list_lock);
 
-    // write metadata to the first two event slots
-    uint64_t n = ktrace_ticks_per_ms();
-    ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) ks->buffer;
-    rec[0].tag = TAG_VERSION;
-    rec[0].a = KTRACE_VERSION;
-    rec[1].tag = TAG_TICKS_PER_MS;
-    rec[1].a = (uint32_t)n;
-    rec[1].b = (uint32_t)(n >> 32);
-
     // enable tracing
-    atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
     ktrace_report_syscalls(kt_syscall_info);
-    ktrace_report_probes();
     atomic_store(&ks->grpmask, KTRACE_GRP_TO_MASK(grpmask));
 
     // report names of existing threads
@@ -245,41 +507,65 @@ void ktrace_init(unsigned level) {
     ktrace_probe0("ktrace_ready");
 }
 
-void ktrace_tiny(uint32_t tag, uint32_t arg) {
+// Appends |rec|, a record of KTRACE_LEN(rec->tag) bytes, to the current
+// cpu's buffer, setting its timestamp unless it is a name record. Returns
+// false if it did not fit.
+static bool ktrace_write(const ktrace_header_t* rec) {
     ktrace_state_t* ks = &KTRACE_STATE;
-    if (tag & atomic_load(&ks->grpmask)) {
-        tag = (tag & 0xFFFFFFF0) | 2;
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_HDRSIZE)) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
+    uint32_t len = KTRACE_LEN(rec->tag);
+    DEBUG_ASSERT(len >= KTRACE_HDRSIZE && len <= kMaxRecordSize);
+    if (ks->cpu_bufsize == 0) {
+        // tracing is disabled, but names are reported regardless
+        return false;
+    }
+
+    // With interrupts off nothing else can write to this cpu's buffer, so
+    // claiming space needs no atomic read-modify-write.
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    ktrace_cpu_t* kc = &ks->cpu[arch_curr_cpu_num()];
+    uint64_t pos = kc->head.load(fbl::memory_order_relaxed);
+    uint32_t room = static_cast<uint32_t>(kBlockSize - pos % kBlockSize);
+    if (room < len) {
+        // leave a zero tag so readers skip the rest of the block
+        *reinterpret_cast<uint32_t*>(kc->buffer + pos % ks->cpu_bufsize) = 0;
+        pos += room;
+    }
+
+    bool written = false;
+    if (!ks->circular && pos + len > ks->cpu_bufsize) {
+        // if we arrive at the end, stop
+        atomic_store(&ks->grpmask, 0);
+    } else {
+        ktrace_header_t* hdr = (ktrace_header_t*) (kc->buffer + pos % ks->cpu_bufsize);
+        memcpy(hdr, rec, len);
+        if (!ktrace_is_name(rec->tag)) {
             hdr->ts = ktrace_timestamp();
-            hdr->tag = tag;
-            hdr->tid = arg;
         }
+        kc->head.store(pos + len, fbl::memory_order_release);
+        written = true;
     }
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return written;
 }
 
-void* ktrace_open(uint32_t tag) {
+void ktrace_tiny(uint32_t tag, uint32_t arg) {
     ktrace_state_t* ks = &KTRACE_STATE;
-    if (!(tag & atomic_load(&ks->grpmask))) {
-        return nullptr;
+    if (tag & atomic_load(&ks->grpmask)) {
+        ktrace_header_t hdr = {(tag & 0xFFFFFFF0) | 2, arg, 0};
+        ktrace_write(&hdr);
     }
+}
 
-    int off;
-    if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-        // if we arrive at the end, stop
-        atomic_store(&ks->grpmask, 0);
-        return nullptr;
+bool ktrace(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    ktrace_state_t* ks = &KTRACE_STATE;
+    if (!(tag & atomic_load(&ks->grpmask))) {
+        return false;
     }
-
-    ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-    hdr->ts = ktrace_timestamp();
-    hdr->tag = tag;
-    hdr->tid = (uint32_t)get_current_thread()->user_tid;
-    return hdr + 1;
+    ktrace_rec_32b_t rec = {tag, (uint32_t)get_current_thread()->user_tid, 0, a, b, c, d};
+    return ktrace_write(reinterpret_cast<ktrace_header_t*>(&rec));
 }
 
 static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char* name, bool always) {
@@ -290,18 +576,14 @@ static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char*
         // set size to: sizeof(hdr) + len + 1, round up to multiple of 8
         tag = (tag & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
 
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->buffer + off);
-            rec->tag = tag;
-            rec->id = id;
-            rec->arg = arg;
-            memcpy(rec->name, name, len);
-            rec->name[len] = 0;
-        }
+        uint64_t buf[kMaxRecordSize / sizeof(uint64_t)] = {};
+        ktrace_rec_name_t* rec = reinterpret_cast<ktrace_rec_name_t*>(buf);
+        rec->tag = tag;
+        rec->id = id;
+        rec->arg = arg;
+        memcpy(rec->name, name, len);
+        rec->name[len] = 0;
+        ktrace_write(reinterpret_cast<ktrace_header_t*>(rec));
     }
 }
 
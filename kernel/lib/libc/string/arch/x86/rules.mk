@@ -11,7 +11,11 @@ ASM_STRING_OPS := memcpy memset
 
 MODULE_SRCS += \
 	$(LOCAL_DIR)/memcpy.S \
-	$(LOCAL_DIR)/memset.S
+	$(LOCAL_DIR)/memset.S \
+	$(LOCAL_DIR)/selection.cpp
+
+MODULE_DEPS += \
+	kernel/lib/code_patching
 
 # filter out the C implementation
 C_STRING_OPS := $(filter-out $(ASM_STRING_OPS),$(C_STRING_OPS))
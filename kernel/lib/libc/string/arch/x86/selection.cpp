@@ -0,0 +1,56 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <assert.h>
+#include <string.h>
+
+#include <arch/x86/feature.h>
+#include <lib/code_patching.h>
+
+// Boot time selection of the memcpy and memset variants.  The unpatched
+// code in memcpy.S and memset.S works on every cpu, so these only patch in
+// the string instructions when the cpu makes them fast.
+
+CODE_TEMPLATE(kRepMovsbRet, "rep movsb\nret");
+CODE_TEMPLATE(kRepMovsb, "rep movsb");
+CODE_TEMPLATE(kRepStosbRet, "rep stosb\nmov %r11, %rax\nret");
+CODE_TEMPLATE(kRepStosb, "rep stosb");
+static const uint8_t kNopInstruction = 0x90;
+
+static void patch_code(const CodePatchInfo* patch, const uint8_t* start, const uint8_t* end) {
+    const size_t size = end - start;
+    DEBUG_ASSERT(size <= patch->dest_size);
+    memcpy(patch->dest_addr, start, size);
+    memset(patch->dest_addr + size, kNopInstruction, patch->dest_size - size);
+}
+
+extern "C" {
+
+void fill_out_memcpy_fsrm_patch(const CodePatchInfo* patch) {
+    if (x86_feature_test(X86_FEATURE_FSRM)) {
+        patch_code(patch, kRepMovsbRet, kRepMovsbRetEnd);
+    }
+}
+
+void fill_out_memcpy_large_patch(const CodePatchInfo* patch) {
+    if (x86_feature_test(X86_FEATURE_ERMS)) {
+        patch_code(patch, kRepMovsb, kRepMovsbEnd);
+    }
+}
+
+void fill_out_memset_fsrm_patch(const CodePatchInfo* patch) {
+    if (x86_feature_test(X86_FEATURE_FSRM)) {
+        patch_code(patch, kRepStosbRet, kRepStosbRetEnd);
+    }
+}
+
+void fill_out_memset_large_patch(const CodePatchInfo* patch) {
+    if (x86_feature_test(X86_FEATURE_ERMS)) {
+        patch_code(patch, kRepStosb, kRepStosbEnd);
+    }
+}
+
+}
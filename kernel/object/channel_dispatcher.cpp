@@ -13,6 +13,7 @@
 #include <trace.h>
 
 #include <kernel/event.h>
+#include <kernel/thread.h>
 #include <platform.h>
 #include <object/handle.h>
 #include <object/message_packet.h>
@@ -163,6 +164,57 @@ zx_status_t ChannelDispatcher::Read(uint32_t* msg_size,
     return rv;
 }
 
+zx_status_t ChannelDispatcher::ReadMany(uint32_t* msg_sizes,
+                                        uint32_t* msg_handle_counts,
+                                        size_t count,
+                                        MessageList* msgs) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    if (messages_.is_empty())
+        return other_ ? ZX_ERR_SHOULD_WAIT : ZX_ERR_PEER_CLOSED;
+
+    for (size_t i = 0; i < count && !messages_.is_empty(); ++i) {
+        const MessagePacket& next = messages_.front();
+        if (next.data_size() > msg_sizes[i] || next.num_handles() > msg_handle_counts[i]) {
+            if (i == 0) {
+                msg_sizes[0] = next.data_size();
+                msg_handle_counts[0] = next.num_handles();
+                return ZX_ERR_BUFFER_TOO_SMALL;
+            }
+            break;
+        }
+        msg_sizes[i] = next.data_size();
+        msg_handle_counts[i] = next.num_handles();
+        msgs->push_back(messages_.pop_front());
+        message_count_--;
+    }
+
+    if (messages_.is_empty())
+        UpdateState(ZX_CHANNEL_READABLE, 0u);
+
+    return ZX_OK;
+}
+
+void ChannelDispatcher::UnreadMany(MessageList* msgs) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    if (msgs->is_empty())
+        return;
+
+    bool was_empty = messages_.is_empty();
+    while (!msgs->is_empty()) {
+        messages_.push_front(msgs->pop_back());
+        message_count_++;
+    }
+
+    if (was_empty)
+        UpdateState(0u, ZX_CHANNEL_READABLE);
+}
+
 zx_status_t ChannelDispatcher::Write(fbl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
@@ -184,6 +236,23 @@ zx_status_t ChannelDispatcher::Write(fbl::unique_ptr<MessagePacket> msg) {
     return ZX_OK;
 }
 
+zx_status_t ChannelDispatcher::WriteMany(MessageList* msgs) {
+    canary_.Assert();
+
+    fbl::RefPtr<ChannelDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_)
+            return ZX_ERR_PEER_CLOSED;
+        other = other_;
+    }
+
+    if (other->WriteSelfMany(msgs) > 0)
+        thread_reschedule();
+
+    return ZX_OK;
+}
+
 zx_status_t ChannelDispatcher::Call(fbl::unique_ptr<MessagePacket> msg,
                                     zx_time_t deadline, bool* return_handles,
                                     fbl::unique_ptr<MessagePacket>* reply) {
@@ -216,8 +285,12 @@ zx_status_t ChannelDispatcher::Call(fbl::unique_ptr<MessagePacket> msg,
         waiters_.push_back(waiter);
     }
 
-    // (1) Write outbound message to opposing endpoint.
+    // (1) Write outbound message to opposing endpoint. We are about to block
+    // for the reply, so a server woken by the write gets this cpu and the rest
+    // of our time slice, and hands them back when it replies.
+    thread_handoff_arm();
     other->WriteSelf(fbl::move(msg));
+    thread_handoff_disarm();
 
     // Reuse the code from the half-call used for retrying a Call after thread
     // suspend.
@@ -264,6 +337,29 @@ int ChannelDispatcher::WriteSelf(fbl::unique_ptr<MessagePacket> msg) {
 
     AutoLock lock(&lock_);
 
+    bool queued = false;
+    int woken = EnqueueLocked(fbl::move(msg), &queued);
+    if (queued)
+        UpdateState(0u, ZX_CHANNEL_READABLE);
+    return woken;
+}
+
+int ChannelDispatcher::WriteSelfMany(MessageList* msgs) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    // Signal readability once for the whole batch.
+    bool queued = false;
+    int woken = 0;
+    while (!msgs->is_empty())
+        woken += EnqueueLocked(msgs->pop_front(), &queued);
+    if (queued)
+        UpdateState(0u, ZX_CHANNEL_READABLE);
+    return woken;
+}
+
+int ChannelDispatcher::EnqueueLocked(fbl::unique_ptr<MessagePacket> msg, bool* queued) {
     if (!waiters_.is_empty()) {
         // If the far side is waiting for replies to messages
         // send via "call", see if this message has a matching
@@ -282,7 +378,7 @@ int ChannelDispatcher::WriteSelf(fbl::unique_ptr<MessagePacket> msg) {
     messages_.push_back(fbl::move(msg));
     message_count_++;
 
-    UpdateState(0u, ZX_CHANNEL_READABLE);
+    *queued = true;
     return 0;
 }
 
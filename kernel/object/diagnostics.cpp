@@ -409,6 +409,8 @@ public:
             usage.scaled_shared_bytes +=
                 committed_pages * PAGE_SIZE / share_count;
         }
+        usage.compressed_pages += map->vmo()->CompressedPagesInRange(
+            map->object_offset(), map->size());
         return true;
     }
 
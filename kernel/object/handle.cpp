@@ -6,6 +6,9 @@
 
 #include <object/handle.h>
 
+#include <arch/ops.h>
+#include <kernel/auto_lock.h>
+#include <kernel/spinlock.h>
 #include <object/dispatcher.h>
 #include <fbl/arena.h>
 #include <fbl/auto_lock.h>
@@ -46,6 +49,101 @@ static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
                   0xffffffffu,
               "Masks do not agree");
 
+// Per-cpu caches of free arena slots. Handle creation and destruction are
+// normally satisfied by the current cpu's cache under a cpu local spinlock,
+// and only take Handle::mutex_ to move a batch of slots to or from the arena.
+// Cached slots are allocated as far as the arena is concerned, and keep the
+// base_value stashed by TearDown so the generation scheme is unaffected.
+//
+// Slots are never handed to the arena with a cache lock held, since
+// growing or shrinking the arena can block.
+
+// Number of slots moved between a cache and the arena at once.
+constexpr size_t kHandleCacheBatch = 32;
+// Most slots a cache holds; freeing into a full cache returns a batch.
+constexpr size_t kHandleCacheMax = 2 * kHandleCacheBatch;
+
+struct HandleCache {
+    SpinLock lock;
+    // Only written with the lock held, read racily for diagnostics.
+    size_t count TA_GUARDED(lock);
+    void* slots[kHandleCacheMax] TA_GUARDED(lock);
+} __CPU_ALIGN;
+
+HandleCache handle_cache[SMP_MAX_CPUS];
+
+// Pops a slot from the current cpu's cache, or returns nullptr if it is empty.
+void* handle_cache_pop() {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache& cache = handle_cache[arch_curr_cpu_num()];
+
+    void* addr = nullptr;
+    cache.lock.Acquire();
+    if (cache.count > 0)
+        addr = cache.slots[--cache.count];
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return addr;
+}
+
+// Pushes up to |count| slots from |slots| into the current cpu's cache,
+// most recently used last. Returns the number of slots accepted.
+size_t handle_cache_push(void* const* slots, size_t count) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache& cache = handle_cache[arch_curr_cpu_num()];
+
+    size_t pushed = 0;
+    cache.lock.Acquire();
+    while (pushed < count && cache.count < kHandleCacheMax)
+        cache.slots[cache.count++] = slots[pushed++];
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return pushed;
+}
+
+// Removes the |count| least recently used slots from the current cpu's
+// cache into |slots|. Returns the number of slots removed.
+size_t handle_cache_trim(void** slots, size_t count) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache& cache = handle_cache[arch_curr_cpu_num()];
+
+    cache.lock.Acquire();
+    if (count > cache.count)
+        count = cache.count;
+    for (size_t i = 0; i < count; i++)
+        slots[i] = cache.slots[i];
+    for (size_t i = count; i < cache.count; i++)
+        cache.slots[i - count] = cache.slots[i];
+    cache.count -= count;
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return count;
+}
+
+// Takes a slot from any cpu's cache, or returns nullptr if all are empty.
+void* handle_cache_steal() TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (auto& cache : handle_cache) {
+        AutoSpinLockIrqSave lock(&cache.lock);
+        if (cache.count > 0)
+            return cache.slots[--cache.count];
+    }
+    return nullptr;
+}
+
+// Returns the number of slots held by all of the caches.
+size_t handle_cache_count() TA_NO_THREAD_SAFETY_ANALYSIS {
+    size_t count = 0;
+    for (const auto& cache : handle_cache)
+        count += cache.count;
+    return count;
+}
+
 }  // namespace
 
 fbl::Mutex Handle::mutex_;
@@ -57,8 +155,9 @@ void Handle::Init() TA_NO_THREAD_SAFETY_ANALYSIS {
 
 // Returns a new |base_value| based on the value stored in the free
 // arena slot pointed to by |addr|. The new value will be different
-// from the last |base_value| used by this slot.
-uint32_t Handle::GetNewBaseValue(void* addr) TA_REQ(mutex_) {
+// from the last |base_value| used by this slot. The caller must own
+// the slot, but need not hold the mutex.
+uint32_t Handle::GetNewBaseValue(void* addr) {
     // Get the index of this slot within the arena.
     uint32_t handle_index = HandleToIndex(reinterpret_cast<Handle*>(addr));
     DEBUG_ASSERT((handle_index & ~kHandleIndexMask) == 0);
@@ -81,28 +180,60 @@ uint32_t Handle::GetNewBaseValue(void* addr) TA_REQ(mutex_) {
 // says whether this is allocation or duplication, for the error message.
 void* Handle::Alloc(const fbl::RefPtr<Dispatcher>& dispatcher,
                     const char* what, uint32_t* base_value) {
+    void* addr = handle_cache_pop();
+    if (unlikely(!addr))
+        addr = Refill(what);
+    if (unlikely(!addr))
+        return nullptr;
+
+    dispatcher->increment_handle_count();
+    *base_value = GetNewBaseValue(addr);
+    return addr;
+}
+
+// Allocates a batch of slots from the arena, keeping one for the caller
+// and putting the rest in the current cpu's cache.
+void* Handle::Refill(const char* what) {
+    void* slots[kHandleCacheBatch];
+    size_t count = 0;
     size_t outstanding_handles;
     {
         AutoLock lock(&mutex_);
-        void* addr = arena_.Alloc();
+        while (count < kHandleCacheBatch) {
+            void* addr = arena_.Alloc();
+            if (!addr)
+                break;
+            slots[count++] = addr;
+        }
         outstanding_handles = arena_.DiagnosticCount();
-        if (likely(addr)) {
-            if (outstanding_handles > kHighHandleCount) {
-                // TODO: Avoid calling this for every handle after
-                // kHighHandleCount; printfs are slow and we're
-                // holding the mutex.
-                printf("WARNING: High handle count: %zu handles\n",
-                       outstanding_handles);
-            }
-            dispatcher->increment_handle_count();
-            *base_value = GetNewBaseValue(addr);
+    }
+
+    if (unlikely(count == 0)) {
+        // The arena is exhausted, but other cpus may be sitting on free
+        // slots; a miss here is rare enough that a scan is acceptable.
+        void* addr = handle_cache_steal();
+        if (addr)
             return addr;
-        }
+        printf("WARNING: Could not allocate %s handle (%zu outstanding)\n",
+               what, outstanding_handles);
+        return nullptr;
     }
 
-    printf("WARNING: Could not allocate %s handle (%zu outstanding)\n",
-           what, outstanding_handles);
-    return nullptr;
+    if (outstanding_handles > kHighHandleCount) {
+        // Only reported once per batch, rather than for every handle.
+        printf("WARNING: High handle count: %zu handles\n",
+               outstanding_handles - handle_cache_count());
+    }
+
+    // The cache may have been refilled by someone else after this thread
+    // found it empty or was migrated; return whatever does not fit.
+    size_t pushed = handle_cache_push(slots + 1, count - 1);
+    if (pushed < count - 1) {
+        AutoLock lock(&mutex_);
+        for (size_t i = 1 + pushed; i < count; i++)
+            arena_.Free(slots[i]);
+    }
+    return slots[0];
 }
 
 HandleOwner Handle::Make(fbl::RefPtr<Dispatcher> dispatcher,
@@ -132,9 +263,10 @@ HandleOwner Handle::Dup(Handle* source, zx_rights_t rights) {
     return HandleOwner(new (addr) Handle(source, rights, base_value));
 }
 
-// Called only by Dup.
+// Called only by Dup. The new handle has no owner until it is added to a
+// process, which publishes its process id.
 Handle::Handle(Handle* rhs, zx_rights_t rights, uint32_t base_value)
-    : process_id_(rhs->process_id()),
+    : process_id_(0u),
       dispatcher_(rhs->dispatcher_),
       rights_(rights),
       base_value_(base_value) {
@@ -146,14 +278,19 @@ Handle::Handle(Handle* rhs, zx_rights_t rights, uint32_t base_value)
 void Handle::TearDown() TA_EXCL(mutex_) {
     uint32_t old_base_value = base_value();
 
+    // A Lookup may still be copying out our dispatcher.
+    WaitForReaders();
+
     // Calling the handle dtor can cause many things to happen, so it is
     // important to call it outside the lock.
     this->~Handle();
 
     // There may be stale pointers to this slot. Zero out most of its fields
     // to ensure that the Handle does not appear to belong to any process
-    // or point to any Dispatcher.
-    memset(this, 0, sizeof(*this));
+    // or point to any Dispatcher. Lookups may be updating |readers_|
+    // concurrently, so leave it alone.
+    memset(this, 0, reinterpret_cast<char*>(&readers_) -
+                        reinterpret_cast<char*>(this));
 
     // Hold onto the base_value for the next user of this slot, stashing
     // it at the beginning of the free slot.
@@ -166,6 +303,22 @@ void Handle::TearDown() TA_EXCL(mutex_) {
     DEBUG_ASSERT(process_id() == 0);
 }
 
+// Waits for any Lookup that might have seen this Handle as still owned by
+// a process. The caller must already have cleared process_id(), so no new
+// lookup can succeed.
+void Handle::WaitForReaders() {
+    DEBUG_ASSERT(process_id() == 0);
+
+    // Orders the process_id() store before the |readers_| load, against
+    // the opposite order in Lookup.
+    fbl::atomic_thread_fence(fbl::memory_order_seq_cst);
+
+    // Lookups run with interrupts disabled, so this never waits for more
+    // than a few instructions.
+    while (readers_.load(fbl::memory_order_acquire) != 0)
+        arch_spinloop_pause();
+}
+
 void Handle::Delete() {
     fbl::RefPtr<Dispatcher> disp = dispatcher();
 
@@ -174,12 +327,8 @@ void Handle::Delete() {
 
     TearDown();
 
-    bool zero_handles = false;
-    {
-        AutoLock lock(&mutex_);
-        zero_handles = disp->decrement_handle_count();
-        arena_.Free(this);
-    }
+    bool zero_handles = disp->decrement_handle_count();
+    Free(this);
 
     if (zero_handles)
         disp->on_zero_handles();
@@ -188,28 +337,84 @@ void Handle::Delete() {
     // gets destroyed here.
 }
 
+// Returns a slot to the current cpu's cache, handing a batch of the
+// cache's least recently used slots back to the arena if it is full.
+void Handle::Free(void* addr) {
+    if (likely(handle_cache_push(&addr, 1) == 1))
+        return;
+
+    void* slots[kHandleCacheBatch];
+    size_t count = handle_cache_trim(slots, kHandleCacheBatch - 1);
+    slots[count++] = addr;
+
+    AutoLock lock(&mutex_);
+    for (size_t i = 0; i < count; i++)
+        arena_.Free(slots[i]);
+}
+
 Handle* Handle::FromU32(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
     Handle* handle = IndexToHandle(value & kHandleIndexMask);
-    {
-        AutoLock lock(&mutex_);
-        if (unlikely(!arena_.in_range(handle)))
-            return nullptr;
-    }
+    if (unlikely(!arena_.in_range_unlocked(handle)))
+        return nullptr;
     return likely(handle->base_value() == value) ? handle : nullptr;
 }
 
+bool Handle::Lookup(uint32_t value, zx_koid_t process_id,
+                    fbl::RefPtr<Dispatcher>* dispatcher,
+                    zx_rights_t* rights) TA_NO_THREAD_SAFETY_ANALYSIS {
+    Handle* handle = IndexToHandle(value & kHandleIndexMask);
+    if (unlikely(!arena_.in_range_unlocked(handle)))
+        return false;
+
+    fbl::RefPtr<Dispatcher> found_dispatcher;
+    zx_rights_t found_rights = 0;
+    bool found = false;
+
+    // Pin the slot so that TearDown cannot drop the dispatcher reference
+    // while it is being copied. Interrupts stay disabled while pinned so
+    // that TearDown never waits on a preempted thread; the slot is always
+    // committed, so touching it cannot fault.
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    handle->readers_.fetch_add(1u, fbl::memory_order_seq_cst);
+    // The process id is loaded first, pairing with the release store in
+    // set_process_id(), so the fields read after it belong to the Handle
+    // that set it. The slot may have been freed and reused in the meantime,
+    // so check the base value again once the fields have been copied.
+    if (handle->process_id_.load(fbl::memory_order_seq_cst) == process_id &&
+        handle->base_value_ == value) {
+        found_dispatcher = handle->dispatcher_;
+        found_rights = handle->rights_;
+        fbl::atomic_thread_fence(fbl::memory_order_acquire);
+        if (likely(handle->base_value_ == value)) {
+            found = true;
+        } else {
+            found_dispatcher.reset();
+        }
+    }
+    handle->readers_.fetch_sub(1u, fbl::memory_order_release);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (found) {
+        *dispatcher = fbl::move(found_dispatcher);
+        *rights = found_rights;
+    }
+    return found;
+}
+
 uint32_t Handle::Count(const fbl::RefPtr<const Dispatcher>& dispatcher) {
-    // Handle::mutex_ also guards Dispatcher::handle_count_.
-    AutoLock lock(&mutex_);
     return dispatcher->current_handle_count();
 }
 
 size_t Handle::diagnostics::OutstandingHandles() {
     AutoLock lock(&mutex_);
-    return arena_.DiagnosticCount();
+    return arena_.DiagnosticCount() - handle_cache_count();
 }
 
 void Handle::diagnostics::DumpTableInfo() {
-    AutoLock lock(&mutex_);
-    arena_.Dump();
+    {
+        AutoLock lock(&mutex_);
+        arena_.Dump();
+    }
+    printf("  %zu free slots cached per-cpu\n", handle_cache_count());
 }
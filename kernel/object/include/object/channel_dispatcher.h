@@ -22,6 +22,7 @@
 class ChannelDispatcher final : public Dispatcher {
 public:
     class MessageWaiter;
+    using MessageList = fbl::DoublyLinkedList<fbl::unique_ptr<MessagePacket>>;
 
     static zx_status_t Create(fbl::RefPtr<Dispatcher>* dispatcher0,
                               fbl::RefPtr<Dispatcher>* dispatcher1, zx_rights_t* rights);
@@ -45,8 +46,27 @@ public:
                      fbl::unique_ptr<MessagePacket>* msg,
                      bool may_disard);
 
+    // Read up to |count| messages from this endpoint's message queue into |msgs|, all under one
+    // acquisition of the lock. |msg_sizes| and |msg_handle_counts| are in-out arrays of |count|
+    // entries, as for Read(); reading stops at the first message that does not fit its entry.
+    // Returns ZX_ERR_BUFFER_TOO_SMALL, with the size of the message in the first entries, if
+    // that is the first message.
+    zx_status_t ReadMany(uint32_t* msg_sizes,
+                         uint32_t* msg_handle_counts,
+                         size_t count,
+                         MessageList* msgs);
+
+    // Put |msgs|, which ReadMany() returned but the caller could not deliver, back at the front
+    // of this endpoint's message queue, in order, so that the next read returns them again.
+    void UnreadMany(MessageList* msgs);
+
     // Write to the opposing endpoint's message queue.
     zx_status_t Write(fbl::unique_ptr<MessagePacket> msg);
+
+    // Write all of |msgs|, in order, to the opposing endpoint's message queue under one
+    // acquisition of its lock. On failure |msgs| is left as it was and its handles are
+    // still to be put back by the caller.
+    zx_status_t WriteMany(MessageList* msgs);
     zx_status_t Call(fbl::unique_ptr<MessagePacket> msg,
                      zx_time_t deadline, bool* return_handles,
                      fbl::unique_ptr<MessagePacket>* reply);
@@ -93,7 +113,6 @@ public:
     };
 
 private:
-    using MessageList = fbl::DoublyLinkedList<fbl::unique_ptr<MessagePacket>>;
     using WaiterList = fbl::DoublyLinkedList<MessageWaiter*>;
 
     void RemoveWaiter(MessageWaiter* waiter);
@@ -101,6 +120,8 @@ private:
     ChannelDispatcher();
     void Init(fbl::RefPtr<ChannelDispatcher> other);
     int WriteSelf(fbl::unique_ptr<MessagePacket> msg);
+    int WriteSelfMany(MessageList* msgs);
+    int EnqueueLocked(fbl::unique_ptr<MessagePacket> msg, bool* queued) TA_REQ(lock_);
     zx_status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
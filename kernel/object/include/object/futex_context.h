@@ -23,6 +23,9 @@
 // When the thread at the head of the futex's blocked thread list is resumed,
 // The FutexNode for the new head of the blocked thread list is set as the hash table value
 // for the futex.
+// The hash table is split into shards by futex address, each with its own lock, so that
+// operations on unrelated futexes do not contend. A FutexNode's key and queue links are only
+// changed with the lock of the shard for its current key held.
 class FutexContext {
 public:
     FutexContext();
@@ -51,14 +54,33 @@ private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    static constexpr size_t kNumShards = 16;
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    // Hash table for futexes in one shard.
+    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
+    // The bucket count is coprime with kNumShards so that keys in one shard still spread out.
+    using HashTable = fbl::HashTable<uintptr_t, FutexNode*, fbl::SinglyLinkedList<FutexNode*>,
+                                     size_t, 7>;
 
-    // protects futex_table_
-    fbl::Mutex lock_;
+    struct Shard {
+        // protects futex_table
+        fbl::Mutex lock;
+        HashTable futex_table TA_GUARDED(lock);
+    };
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+    Shard* ShardFor(uintptr_t futex_key) {
+        return &shards_[FutexNode::GetHash(futex_key) % kNumShards];
+    }
+
+    static void QueueNodesLocked(Shard* shard, FutexNode* head) TA_REQ(shard->lock);
+
+    zx_status_t RequeueLocked(Shard* wake_shard, user_in_ptr<const int> wake_ptr,
+                              uintptr_t wake_key, uint32_t wake_count, int current_value,
+                              Shard* requeue_shard, uintptr_t requeue_key,
+                              uint32_t requeue_count, bool* any_woken)
+        TA_REQ(wake_shard->lock) TA_REQ(requeue_shard->lock);
+
+    bool UnqueueNode(FutexNode* node);
+
+    Shard shards_[kNumShards];
 };
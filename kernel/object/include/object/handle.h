@@ -87,9 +87,10 @@ public:
         return process_id_.load(fbl::memory_order_relaxed);
     }
 
-    // Sets the value returned by process_id().
+    // Sets the value returned by process_id(). A release store, so that a
+    // Lookup that sees the new process id also sees the rest of the Handle.
     void set_process_id(zx_koid_t pid) {
-        process_id_.store(pid, fbl::memory_order_relaxed);
+        process_id_.store(pid, fbl::memory_order_release);
     }
 
     // Returns the |rights| parameter that was provided when this instance
@@ -116,6 +117,13 @@ public:
     // Maps an integer obtained by Handle::base_value() back to a Handle.
     static Handle* FromU32(uint32_t value);
 
+    // Looks up the Handle for |value| without any lock and, if it is owned
+    // by the process |process_id|, returns its dispatcher and rights. A
+    // concurrent Delete of the Handle is safe: TearDown waits for any
+    // lookup that may have seen the Handle before dropping its dispatcher.
+    static bool Lookup(uint32_t value, zx_koid_t process_id,
+                       fbl::RefPtr<Dispatcher>* dispatcher, zx_rights_t* rights);
+
     // Get the number of outstanding handles for a given dispatcher.
     static uint32_t Count(const fbl::RefPtr<const Dispatcher>&);
 
@@ -145,12 +153,15 @@ private:
     // Private subroutines of Make and Dup.
     static void* Alloc(const fbl::RefPtr<Dispatcher>&, const char* what,
                        uint32_t* base_value);
+    static void* Refill(const char* what);
+    static void Free(void* addr);
     static uint32_t GetNewBaseValue(void* addr);
 
     // Handle should never be destroyed by anything other than Delete,
     // which uses TearDown to do the actual destruction.
     ~Handle() = default;
     void TearDown() TA_EXCL(mutex_);
+    void WaitForReaders();
     void Delete();
 
     // These two are allowed to call Delete.
@@ -165,7 +176,14 @@ private:
     const zx_rights_t rights_;
     const uint32_t base_value_;
 
-    // The handle arena and its mutex; also guards Dispatcher::handle_count_.
+    // The number of Lookup calls currently examining this slot. This
+    // belongs to the arena slot rather than to the Handle, since a lookup
+    // can race with the slot being freed and reused: the constructors
+    // leave it alone and TearDown does not clear it. Must stay last.
+    fbl::atomic<uint32_t> readers_;
+
+    // The handle arena and its mutex. Most allocations and frees go
+    // through per-cpu caches of free slots and do not take the mutex.
     static fbl::Mutex mutex_;
     static fbl::Arena TA_GUARDED(mutex_) arena_;
 
@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 
+#include <arch/defines.h>
 #include <lib/user_copy/user_ptr.h>
 #include <zircon/types.h>
 #include <fbl/intrusive_single_list.h>
@@ -26,14 +27,27 @@ public:
 
 private:
     // An MBuf is a small fixed-size chainable memory buffer.
+    //
+    // Bulk data goes in page MBufs instead, which take up a whole page from
+    // the pmm, header included, with the payload filling the rest of that
+    // page. A large write then costs one page allocation, usually recycled,
+    // per page rather than two or more heap allocations.
     struct MBuf : public fbl::SinglyLinkedListable<MBuf*> {
         // 8 for the linked list and 4 for the explicit uint32_t fields.
         static constexpr size_t kHeaderSize = 8 + (4 * 4);
         // 16 is for the malloc header.
         static constexpr size_t kMallocSize = 2048 - 16;
         static constexpr size_t kPayloadSize = kMallocSize - kHeaderSize;
+        static constexpr size_t kPagePayloadSize = PAGE_SIZE - kHeaderSize;
+
+        explicit MBuf(uint32_t cap) : cap_(cap) {}
 
         size_t rem() const;
+        bool is_page() const { return cap_ == kPagePayloadSize; }
+
+        // The |cap_| bytes after the header. For a small MBuf this is |data_|;
+        // a page MBuf's runs on to the end of its page, past |data_|.
+        char* payload() { return reinterpret_cast<char*>(this) + kHeaderSize; }
 
         uint32_t off_ = 0u;
         uint32_t len_ = 0u;
@@ -43,18 +57,28 @@ private:
         //
         // Always 0 in ZX_SOCKET_STREAM mode.
         uint32_t pkt_len_ = 0u;
-        uint32_t unused_;
-        char data_[kPayloadSize] = {0};
-        // TODO: maybe union data_ with char* blocks for large messages
+        // bytes of payload, kPayloadSize or kPagePayloadSize
+        const uint32_t cap_;
+        // only accessed through payload()
+        char data_[kPayloadSize];
     };
     static_assert(sizeof(MBuf) == MBuf::kMallocSize, "");
+    static_assert(sizeof(MBuf) <= PAGE_SIZE, "");
 
     static constexpr size_t kSizeMax = 128 * MBuf::kPayloadSize;
 
-    MBuf* AllocMBuf();
+    // page MBufs kept for reuse, beyond which they go back to the pmm
+    static constexpr size_t kPageFreeListMax = 16;
+
+    // Allocates an MBuf for the next |len| bytes of a write: a page MBuf if
+    // they would not fit in a small one.
+    MBuf* AllocMBuf(size_t len);
     void FreeMBuf(MBuf* buf);
+    static void DeleteMBuf(MBuf* buf);
 
     fbl::SinglyLinkedList<MBuf*> freelist_;
+    fbl::SinglyLinkedList<MBuf*> page_freelist_;
+    size_t page_freelist_len_ = 0u;
     fbl::SinglyLinkedList<MBuf*> tail_;
     MBuf* head_ = nullptr;;
     size_t size_ = 0u;
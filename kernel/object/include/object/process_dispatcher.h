@@ -268,6 +268,10 @@ private:
     ProcessDispatcher& operator=(const ProcessDispatcher&) = delete;
 
 
+    // Looks up |handle_value| without taking |handle_table_lock_|.
+    bool LookupHandle(zx_handle_t handle_value, fbl::RefPtr<Dispatcher>* dispatcher,
+                      zx_rights_t* rights);
+
     zx_status_t GetDispatcherInternal(zx_handle_t handle_value, fbl::RefPtr<Dispatcher>* dispatcher,
                                       zx_rights_t* rights);
 
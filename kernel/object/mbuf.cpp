@@ -10,23 +10,30 @@
 
 #include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
+#include <fbl/new.h>
+#include <vm/page.h>
+#include <vm/pmm.h>
 
 #define LOCAL_TRACE 0
 
 constexpr size_t MBufChain::MBuf::kHeaderSize;
 constexpr size_t MBufChain::MBuf::kMallocSize;
 constexpr size_t MBufChain::MBuf::kPayloadSize;
+constexpr size_t MBufChain::MBuf::kPagePayloadSize;
 constexpr size_t MBufChain::kSizeMax;
+constexpr size_t MBufChain::kPageFreeListMax;
 
 size_t MBufChain::MBuf::rem() const {
-    return kPayloadSize - (off_ + len_);
+    return cap_ - (off_ + len_);
 }
 
 MBufChain::~MBufChain() {
     while (!tail_.is_empty())
-        delete tail_.pop_front();
+        DeleteMBuf(tail_.pop_front());
     while (!freelist_.is_empty())
-        delete freelist_.pop_front();
+        DeleteMBuf(freelist_.pop_front());
+    while (!page_freelist_.is_empty())
+        DeleteMBuf(page_freelist_.pop_front());
 }
 
 bool MBufChain::is_full() const {
@@ -44,7 +51,7 @@ size_t MBufChain::Read(user_out_ptr<void> dst, size_t len, bool datagram) {
     size_t pos = 0;
     while (pos < len && !tail_.is_empty()) {
         MBuf& cur = tail_.front();
-        char* src = cur.data_ + cur.off_;
+        char* src = cur.payload() + cur.off_;
         size_t copy_len = MIN(cur.len_, len - pos);
         if (dst.byte_offset(pos).copy_array_to_user(src, copy_len) != ZX_OK)
             return pos;
@@ -78,26 +85,30 @@ zx_status_t MBufChain::WriteDatagram(user_in_ptr<const void> src,
         return ZX_ERR_SHOULD_WAIT;
 
     fbl::SinglyLinkedList<MBuf*> bufs;
-    for (size_t need = 1 + ((len - 1) / MBuf::kPayloadSize); need != 0; need--) {
-        auto buf = AllocMBuf();
+    MBuf* last = nullptr;
+    size_t pos = 0;
+    while (pos < len) {
+        auto buf = AllocMBuf(len - pos);
         if (buf == nullptr) {
             while (!bufs.is_empty())
                 FreeMBuf(bufs.pop_front());
             return ZX_ERR_SHOULD_WAIT;
         }
-        bufs.push_front(buf);
-    }
+        if (last == nullptr) {
+            bufs.push_front(buf);
+        } else {
+            bufs.insert_after(bufs.make_iterator(*last), buf);
+        }
+        last = buf;
 
-    size_t pos = 0;
-    for (auto& buf : bufs) {
-        size_t copy_len = fbl::min(MBuf::kPayloadSize, len - pos);
-        if (src.byte_offset(pos).copy_array_from_user(buf.data_, copy_len) != ZX_OK) {
+        size_t copy_len = fbl::min(buf->rem(), len - pos);
+        if (src.byte_offset(pos).copy_array_from_user(buf->payload(), copy_len) != ZX_OK) {
             while (!bufs.is_empty())
                 FreeMBuf(bufs.pop_front());
             return ZX_ERR_INVALID_ARGS; // Bad user buffer.
         }
         pos += copy_len;
-        buf.len_ += static_cast<uint32_t>(copy_len);
+        buf->len_ += static_cast<uint32_t>(copy_len);
     }
 
     bufs.front().pkt_len_ = static_cast<uint32_t>(len);
@@ -121,7 +132,7 @@ zx_status_t MBufChain::WriteDatagram(user_in_ptr<const void> src,
 zx_status_t MBufChain::WriteStream(user_in_ptr<const void> src,
                                    size_t len, size_t* written) {
     if (head_ == nullptr) {
-        head_ = AllocMBuf();
+        head_ = AllocMBuf(len);
         if (head_ == nullptr)
             return ZX_ERR_SHOULD_WAIT;
         tail_.push_front(head_);
@@ -130,13 +141,13 @@ zx_status_t MBufChain::WriteStream(user_in_ptr<const void> src,
     size_t pos = 0;
     while (pos < len) {
         if (head_->rem() == 0) {
-            auto next = AllocMBuf();
+            auto next = AllocMBuf(len - pos);
             if (next == nullptr)
                 break;
             tail_.insert_after(tail_.make_iterator(*head_), next);
             head_ = next;
         }
-        void* dst = head_->data_ + head_->off_ + head_->len_;
+        void* dst = head_->payload() + head_->off_ + head_->len_;
         size_t copy_len = fbl::min(head_->rem(), len - pos);
         if (size_ + copy_len > kSizeMax) {
             copy_len = kSizeMax - size_;
@@ -157,10 +168,25 @@ zx_status_t MBufChain::WriteStream(user_in_ptr<const void> src,
     return ZX_OK;
 }
 
-MBufChain::MBuf* MBufChain::AllocMBuf() {
+MBufChain::MBuf* MBufChain::AllocMBuf(size_t len) {
+    if (len > MBuf::kPayloadSize) {
+        if (!page_freelist_.is_empty()) {
+            page_freelist_len_--;
+            return page_freelist_.pop_front();
+        }
+        vm_page_t* p;
+        void* page = pmm_alloc_kpage(nullptr, &p);
+        if (page != nullptr) {
+            // kernel memory that is neither heap nor a VMO's
+            p->state = VM_PAGE_STATE_WIRED;
+            return new (page) MBuf(static_cast<uint32_t>(MBuf::kPagePayloadSize));
+        }
+        // fall back to a small one
+    }
+
     if (freelist_.is_empty()) {
         fbl::AllocChecker ac;
-        MBuf* buf = new (&ac) MBuf();
+        MBuf* buf = new (&ac) MBuf(static_cast<uint32_t>(MBuf::kPayloadSize));
         return (!ac.check()) ? nullptr : buf;
     }
     return freelist_.pop_front();
@@ -169,5 +195,22 @@ MBufChain::MBuf* MBufChain::AllocMBuf() {
 void MBufChain::FreeMBuf(MBuf* buf) {
     buf->off_ = 0u;
     buf->len_ = 0u;
-    freelist_.push_front(buf);
+    buf->pkt_len_ = 0u;
+    if (!buf->is_page()) {
+        freelist_.push_front(buf);
+    } else if (page_freelist_len_ < kPageFreeListMax) {
+        page_freelist_.push_front(buf);
+        page_freelist_len_++;
+    } else {
+        DeleteMBuf(buf);
+    }
+}
+
+void MBufChain::DeleteMBuf(MBuf* buf) {
+    if (buf->is_page()) {
+        buf->~MBuf();
+        pmm_free_kpages(buf, 1);
+    } else {
+        delete buf;
+    }
 }
@@ -6,13 +6,252 @@
 
 #include <object/message_packet.h>
 
+#include <arch/ops.h>
 #include <err.h>
+#include <kernel/auto_lock.h>
+#include <kernel/spinlock.h>
+#include <lib/counters.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <fbl/algorithm.h>
 #include <zxcpp/new.h>
 #include <object/handle_reaper.h>
 
+KCOUNTER(packet_alloc_256_count, "kernel.channel.packet.alloc.256");
+KCOUNTER(packet_alloc_1k_count, "kernel.channel.packet.alloc.1k");
+KCOUNTER(packet_alloc_4k_count, "kernel.channel.packet.alloc.4k");
+KCOUNTER(packet_alloc_large_count, "kernel.channel.packet.alloc.large");
+KCOUNTER(packet_heap_count, "kernel.channel.packet.heap");
+
+// Packet buffers (the MessagePacket, its handle array and its data) are
+// grouped into a few size classes. Each class has a pair of magazines of
+// free buffers per cpu, backed by a depot of full and empty magazines, so
+// that a packet allocated on one cpu and freed on another usually moves
+// between caches a magazine at a time rather than going to the heap.
+// Buffers too large for any class come straight from the heap.
+namespace {
+
+constexpr size_t kPacketClassSizes[] = {256u, 1024u, 4096u};
+constexpr size_t kNumPacketClasses = fbl::count_of(kPacketClassSizes);
+// Marks a buffer that did not come from a size class.
+constexpr uint8_t kLargePacketClass = kNumPacketClasses;
+
+const k_counter_desc* const kPacketClassCounters[] = {
+    packet_alloc_256_count,
+    packet_alloc_1k_count,
+    packet_alloc_4k_count,
+    packet_alloc_large_count,
+};
+static_assert(fbl::count_of(kPacketClassCounters) == kNumPacketClasses + 1, "");
+
+// Number of buffers held by a magazine.
+constexpr size_t kMagazineRounds = 16;
+// Most full magazines kept in a depot; beyond that, buffers go back to the
+// heap.
+constexpr size_t kDepotMaxFull = 16;
+
+struct Magazine {
+    Magazine* next;
+    size_t count;
+    void* rounds[kMagazineRounds];
+};
+
+// The current cpu's magazines for one size class. |loaded| is used first;
+// |previous| is swapped in before going to the depot.
+struct PacketCache {
+    SpinLock lock;
+    Magazine* loaded TA_GUARDED(lock);
+    Magazine* previous TA_GUARDED(lock);
+};
+
+struct PacketDepot {
+    SpinLock lock;
+    Magazine* full TA_GUARDED(lock);
+    size_t full_count TA_GUARDED(lock);
+    Magazine* empty TA_GUARDED(lock);
+};
+
+struct PacketCpuCaches {
+    PacketCache classes[kNumPacketClasses];
+} __CPU_ALIGN;
+
+PacketCpuCaches packet_caches[SMP_MAX_CPUS];
+PacketDepot packet_depots[kNumPacketClasses];
+
+// Each buffer starts with a header recording its size class, so that
+// operator delete can find it without reading the destroyed packet. Sized to
+// keep the packet that follows suitably aligned.
+constexpr size_t kPacketHeaderSize = alignof(MessagePacket);
+static_assert(kPacketHeaderSize >= sizeof(uint8_t), "");
+
+uint8_t packet_size_class(size_t size) {
+    for (uint8_t i = 0; i < kNumPacketClasses; i++) {
+        if (size <= kPacketClassSizes[i])
+            return i;
+    }
+    return kLargePacketClass;
+}
+
+Magazine* magazine_pop(Magazine** list) {
+    Magazine* mag = *list;
+    if (mag)
+        *list = mag->next;
+    return mag;
+}
+
+void magazine_push(Magazine** list, Magazine* mag) {
+    mag->next = *list;
+    *list = mag;
+}
+
+void swap_magazines(PacketCache* cache) TA_REQ(cache->lock) {
+    Magazine* mag = cache->loaded;
+    cache->loaded = cache->previous;
+    cache->previous = mag;
+}
+
+// Takes a buffer of size class |sc| from the current cpu's cache, trading
+// an empty magazine for a full one from the depot if needed. Returns
+// nullptr if no cached buffer is available.
+void* packet_cache_alloc(uint8_t sc) TA_NO_THREAD_SAFETY_ANALYSIS {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PacketCache& cache = packet_caches[arch_curr_cpu_num()].classes[sc];
+
+    void* ptr = nullptr;
+    cache.lock.Acquire();
+    if (!cache.loaded || cache.loaded->count == 0) {
+        if (cache.previous && cache.previous->count > 0) {
+            swap_magazines(&cache);
+        } else {
+            PacketDepot& depot = packet_depots[sc];
+            depot.lock.Acquire();
+            Magazine* full = magazine_pop(&depot.full);
+            if (full) {
+                depot.full_count--;
+                if (cache.previous)
+                    magazine_push(&depot.empty, cache.previous);
+                cache.previous = cache.loaded;
+                cache.loaded = full;
+            }
+            depot.lock.Release();
+        }
+    }
+    if (cache.loaded && cache.loaded->count > 0)
+        ptr = cache.loaded->rounds[--cache.loaded->count];
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return ptr;
+}
+
+enum class CacheFree {
+    kCached,       // The buffer is now in the cache.
+    kNeedMagazine, // The depot has no empty magazine to trade for.
+    kOverflow,     // |*overflow| is a full magazine the depot has no room for.
+};
+
+// Puts a buffer of size class |sc| in the current cpu's cache, trading a
+// full magazine for an empty one from the depot if needed.
+CacheFree packet_cache_free(uint8_t sc, void* ptr,
+                            Magazine** overflow) TA_NO_THREAD_SAFETY_ANALYSIS {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PacketCache& cache = packet_caches[arch_curr_cpu_num()].classes[sc];
+
+    CacheFree result = CacheFree::kCached;
+    cache.lock.Acquire();
+    if (!cache.loaded || cache.loaded->count == kMagazineRounds) {
+        if (cache.previous && cache.previous->count < kMagazineRounds) {
+            swap_magazines(&cache);
+        } else {
+            PacketDepot& depot = packet_depots[sc];
+            depot.lock.Acquire();
+            Magazine* empty = magazine_pop(&depot.empty);
+            if (!empty) {
+                result = CacheFree::kNeedMagazine;
+            } else if (cache.previous) {
+                // |previous| is full here.
+                if (depot.full_count < kDepotMaxFull) {
+                    magazine_push(&depot.full, cache.previous);
+                    depot.full_count++;
+                } else {
+                    *overflow = cache.previous;
+                    result = CacheFree::kOverflow;
+                }
+            }
+            if (empty) {
+                cache.previous = cache.loaded;
+                cache.loaded = empty;
+            }
+            depot.lock.Release();
+        }
+    }
+    if (result != CacheFree::kNeedMagazine)
+        cache.loaded->rounds[cache.loaded->count++] = ptr;
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return result;
+}
+
+void packet_depot_add_empty(uint8_t sc, Magazine* mag) {
+    PacketDepot& depot = packet_depots[sc];
+    AutoSpinLockIrqSave lock(&depot.lock);
+    magazine_push(&depot.empty, mag);
+}
+
+void* packet_alloc(size_t size, uint8_t* size_class) {
+    uint8_t sc = packet_size_class(size);
+    kcounter_add(kPacketClassCounters[sc], 1u);
+    *size_class = sc;
+
+    if (sc != kLargePacketClass) {
+        void* ptr = packet_cache_alloc(sc);
+        if (ptr)
+            return ptr;
+        size = kPacketClassSizes[sc];
+    }
+    kcounter_add(packet_heap_count, 1u);
+    return malloc(size);
+}
+
+void packet_free(void* ptr, uint8_t sc) {
+    if (sc == kLargePacketClass) {
+        free(ptr);
+        return;
+    }
+
+    for (;;) {
+        Magazine* overflow = nullptr;
+        switch (packet_cache_free(sc, ptr, &overflow)) {
+        case CacheFree::kCached:
+            return;
+        case CacheFree::kOverflow:
+            // Nothing else can see |overflow|; empty it into the heap and
+            // keep the magazine for later.
+            while (overflow->count > 0)
+                free(overflow->rounds[--overflow->count]);
+            packet_depot_add_empty(sc, overflow);
+            return;
+        case CacheFree::kNeedMagazine: {
+            // Magazines are only ever allocated here, and never freed.
+            Magazine* mag = static_cast<Magazine*>(calloc(1, sizeof(Magazine)));
+            if (!mag) {
+                free(ptr);
+                return;
+            }
+            packet_depot_add_empty(sc, mag);
+            break;
+        }
+        }
+    }
+}
+
+} // namespace
+
 // static
 zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
                                      fbl::unique_ptr<MessagePacket>* msg) {
@@ -23,17 +262,17 @@ zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
         return ZX_ERR_OUT_OF_RANGE;
     }
 
-    // Allocate space for the MessagePacket object followed by num_handles
-    // Handle*s followed by data_size bytes.
-    // TODO(dbort): Use mbuf-style memory for data_size, ideally allocating from
-    // somewhere other than the heap. Lets us better track and isolate channel
-    // memory usage.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
+    // Allocate space for the header and the MessagePacket object followed
+    // by num_handles Handle*s followed by data_size bytes.
+    uint8_t size_class;
+    char* ptr = static_cast<char*>(packet_alloc(kPacketHeaderSize + sizeof(MessagePacket) +
+                                                num_handles * sizeof(Handle*) +
+                                                data_size, &size_class));
     if (ptr == nullptr) {
         return ZX_ERR_NO_MEMORY;
     }
+    *reinterpret_cast<uint8_t*>(ptr) = size_class;
+    ptr += kPacketHeaderSize;
 
     // The storage space for the Handle*s is not initialized because
     // the only creators of MessagePackets (sys_channel_write and
@@ -45,6 +284,12 @@ zx_status_t MessagePacket::NewPacket(uint32_t data_size, uint32_t num_handles,
     return ZX_OK;
 }
 
+// static
+void MessagePacket::operator delete(void* ptr) {
+    char* buffer = static_cast<char*>(ptr) - kPacketHeaderSize;
+    packet_free(buffer, *reinterpret_cast<uint8_t*>(buffer));
+}
+
 // static
 zx_status_t MessagePacket::Create(user_in_ptr<const void> data, uint32_t data_size,
                                   uint32_t num_handles,
@@ -52,9 +52,12 @@ static zx_handle_t map_handle_to_value(const Handle* handle, uint32_t mixer) {
     return static_cast<zx_handle_t>(mixer ^ handle_id);
 }
 
+static uint32_t map_value_to_handle_id(zx_handle_t value, uint32_t mixer) {
+    return (static_cast<uint32_t>(value) ^ mixer) >> 1;
+}
+
 static Handle* map_value_to_handle(zx_handle_t value, uint32_t mixer) {
-    auto handle_id = (static_cast<uint32_t>(value) ^ mixer) >> 1;
-    return Handle::FromU32(handle_id);
+    return Handle::FromU32(map_value_to_handle_id(value, mixer));
 }
 
 zx_status_t ProcessDispatcher::Create(
@@ -403,25 +406,35 @@ void ProcessDispatcher::UndoRemoveHandleLocked(zx_handle_t handle_value) {
     AddHandleLocked(HandleOwner(handle));
 }
 
+bool ProcessDispatcher::LookupHandle(zx_handle_t handle_value,
+                                     fbl::RefPtr<Dispatcher>* dispatcher,
+                                     zx_rights_t* rights) {
+    uint32_t handle_id = map_value_to_handle_id(handle_value, handle_rand_);
+    if (likely(Handle::Lookup(handle_id, get_koid(), dispatcher, rights)))
+        return true;
+
+    // See GetHandleLocked.
+    QueryPolicy(ZX_POL_BAD_HANDLE);
+    return false;
+}
+
 zx_koid_t ProcessDispatcher::GetKoidForHandle(zx_handle_t handle_value) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
+    fbl::RefPtr<Dispatcher> dispatcher;
+    zx_rights_t rights;
+    if (!LookupHandle(handle_value, &dispatcher, &rights))
         return ZX_KOID_INVALID;
-    return handle->dispatcher()->get_koid();
+    return dispatcher->get_koid();
 }
 
 zx_status_t ProcessDispatcher::GetDispatcherInternal(zx_handle_t handle_value,
                                                      fbl::RefPtr<Dispatcher>* dispatcher,
                                                      zx_rights_t* rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
+    zx_rights_t handle_rights;
+    if (!LookupHandle(handle_value, dispatcher, &handle_rights))
         return ZX_ERR_BAD_HANDLE;
 
-    *dispatcher = handle->dispatcher();
     if (rights)
-        *rights = handle->rights();
+        *rights = handle_rights;
     return ZX_OK;
 }
 
@@ -429,17 +442,17 @@ zx_status_t ProcessDispatcher::GetDispatcherWithRightsInternal(zx_handle_t handl
                                                                zx_rights_t desired_rights,
                                                                fbl::RefPtr<Dispatcher>* dispatcher_out,
                                                                zx_rights_t* out_rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
+    fbl::RefPtr<Dispatcher> dispatcher;
+    zx_rights_t handle_rights;
+    if (!LookupHandle(handle_value, &dispatcher, &handle_rights))
         return ZX_ERR_BAD_HANDLE;
 
-    if (!handle->HasRights(desired_rights))
+    if ((handle_rights & desired_rights) != desired_rights)
         return ZX_ERR_ACCESS_DENIED;
 
-    *dispatcher_out = handle->dispatcher();
+    *dispatcher_out = fbl::move(dispatcher);
     if (out_rights)
-        *out_rights = handle->rights();
+        *out_rights = handle_rights;
     return ZX_OK;
 }
 
@@ -487,6 +500,7 @@ zx_status_t ProcessDispatcher::GetStats(zx_info_task_stats_t* stats) {
     stats->mem_private_bytes = usage.private_pages * PAGE_SIZE;
     stats->mem_shared_bytes = usage.shared_pages * PAGE_SIZE;
     stats->mem_scaled_shared_bytes = usage.scaled_shared_bytes;
+    stats->mem_compressed_bytes = usage.compressed_pages * PAGE_SIZE;
     return ZX_OK;
 }
 
@@ -742,6 +756,7 @@ const char* StateToString(ProcessDispatcher::State state) {
 }
 
 bool ProcessDispatcher::IsHandleValid(zx_handle_t handle_value) {
-    AutoLock lock(&handle_table_lock_);
-    return (GetHandleLocked(handle_value) != nullptr);
+    fbl::RefPtr<Dispatcher> dispatcher;
+    zx_rights_t rights;
+    return LookupHandle(handle_value, &dispatcher, &rights);
 }
@@ -75,6 +75,14 @@ zx_status_t split_syscall_flags(uint32_t flags, uint32_t* vmar_flags, uint* arch
         vmar |= VMAR_FLAG_CAN_MAP_EXECUTE;
         flags &= ~ZX_VM_FLAG_CAN_MAP_EXECUTE;
     }
+    if (flags & ZX_VM_FLAG_NO_FAULT_AROUND) {
+        vmar |= VMAR_FLAG_NO_FAULT_AROUND;
+        flags &= ~ZX_VM_FLAG_NO_FAULT_AROUND;
+    }
+    if (flags & ZX_VM_FLAG_ALLOW_LARGE_PAGES) {
+        vmar |= VMAR_FLAG_LARGE_PAGES;
+        flags &= ~ZX_VM_FLAG_ALLOW_LARGE_PAGES;
+    }
 
     if (flags != 0)
         return ZX_ERR_INVALID_ARGS;
@@ -145,6 +145,98 @@ zx_status_t sys_channel_read(zx_handle_t handle_value, uint32_t options,
     return result;
 }
 
+zx_status_t sys_channel_read_many(zx_handle_t handle_value, uint32_t options,
+                                  user_inout_ptr<zx_channel_msg_t> user_msgs, uint32_t count,
+                                  user_out_ptr<uint32_t> actual) {
+    LTRACEF("handle %x msgs %p count %u\n", handle_value, user_msgs.get(), count);
+
+    if (count == 0u)
+        return ZX_ERR_INVALID_ARGS;
+    if (count > ZX_CHANNEL_MAX_MSGS_PER_CALL)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<ChannelDispatcher> channel;
+    zx_status_t result = up->GetDispatcherWithRights(handle_value, ZX_RIGHT_READ, &channel);
+    if (result != ZX_OK)
+        return result;
+
+    // No options are supported.
+    if (options)
+        return ZX_ERR_NOT_SUPPORTED;
+
+    zx_channel_msg_t msgs[ZX_CHANNEL_MAX_MSGS_PER_CALL];
+    if (user_msgs.copy_array_from_user(msgs, count) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    uint32_t num_bytes[ZX_CHANNEL_MAX_MSGS_PER_CALL];
+    uint32_t num_handles[ZX_CHANNEL_MAX_MSGS_PER_CALL];
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        num_bytes[ix] = msgs[ix].num_bytes;
+        num_handles[ix] = msgs[ix].num_handles;
+    }
+
+    ChannelDispatcher::MessageList read;
+    result = channel->ReadMany(num_bytes, num_handles, count, &read);
+    if (result == ZX_ERR_BUFFER_TOO_SMALL) {
+        // As for zx_channel_read(), report the size of the message that didn't fit.
+        msgs[0].num_bytes = num_bytes[0];
+        msgs[0].num_handles = num_handles[0];
+        zx_status_t status = user_msgs.copy_array_to_user(msgs, 1u);
+        if (status != ZX_OK)
+            return status;
+        if (actual) {
+            status = actual.copy_to_user(0u);
+            if (status != ZX_OK)
+                return status;
+        }
+        return result;
+    }
+    if (result != ZX_OK)
+        return result;
+
+    uint32_t num_read = 0u;
+    while (!read.is_empty()) {
+        if (num_bytes[num_read] > 0u) {
+            if (read.front().CopyDataTo(make_user_out_ptr(msgs[num_read].bytes)) != ZX_OK) {
+                // Nothing of this message or the ones after it has been
+                // handed out yet, so put them back for the next read and
+                // report the messages that were delivered, if any.
+                channel->UnreadMany(&read);
+                if (num_read == 0u)
+                    return ZX_ERR_INVALID_ARGS;
+                break;
+            }
+        }
+
+        fbl::unique_ptr<MessagePacket> msg = read.pop_front();
+        msgs[num_read].num_bytes = num_bytes[num_read];
+        msgs[num_read].num_handles = num_handles[num_read];
+
+        // As in zx_channel_read(), the handles of each message are written
+        // after its data.
+        if (num_handles[num_read] > 0u) {
+            msg_get_handles(up, msg.get(), make_user_out_ptr(msgs[num_read].handles),
+                            num_handles[num_read]);
+        }
+
+        ktrace(TAG_CHANNEL_READ, (uint32_t)channel->get_koid(),
+               num_bytes[num_read], num_handles[num_read], 0);
+        ++num_read;
+    }
+
+    zx_status_t status = user_msgs.copy_array_to_user(msgs, num_read);
+    if (status != ZX_OK)
+        return status;
+    if (actual) {
+        status = actual.copy_to_user(num_read);
+        if (status != ZX_OK)
+            return status;
+    }
+    return ZX_OK;
+}
+
 static zx_status_t channel_read_out(ProcessDispatcher* up,
                                     fbl::unique_ptr<MessagePacket> reply,
                                     zx_channel_call_args_t* args,
@@ -296,6 +388,73 @@ zx_status_t sys_channel_write(zx_handle_t handle_value, uint32_t options,
     return ZX_OK;
 }
 
+// Puts the handles of messages that were not written back into the process.
+static void msg_list_return_handles(ProcessDispatcher* up, ChannelDispatcher::MessageList* msgs) {
+    AutoLock lock(up->handle_table_lock());
+    for (auto& msg : *msgs) {
+        Handle* const* handle_list = msg.handles();
+        for (uint32_t ix = 0; ix != msg.num_handles(); ++ix) {
+            up->AddHandleLocked(HandleOwner(handle_list[ix]));
+        }
+        msg.set_owns_handles(false);
+    }
+}
+
+zx_status_t sys_channel_write_many(zx_handle_t handle_value, uint32_t options,
+                                   user_in_ptr<const zx_channel_msg_t> user_msgs, uint32_t count) {
+    LTRACEF("handle %x msgs %p count %u options 0x%x\n",
+            handle_value, user_msgs.get(), count, options);
+
+    if (options || count == 0u)
+        return ZX_ERR_INVALID_ARGS;
+    if (count > ZX_CHANNEL_MAX_MSGS_PER_CALL)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    fbl::RefPtr<ChannelDispatcher> channel;
+    zx_status_t result = up->GetDispatcherWithRights(handle_value, ZX_RIGHT_WRITE, &channel);
+    if (result != ZX_OK)
+        return result;
+
+    zx_channel_msg_t msgs[ZX_CHANNEL_MAX_MSGS_PER_CALL];
+    if (user_msgs.copy_array_from_user(msgs, count) != ZX_OK)
+        return ZX_ERR_INVALID_ARGS;
+
+    // Build every message before writing any, so that either all of them are
+    // written or none is and every handle stays with this process.
+    ChannelDispatcher::MessageList list;
+    zx_handle_t handles[kMaxMessageHandles];
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        fbl::unique_ptr<MessagePacket> msg;
+        result = MessagePacket::Create(make_user_in_ptr<const void>(msgs[ix].bytes),
+                                       msgs[ix].num_bytes, msgs[ix].num_handles, &msg);
+        if (result == ZX_OK && msgs[ix].num_handles > 0u) {
+            result = msg_put_handles(up, msg.get(), handles,
+                                     make_user_in_ptr<const zx_handle_t>(msgs[ix].handles),
+                                     msgs[ix].num_handles,
+                                     static_cast<Dispatcher*>(channel.get()));
+        }
+        if (result != ZX_OK) {
+            msg_list_return_handles(up, &list);
+            return result;
+        }
+        list.push_back(fbl::move(msg));
+    }
+
+    result = channel->WriteMany(&list);
+    if (result != ZX_OK) {
+        msg_list_return_handles(up, &list);
+        return result;
+    }
+
+    for (uint32_t ix = 0; ix != count; ++ix) {
+        ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(),
+               msgs[ix].num_bytes, msgs[ix].num_handles, 0);
+    }
+    return ZX_OK;
+}
+
 zx_status_t sys_channel_call_noretry(zx_handle_t handle_value, uint32_t options,
                                      zx_time_t deadline,
                                      user_in_ptr<const zx_channel_call_args_t> user_args,
@@ -6,6 +6,7 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <trace.h>
 
 #include <kernel/mp.h>
@@ -317,8 +318,15 @@ zx_status_t sys_object_get_info(zx_handle_t handle, uint32_t topic,
             if (err != ZX_OK)
                 return err;
 
+            // Callers built before mem_compressed_bytes was added pass the
+            // smaller struct; give them the fields they know about.
+            size_t record_size = sizeof(info);
+            constexpr size_t kOldRecordSize = offsetof(zx_info_task_stats_t, mem_compressed_bytes);
+            if (buffer_size < record_size && buffer_size >= kOldRecordSize)
+                record_size = kOldRecordSize;
+
             return single_record_result(
-                _buffer, buffer_size, _actual, _avail, &info, sizeof(info));
+                _buffer, buffer_size, _actual, _avail, &info, record_size);
         }
         case ZX_INFO_PROCESS_MAPS: {
             fbl::RefPtr<ProcessDispatcher> process;
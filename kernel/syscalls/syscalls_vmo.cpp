@@ -8,6 +8,7 @@
 #include <inttypes.h>
 #include <trace.h>
 
+#include <vm/page_compression.h>
 #include <vm/vm_object.h>
 #include <vm/vm_object_paged.h>
 
@@ -26,7 +27,7 @@
 zx_status_t sys_vmo_create(uint64_t size, uint32_t options, user_out_ptr<zx_handle_t> _out) {
     LTRACEF("size %#" PRIx64 "\n", size);
 
-    if (options != 0u)
+    if (options & ~ZX_VMO_MERGEABLE)
         return ZX_ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -36,7 +37,12 @@ zx_status_t sys_vmo_create(uint64_t size, uint32_t options, user_out_ptr<zx_hand
 
     // create a vm object
     fbl::RefPtr<VmObject> vmo;
-    res = VmObjectPaged::Create(0, size, &vmo);
+    // anonymous user memory is what the compressed store is for; leave it
+    // off the scanner's list when there is no store
+    uint32_t vmo_options = page_compression_enabled() ? VmObjectPaged::kCompressible : 0;
+    if (options & ZX_VMO_MERGEABLE)
+        vmo_options |= VmObjectPaged::kMergeable;
+    res = VmObjectPaged::Create(0, vmo_options, size, &vmo);
     if (res != ZX_OK)
         return res;
 
@@ -10,8 +10,10 @@
 #include <arch/ops.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/percpu.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <platform.h>
@@ -20,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <vm/vm_aspace.h>
 
 const size_t BUFSIZE = (8 * 1024 * 1024);
 const size_t ITER = (1UL * 1024 * 1024 * 1024 / BUFSIZE); // enough iterations to have to copy/set 1GB of memory
@@ -172,6 +175,50 @@ __NO_INLINE static void bench_memcpy() {
     free(buf);
 }
 
+// Copy and set throughput at each size, to show where memcpy and memset
+// switch between their small, unrolled and string instruction variants.
+__NO_INLINE static void bench_memcpy_memset_sizes() {
+    static const size_t sizes[] = {1, 4, 8, 16, 32, 64, 128, 256, 512,
+                                   1024, 4096, 16384, 65536, 1024 * 1024};
+    const size_t total = 256 * 1024 * 1024;
+    const size_t max_size = sizes[countof(sizes) - 1];
+
+    uint8_t* buf = (uint8_t*)memalign(PAGE_SIZE, max_size * 2);
+    if (!buf)
+        return;
+    memset(buf, 0x5a, max_size * 2);
+
+    printf("%8s %16s %16s\n", "size", "memcpy bytes/cyc", "memset bytes/cyc");
+    for (size_t size : sizes) {
+        // Cap the iterations for tiny sizes, which are dominated by call overhead.
+        const size_t iter = total / (size < 64 ? 64 : size);
+
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+        uint64_t copy = arch_cycle_count();
+        for (size_t i = 0; i < iter; i++) {
+            memcpy(buf, buf + max_size, size);
+            __asm__ volatile("" ::: "memory");
+        }
+        copy = arch_cycle_count() - copy;
+
+        uint64_t set = arch_cycle_count();
+        for (size_t i = 0; i < iter; i++) {
+            memset(buf, (int)i, size);
+            __asm__ volatile("" ::: "memory");
+        }
+        set = arch_cycle_count() - set;
+        arch_interrupt_restore(state, ARCH_DEFAULT_SPIN_LOCK_FLAG_INTERRUPTS);
+
+        uint64_t copy_rate = (size * iter * 1000ULL) / (copy ? copy : 1);
+        uint64_t set_rate = (size * iter * 1000ULL) / (set ? set : 1);
+        printf("%8zu %12" PRIu64 ".%03" PRIu64 " %12" PRIu64 ".%03" PRIu64 "\n",
+               size, copy_rate / 1000, copy_rate % 1000, set_rate / 1000, set_rate % 1000);
+    }
+
+    free(buf);
+}
+
 __NO_INLINE static void bench_spinlock() {
     spin_lock_saved_state_t state;
     spin_lock_saved_state_t state2;
@@ -235,10 +282,222 @@ __NO_INLINE static void bench_mutex() {
     printf("%" PRIu64 " cycles to acquire/release uncontended mutex %u times (%" PRIu64 " cycles per)\n", c, count, c / count);
 }
 
+// Per-cpu scaling benchmarks: a work function runs on threads pinned to a growing
+// number of cpus, all released at once.
+typedef void (*bench_cpus_func)(void* arg, uint index, uint thread);
+
+static const uint bench_cpus_max_threads = 2;
+
+struct bench_cpus_state {
+    bench_cpus_func func;
+    void* arg;
+    event_t start;
+    // Set if not every thread could be created; the threads that were then
+    // return without running |func|.
+    bool abort;
+};
+
+struct bench_cpus_thread_arg {
+    bench_cpus_state* state;
+    uint index;
+    uint thread;
+};
+
+static int bench_cpus_thread(void* _arg) {
+    auto arg = static_cast<bench_cpus_thread_arg*>(_arg);
+    event_wait(&arg->state->start);
+    if (arg->state->abort)
+        return 0;
+    arg->state->func(arg->state->arg, arg->index, arg->thread);
+    return 0;
+}
+
+// Run |func| on |threads_per_cpu| threads pinned to each of the first |num_cpus| active
+// cpus. |func| is passed the index of its cpu among those used and its thread number on
+// that cpu. Returns the number of cpus used, and in |elapsed| the time until all finished,
+// or 0 if the threads could not all be created.
+static uint bench_on_cpus(uint num_cpus, uint threads_per_cpu, bench_cpus_func func, void* arg,
+                          zx_duration_t* elapsed) {
+    DEBUG_ASSERT(threads_per_cpu <= bench_cpus_max_threads);
+
+    bench_cpus_state state;
+    state.func = func;
+    state.arg = arg;
+    state.abort = false;
+    event_init(&state.start, false, 0);
+
+    bench_cpus_thread_arg args[SMP_MAX_CPUS][bench_cpus_max_threads];
+    thread_t* threads[SMP_MAX_CPUS][bench_cpus_max_threads];
+    cpu_mask_t active = mp_get_active_mask();
+    uint n = 0;
+    uint started = 0;
+    for (cpu_num_t cpu = 0; cpu < SMP_MAX_CPUS && n < num_cpus && !state.abort; cpu++) {
+        if (!(active & cpu_num_to_mask(cpu)))
+            continue;
+
+        for (uint j = 0; j < threads_per_cpu; j++) {
+            args[n][j] = {&state, n, j};
+            threads[n][j] = thread_create("bench cpus", &bench_cpus_thread, &args[n][j],
+                                          DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+            if (!threads[n][j]) {
+                state.abort = true;
+                break;
+            }
+            thread_set_cpu_affinity(threads[n][j], cpu_num_to_mask(cpu));
+            thread_resume(threads[n][j]);
+            started++;
+        }
+        n++;
+    }
+
+    zx_time_t t = current_time();
+    event_signal(&state.start, true);
+    for (uint i = 0; i < started; i++)
+        thread_join(threads[i / threads_per_cpu][i % threads_per_cpu], NULL, ZX_TIME_INFINITE);
+    *elapsed = current_time() - t;
+
+    event_destroy(&state.start);
+    return state.abort ? 0 : n;
+}
+
+// Run |bench| on 1, 2, 4, ... cpus, and on all of them.
+static void bench_sweep_cpus(void (*bench)(uint num_cpus)) {
+    uint active_cpus = __builtin_popcount(mp_get_active_mask());
+    for (uint num_cpus = 1; num_cpus <= active_cpus; num_cpus *= 2) {
+        bench(num_cpus);
+    }
+    if ((active_cpus & (active_cpus - 1)) != 0) {
+        bench(active_cpus);
+    }
+}
+
+struct sched_ping_pong_pair {
+    event_t ping;
+    event_t pong;
+};
+
+static const uint sched_ping_pong_count = 64 * 1024;
+
+static void sched_ping_pong_work(void* arg, uint index, uint thread) {
+    sched_ping_pong_pair* pair = &static_cast<sched_ping_pong_pair*>(arg)[index];
+
+    for (uint i = 0; i < sched_ping_pong_count; i++) {
+        if (thread == 0) {
+            event_signal(&pair->ping, true);
+            event_wait(&pair->pong);
+        } else {
+            event_wait(&pair->ping);
+            event_signal(&pair->pong, true);
+        }
+    }
+}
+
+// Ping-pong a pair of threads pinned to each of the first |num_cpus| active cpus. Every
+// round trip is two blocks, two wakeups and two context switches local to that cpu. The
+// run queues each have their own lock, so how far short of scaling with the cpu count
+// the aggregate rate falls shows how much the pairs still contend on thread_lock, which
+// the wait queue and event paths take around every block and wakeup.
+__NO_INLINE static void bench_sched_ping_pong_cpus(uint num_cpus) {
+    sched_ping_pong_pair pairs[SMP_MAX_CPUS];
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        event_init(&pairs[i].ping, false, EVENT_FLAG_AUTOUNSIGNAL);
+        event_init(&pairs[i].pong, false, EVENT_FLAG_AUTOUNSIGNAL);
+    }
+
+    zx_duration_t t;
+    uint n = bench_on_cpus(num_cpus, 2, sched_ping_pong_work, pairs, &t);
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        event_destroy(&pairs[i].ping);
+        event_destroy(&pairs[i].pong);
+    }
+
+    if (n == 0) {
+        printf("%u cpus: failed to create threads\n", num_cpus);
+        return;
+    }
+
+    uint64_t switches = 2ULL * sched_ping_pong_count * n;
+    printf("%u cpus: %" PRIu64 " context switches in %" PRIi64 " ns, %" PRIu64 " switches/sec\n",
+           n, switches, t, t ? (switches * ZX_SEC(1)) / t : 0);
+}
+
+static const uint heap_churn_rounds = 64 * 1024;
+// a handful of typical kernel object sizes
+static const size_t heap_churn_sizes[] = {24, 64, 96, 200, 512, 1024};
+
+static void heap_churn_work(void* arg, uint index, uint thread) {
+    void* ptrs[countof(heap_churn_sizes)];
+    for (uint i = 0; i < heap_churn_rounds; i++) {
+        for (size_t j = 0; j < countof(heap_churn_sizes); j++)
+            ptrs[j] = malloc(heap_churn_sizes[j]);
+        for (size_t j = 0; j < countof(heap_churn_sizes); j++)
+            free(ptrs[j]);
+    }
+}
+
+// Run malloc/free churn on one thread pinned to each of the first |num_cpus| active cpus.
+__NO_INLINE static void bench_heap_churn_cpus(uint num_cpus) {
+    zx_duration_t t;
+    uint n = bench_on_cpus(num_cpus, 1, heap_churn_work, nullptr, &t);
+    if (n == 0) {
+        printf("%u cpus: failed to create threads\n", num_cpus);
+        return;
+    }
+
+    uint64_t allocs = countof(heap_churn_sizes) * uint64_t(heap_churn_rounds) * n;
+    printf("%u cpus: %" PRIu64 " malloc/free pairs in %" PRIi64 " ns, %" PRIu64 " pairs/sec\n",
+           n, allocs, t, t ? (allocs * ZX_SEC(1)) / t : 0);
+}
+
+static uint64_t total_generic_ipis() {
+    uint64_t total = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        total += percpu[i].stats.generic_ipis;
+    }
+    return total;
+}
+
+// Measure the cost of write-protecting and then unmapping committed kernel
+// mappings of increasing size, along with the number of TLB shootdown IPIs
+// each operation generates.
+__NO_INLINE static void bench_unmap() {
+    VmAspace* aspace = VmAspace::kernel_aspace();
+
+    for (size_t size = 64 * 1024; size <= 64 * 1024 * 1024; size *= 4) {
+        void* ptr;
+        zx_status_t status = aspace->Alloc("bench_unmap", size, &ptr, 0,
+                                           VmAspace::VMM_FLAG_COMMIT,
+                                           ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE);
+        if (status != ZX_OK) {
+            printf("failed to allocate %zu bytes, skipping\n", size);
+            continue;
+        }
+        vaddr_t va = reinterpret_cast<vaddr_t>(ptr);
+
+        uint64_t ipis = total_generic_ipis();
+        zx_time_t t = current_time();
+        aspace->arch_aspace().Protect(va, size / PAGE_SIZE, ARCH_MMU_FLAG_PERM_READ);
+        zx_time_t protect_time = current_time() - t;
+        uint64_t protect_ipis = total_generic_ipis() - ipis;
+
+        ipis = total_generic_ipis();
+        t = current_time();
+        aspace->FreeRegion(va);
+        zx_time_t unmap_time = current_time() - t;
+        uint64_t unmap_ipis = total_generic_ipis() - ipis;
+
+        printf("%6zu KB: protect %" PRIi64 " ns (%" PRIu64 " ipis), "
+               "unmap %" PRIi64 " ns (%" PRIu64 " ipis)\n",
+               size / 1024, protect_time, protect_ipis, unmap_time, unmap_ipis);
+    }
+}
+
 void benchmarks() {
     bench_set_overhead();
     bench_memcpy();
     bench_memset();
+    bench_memcpy_memset_sizes();
 
     bench_memset_per_page();
     bench_zero_page();
@@ -251,4 +510,8 @@ void benchmarks() {
 
     bench_spinlock();
     bench_mutex();
+
+    bench_sweep_cpus(bench_sched_ping_pong_cpus);
+    bench_sweep_cpus(bench_heap_churn_cpus);
+    bench_unmap();
 }
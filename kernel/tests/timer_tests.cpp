@@ -172,6 +172,23 @@ static void timer_test_coalescing_early(void) {
         TIMER_SLACK_EARLY, slack, deadline, expected_adj, countof(deadline));
 }
 
+static void timer_test_coalescing_exact(void) {
+    zx_time_t when = current_time() + ZX_MSEC(1);
+    zx_duration_t off = ZX_USEC(10);
+    zx_duration_t slack = 3u * off;
+
+    const zx_time_t deadline[] = {
+        when,       // non-coalesced, adjustment = 0
+        when - off, // non-coalesced, adjustment = 0
+        when,       // coalesced with [0] rather than [1], adjustment = 0
+    };
+
+    const int64_t expected_adj[countof(deadline)] = {0, 0, 0};
+
+    timer_test_coalescing(
+        TIMER_SLACK_EARLY, slack, deadline, expected_adj, countof(deadline));
+}
+
 static void timer_far_deadline(void) {
     event_t event;
     timer_t timer;
@@ -190,10 +207,96 @@ static void timer_far_deadline(void) {
     event_destroy(&event);
 }
 
+struct timer_fire_stats {
+    int count;
+    zx_time_t first;
+    zx_time_t last;
+};
+
+static enum handler_return timer_cb_stats(struct timer* timer, zx_time_t now, void* arg) {
+    timer_fire_stats* stats = (timer_fire_stats*)arg;
+    zx_time_t t = current_time();
+    if (stats->first == 0)
+        stats->first = t;
+    stats->last = t;
+    atomic_add(&stats->count, 1);
+    return INT_NO_RESCHEDULE;
+}
+
+// Measures the cost of inserting, canceling and firing a large number of
+// timers queued on a single cpu.
+static void timer_test_many_timers(void) {
+    const int count = 100000;
+
+    timer_t* timer = (timer_t*)malloc(sizeof(timer_t) * count);
+    if (timer == NULL) {
+        printf("failed to allocate %d timers\n", count);
+        return;
+    }
+
+    printf("testing %d timers\n", count);
+
+    // Keep every timer on one queue so the fire stats are only touched by one cpu.
+    cpu_mask_t old_affinity = get_current_thread()->cpu_affinity;
+    thread_set_cpu_affinity(get_current_thread(), cpu_num_to_mask(arch_curr_cpu_num()));
+
+    timer_fire_stats stats = {};
+    uint32_t seed = 1;
+
+    // Insert with deadlines far enough out that none fires, then cancel them all.
+    zx_time_t base = current_time() + ZX_SEC(10);
+    zx_time_t start = current_time();
+    for (int ix = 0; ix != count; ++ix) {
+        seed = seed * 1664525 + 1013904223;
+        timer_init(&timer[ix]);
+        timer_set(&timer[ix], base + (seed % ZX_SEC(1)), TIMER_SLACK_CENTER, ZX_USEC(1),
+                  timer_cb_stats, &stats);
+    }
+    zx_duration_t insert = current_time() - start;
+
+    start = current_time();
+    for (int ix = 0; ix != count; ++ix) {
+        timer_cancel(&timer[ix]);
+    }
+    zx_duration_t cancel = current_time() - start;
+
+    // Queue them all again inside a short window and let them fire.
+    base = current_time() + ZX_MSEC(500);
+    for (int ix = 0; ix != count; ++ix) {
+        seed = seed * 1664525 + 1013904223;
+        timer_set(&timer[ix], base + (seed % ZX_MSEC(1)), TIMER_SLACK_CENTER, ZX_USEC(1),
+                  timer_cb_stats, &stats);
+    }
+    zx_time_t deadline = base + ZX_SEC(10);
+    while (atomic_load(&stats.count) != count) {
+        if (current_time() > deadline) {
+            printf("error: only %d of %d timers fired\n", atomic_load(&stats.count), count);
+            for (int ix = 0; ix != count; ++ix) {
+                timer_cancel(&timer[ix]);
+            }
+            thread_set_cpu_affinity(get_current_thread(), old_affinity);
+            free(timer);
+            return;
+        }
+        thread_sleep(current_time() + ZX_MSEC(5));
+    }
+    zx_duration_t fire = stats.last - stats.first;
+
+    thread_set_cpu_affinity(get_current_thread(), old_affinity);
+
+    printf("insert: %" PRIu64 " ns per timer\n", insert / count);
+    printf("cancel: %" PRIu64 " ns per timer\n", cancel / count);
+    printf("fire:   %" PRIu64 " ns per timer\n", fire / count);
+
+    free(timer);
+}
+
 void timer_tests(void) {
     timer_test_coalescing_center();
     timer_test_coalescing_late();
     timer_test_coalescing_early();
+    timer_test_coalescing_exact();
     timer_test_all_cpus();
     timer_far_deadline();
+    timer_test_many_timers();
 }
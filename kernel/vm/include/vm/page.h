@@ -39,6 +39,15 @@ typedef struct vm_page {
             // If true, one pin slot is used by the VmObject to keep a run
             // contiguous.
             bool contiguous_pin : 1;
+            // If true, the page was merged with identical pages and is shared
+            // read-only by |share_count| page lists. See vm/page_merge.h.
+            bool merged : 1;
+            // Set when the VmObject hands the page out; cleared by the aging
+            // pass of the compressed store. See vm/page_compression.h.
+            bool referenced : 1;
+            // aging passes the page has gone unreferenced for
+            uint8_t age;
+            uint32_t share_count;
         } object;
 
         uint8_t pad[24]; // pad out to 32 bytes
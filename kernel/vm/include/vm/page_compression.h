@@ -0,0 +1,67 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <fbl/intrusive_wavl_tree.h>
+#include <fbl/macros.h>
+#include <fbl/unique_ptr.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <zircon/types.h>
+
+// Compressed page store.
+//
+// When free memory runs low, a low priority thread ages the pages of VMOs
+// created with VmObjectPaged::kCompressible and replaces those that have not
+// been touched for a few passes with an LZ4 compressed copy, freeing the page.
+// The next lookup of that offset through VmObjectPaged::GetPageLocked
+// allocates a page and decompresses into it.
+//
+// Pages are aged with their |object.referenced| bit, set whenever the VMO
+// hands the page out. An aging pass clears the bit and unmaps the page, so
+// that the next access through a mapping faults and sets it again; pages it
+// finds still clear grow older until they are compressed.
+
+// The compressed contents of one page of a VMO.
+class CompressedPage final : public fbl::WAVLTreeContainable<fbl::unique_ptr<CompressedPage>> {
+public:
+    // Compresses the page at |data|. Returns null if the page doesn't compress
+    // to under three quarters of its size, or if the store is full.
+    static fbl::unique_ptr<CompressedPage> Create(uint64_t offset, const void* data);
+    ~CompressedPage();
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(CompressedPage);
+
+    // Writes the uncompressed contents to the page at |data|.
+    void Decompress(void* data) const;
+
+    uint64_t offset() const { return offset_; }
+    uint64_t GetKey() const { return offset_; }
+
+    // bytes held by the store for this page
+    size_t size() const { return size_; }
+
+private:
+    CompressedPage(uint64_t offset, size_t size, fbl::unique_ptr<uint8_t[]> data);
+
+    const uint64_t offset_;
+    // zero for a page of zeroes, which needs no data
+    const size_t size_;
+    const fbl::unique_ptr<uint8_t[]> data_;
+};
+
+// Whether kernel.vm.compression.enable turned the store on. VMOs only need
+// to be created compressible when it is.
+bool page_compression_enabled();
+
+// Runs one aging pass over up to |max_pages| pages of compressible VMOs,
+// compressing those seen unreferenced for at least |min_age| passes. Returns
+// the number of pages compressed.
+size_t page_compression_scan(size_t max_pages, uint min_age);
+
+// Bytes held by the compressed store.
+size_t page_compression_store_bytes();
@@ -0,0 +1,83 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vm/page.h>
+#include <zircon/compiler.h>
+
+// Same-page merging.
+//
+// A low priority thread hashes the committed pages of VMOs created with
+// VmObjectPaged::kMergeable, a bounded number per pass, and points VMOs
+// holding identical pages at a single copy. A merged page is never mapped
+// writable; the first write through any VMO sharing it goes through
+// VmObjectPaged::GetPageLocked, which gives that VMO a private copy again.
+//
+// A merged page stays in VM_PAGE_STATE_OBJECT with |object.merged| set, and
+// |object.share_count| counts the page lists holding it, plus any reference
+// the scanner holds while merging into it. The count is only raised by
+// someone holding the lock of a VMO that holds the page, so an owner that
+// sees a count of one under its lock knows the page is its alone.
+
+// A page the scanner found, and where.
+class VmObjectPaged;
+struct PageMergeCandidate {
+    uint64_t hash;
+    uint64_t offset;
+    VmObjectPaged* vmo;
+};
+
+// Hash of the PAGE_SIZE bytes at |data|.
+uint64_t page_merge_hash(const void* data);
+
+// Runs one scan pass over up to |max_pages| pages, returning the number of
+// pages merged. Used by the scanner thread and by tests.
+size_t page_merge_scan(size_t max_pages);
+
+// Returns true if |page| is a merged page.
+static inline bool page_is_merged(const vm_page_t* page) {
+    return page->state == VM_PAGE_STATE_OBJECT && page->object.merged;
+}
+
+// Turns |page|, held by a single page list, into a merged page.
+static inline void page_merge_mark(vm_page_t* page) {
+    DEBUG_ASSERT(page->state == VM_PAGE_STATE_OBJECT);
+    DEBUG_ASSERT(!page->object.merged);
+    page->object.share_count = 1;
+    page->object.merged = true;
+}
+
+// Takes a reference to merged |page| for another page list.
+static inline void page_merge_acquire(vm_page_t* page) {
+    DEBUG_ASSERT(page->object.merged);
+    __atomic_fetch_add(&page->object.share_count, 1, __ATOMIC_RELAXED);
+}
+
+// Drops a page list's reference to |page|. Returns true if the caller should
+// free the page, which is always the case for a page that was never merged.
+static inline bool page_merge_release(vm_page_t* page) {
+    if (!page_is_merged(page))
+        return true;
+    if (__atomic_fetch_sub(&page->object.share_count, 1, __ATOMIC_ACQ_REL) != 1)
+        return false;
+    page->object.merged = false;
+    return true;
+}
+
+// If the caller's page list holds the only reference to merged |page|, turns
+// it back into an ordinary page and returns true. Must be called with the
+// lock of the VMO holding the page.
+static inline bool page_merge_try_unshare(vm_page_t* page) {
+    DEBUG_ASSERT(page->object.merged);
+    if (__atomic_load_n(&page->object.share_count, __ATOMIC_ACQUIRE) != 1)
+        return false;
+    page->object.merged = false;
+    return true;
+}
@@ -19,6 +19,12 @@
 #define ROUNDUP_PAGE_SIZE(x) ROUNDUP((x), PAGE_SIZE)
 #define IS_PAGE_ALIGNED(x) IS_ALIGNED((x), PAGE_SIZE)
 
+// Large pages are mapped by a single entry one level up from PAGE_SIZE in the
+// page tables: 2MB with a 4K base page on both x86 and arm64.
+#define LARGE_PAGE_SIZE_SHIFT (PAGE_SIZE_SHIFT + (PAGE_SIZE_SHIFT - 3))
+#define LARGE_PAGE_SIZE (1UL << LARGE_PAGE_SIZE_SHIFT)
+#define IS_LARGE_PAGE_ALIGNED(x) IS_ALIGNED((x), LARGE_PAGE_SIZE)
+
 // kernel address space
 static_assert(KERNEL_ASPACE_BASE + (KERNEL_ASPACE_SIZE - 1) > KERNEL_ASPACE_BASE, "");
 
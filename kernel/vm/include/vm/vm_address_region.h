@@ -42,6 +42,14 @@
 // with execute permissions.  When on a VmMapping, controls whether or not the
 // mapping can gain this permission.
 #define VMAR_FLAG_CAN_MAP_EXECUTE (1 << 6)
+// When on a VmMapping, resolve page faults one page at a time rather than also
+// mapping neighboring pages the VMO already holds.
+#define VMAR_FLAG_NO_FAULT_AROUND (1 << 7)
+// When on a VmMapping, map large page aligned runs of the VMO with large pages
+// where the VMO holds them physically contiguous, and ask the VMO to commit
+// whole large pages on write faults.  When on a VmAddressRegion, VmMappings
+// and VmAddressRegions created inside it inherit the flag.
+#define VMAR_FLAG_LARGE_PAGES (1 << 8)
 
 #define VMAR_CAN_RWX_FLAGS (VMAR_FLAG_CAN_MAP_READ |  \
                             VMAR_FLAG_CAN_MAP_WRITE | \
@@ -249,6 +257,9 @@ protected:
     // Used to implement VmAspace::EnumerateChildren.
     // |aspace_->lock()| must be held.
     virtual bool EnumerateChildrenLocked(VmEnumerator* ve, uint depth);
+    // Recursively find the mapping that contains |va|, or nullptr if there is
+    // none.  |aspace_->lock()| must be held.
+    fbl::RefPtr<VmMapping> FindMappingLocked(vaddr_t va);
 
     friend class VmMapping;
     // Remove *region* from the subregion list
@@ -434,6 +445,14 @@ public:
     void Dump(uint depth, bool verbose) const override;
     zx_status_t PageFault(vaddr_t va, uint pf_flags) override;
 
+    // Returns ZX_OK if this mapping's permissions allow a fault with
+    // |pf_flags|, or ZX_ERR_ACCESS_DENIED.
+    zx_status_t CheckFaultPermissions(uint pf_flags) const;
+
+    // Returns true if the large page containing |va| lies entirely within this
+    // mapping and could be mapped with a single entry.
+    bool CanMapLargePage(vaddr_t va) const;
+
 protected:
     ~VmMapping() override;
     friend fbl::RefPtr<VmMapping>;
@@ -477,6 +496,14 @@ private:
     // in Clang around capability aliasing, we need to relax the analysis.
     void ActivateLocked();
 
+    // Map the pages around |va| that object_ already holds, after a fault at
+    // |va| has been resolved.  Called with object_->lock() held.
+    void FaultAroundLocked(vaddr_t va);
+
+    // Map the large page containing |va| with a single entry if object_ holds
+    // it as one contiguous run.  Called with object_->lock() held.
+    zx_status_t MapLargePageLocked(vaddr_t va, uint pf_flags);
+
     // pointer and region of the object we are mapping
     fbl::RefPtr<VmObject> object_;
     uint64_t object_offset_ = 0;
@@ -105,6 +105,10 @@ public:
         //
         // This number is strictly smaller than shared_pages * PAGE_SIZE.
         size_t scaled_shared_bytes;
+
+        // A count of pages covered by VmMapping ranges that are held
+        // compressed rather than committed.
+        size_t compressed_pages;
     };
 
     // Counts memory usage under the VmAspace.
@@ -55,6 +55,15 @@ public:
         return AllocatedPagesInRange(0, size());
     }
 
+    // Returns the number of pages of the object held compressed rather than
+    // allocated where (offset <= page_offset < offset+len).
+    virtual size_t CompressedPagesInRange(uint64_t offset, uint64_t len) const {
+        return 0;
+    }
+    size_t CompressedPages() const {
+        return CompressedPagesInRange(0, size());
+    }
+
     // find physical pages to back the range of the object
     virtual zx_status_t CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) {
         return ZX_ERR_NOT_SUPPORTED;
@@ -175,6 +184,22 @@ public:
         return ZX_ERR_NOT_SUPPORTED;
     }
 
+    // Fill |pa| with the physical addresses of the pages this object already
+    // holds at offsets [offset, offset + count * PAGE_SIZE), using 0 for any
+    // offset without one.  Nothing is faulted in, and pages that would come
+    // from a parent are not reported.  Returns the number of pages found.
+    virtual size_t GetResidentPagesLocked(uint64_t offset, size_t count, paddr_t* pa)
+        TA_REQ(lock_) {
+        return 0;
+    }
+
+    // If this object holds every page of the LARGE_PAGE_SIZE range at |offset|
+    // itself, as one physically contiguous and large page aligned run, return
+    // true and the base of that run in |pa|.  Nothing is faulted in.
+    virtual bool GetLargePageLocked(uint64_t offset, paddr_t* pa) TA_REQ(lock_) {
+        return false;
+    }
+
     fbl::Mutex* lock() TA_RET_CAP(lock_) { return &lock_; }
     fbl::Mutex& lock_ref() TA_RET_CAP(lock_) { return lock_; }
 
@@ -17,6 +17,8 @@
 #include <lib/user_copy/user_ptr.h>
 #include <list.h>
 #include <stdint.h>
+#include <vm/page_compression.h>
+#include <vm/page_merge.h>
 #include <vm/pmm.h>
 #include <vm/vm.h>
 #include <vm/vm_object.h>
@@ -27,7 +29,19 @@
 // the main VM object type, holding a list of pages
 class VmObjectPaged final : public VmObject {
 public:
-    static zx_status_t Create(uint32_t pmm_alloc_flags, uint64_t size, fbl::RefPtr<VmObject>* vmo);
+    // |options| is a bitmask of:
+    // kMergeable: identical pages may be merged into one shared read-only
+    // copy by the background scanner; see vm/page_merge.h.
+    // kCompressible: pages that go unused may be compressed when memory runs
+    // low; see vm/page_compression.h.
+    static constexpr uint32_t kMergeable = (1u << 0);
+    static constexpr uint32_t kCompressible = (1u << 1);
+
+    static zx_status_t Create(uint32_t pmm_alloc_flags, uint32_t options, uint64_t size,
+                              fbl::RefPtr<VmObject>* vmo);
+    static zx_status_t Create(uint32_t pmm_alloc_flags, uint64_t size, fbl::RefPtr<VmObject>* vmo) {
+        return Create(pmm_alloc_flags, 0u, size, vmo);
+    }
 
     static zx_status_t CreateFromROData(const void* data, size_t size, fbl::RefPtr<VmObject>* vmo);
 
@@ -40,6 +54,7 @@ public:
     bool is_paged() const override { return true; }
 
     size_t AllocatedPagesInRange(uint64_t offset, uint64_t len) const override;
+    size_t CompressedPagesInRange(uint64_t offset, uint64_t len) const override;
 
     zx_status_t CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) override;
     zx_status_t CommitRangeContiguous(uint64_t offset, uint64_t len, uint64_t* committed,
@@ -69,6 +84,10 @@ public:
     zx_status_t CleanInvalidateCache(const uint64_t offset, const uint64_t len) override;
     zx_status_t SyncCache(const uint64_t offset, const uint64_t len) override;
 
+    size_t GetResidentPagesLocked(uint64_t offset, size_t count, paddr_t* pa) override
+        TA_REQ(lock_);
+    bool GetLargePageLocked(uint64_t offset, paddr_t* pa) override TA_REQ(lock_);
+
     zx_status_t GetPageLocked(uint64_t offset, uint pf_flags, list_node* free_list,
                               vm_page_t**, paddr_t*) override
         // Calls a Locked method of the parent, which confuses analysis.
@@ -83,9 +102,47 @@ public:
         // Called under the parent's lock, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
 
+    // Returns the VMO created with |option| after |prev| in creation order,
+    // or the first one if |prev| is null. |prev| must be kept alive by the
+    // caller. Used by the background scanners to walk the VMOs they apply to.
+    static fbl::RefPtr<VmObjectPaged> NextWithOption(const VmObjectPaged* prev, uint32_t option);
+
+    // Returns the first VMO created with |option| whose option_seq() is at
+    // least |seq|, or null if there is none. Lets a scanner remember its
+    // place between passes without keeping a VMO alive.
+    static fbl::RefPtr<VmObjectPaged> FindWithOption(uint64_t seq, uint32_t option);
+
+    // Our place in creation order among the VMOs created with any options,
+    // counting from 1; 0 if we were created without options.
+    uint64_t option_seq() const { return option_seq_; }
+
+    // Same-page merging, used by the scanner in page_merge.cpp.
+
+    // Hashes up to |max| unpinned pages at or after |offset| into |out|,
+    // returning how many it filled in. |*next| is the offset to continue
+    // from, or UINT64_MAX once the end of the VMO was reached.
+    size_t HashPagesForMerge(uint64_t offset, size_t max, PageMergeCandidate* out,
+                             uint64_t* next);
+
+    // Marks the page at |offset| merged if it isn't already and returns it
+    // with a reference held for the caller, who must drop it with
+    // page_merge_release(). Returns null if there is no unpinned page there.
+    vm_page_t* AcquirePageForMerge(uint64_t offset);
+
+    // Replaces the page at |offset| with |shared| if their contents match.
+    zx_status_t MergePage(uint64_t offset, vm_page_t* shared);
+
+    // Compressed page store, used by the aging thread in page_compression.cpp.
+
+    // Ages up to |max| pages at or after |offset| and returns how many it
+    // aged, compressing those found unreferenced by at least |min_age| passes
+    // and counting them in |*compressed|. |*next| is as for HashPagesForMerge.
+    size_t CompressColdPages(uint64_t offset, size_t max, uint min_age, uint64_t* next,
+                             size_t* compressed);
+
 private:
     // private constructor (use Create())
-    explicit VmObjectPaged(uint32_t pmm_alloc_flags, fbl::RefPtr<VmObject> parent);
+    VmObjectPaged(uint32_t pmm_alloc_flags, uint32_t options, fbl::RefPtr<VmObject> parent);
 
     // private destructor, only called from refptr
     ~VmObjectPaged() override;
@@ -107,9 +164,26 @@ private:
     // internal page list routine
     void AddPageToArray(size_t index, vm_page_t* p);
 
+    // back the empty large page containing |offset| with one contiguous run
+    // of zeroed pages, returning the page at |offset|
+    zx_status_t CommitLargePageLocked(uint64_t offset, vm_page_t** page_out, paddr_t* pa_out)
+        TA_REQ(lock_);
+
     zx_status_t PinLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
     void UnpinLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
 
+    // give this VMO its own writable copy of the merged page at |offset|
+    zx_status_t UnmergePageLocked(uint64_t offset, vm_page_t** page_out) TA_REQ(lock_);
+    zx_status_t UnmergeRangeLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
+
+    // bring back the compressed page at |offset|, taking the page from
+    // |free_list| if it has one
+    zx_status_t DecompressPageLocked(uint64_t offset, list_node* free_list, vm_page_t** page_out)
+        TA_REQ(lock_);
+    zx_status_t DecompressRangeLocked(uint64_t offset, uint64_t len) TA_REQ(lock_);
+    // throw away the compressed pages in [start, end), returning how many
+    size_t DropCompressedLocked(uint64_t start, uint64_t end) TA_REQ(lock_);
+
     // internal check if any pages in a range are pinned
     bool AnyPagesPinnedLocked(uint64_t offset, size_t len) TA_REQ(lock_);
 
@@ -121,14 +195,58 @@ private:
     // set our offset within our parent
     zx_status_t SetParentOffsetLocked(uint64_t o) TA_REQ(lock_);
 
+    // if nothing but us refers to our parent, take over the pages of it that
+    // we can see and, if it has a parent of its own, unlink it from the chain
+    void CollapseParentLocked()
+        // Touches the parent's state under the lock shared with it, which
+        // confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    // count the pages we see through our parent chain rather than hold ourself
+    size_t SharedPagesLocked()
+        // Walks the parents under the shared lock, which confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
     // maximum size of a VMO is one page less than the full 64bit range
     static const uint64_t MAX_SIZE = ROUNDDOWN(UINT64_MAX, PAGE_SIZE);
 
     // members
     uint64_t size_ TA_GUARDED(lock_) = 0;
     uint64_t parent_offset_ TA_GUARDED(lock_) = 0;
+    // offsets at or above this are never looked up in the parent; set when a
+    // collapse narrows what we can see of the chain above us
+    uint64_t parent_limit_ TA_GUARDED(lock_) = UINT64_MAX;
+    // set when we could not be folded into our child because of pinned pages
+    // or a failed allocation, so lookups in the child stop retrying; cleared
+    // when pages are unpinned
+    bool collapse_blocked_ TA_GUARDED(lock_) = false;
     uint32_t pmm_alloc_flags_ TA_GUARDED(lock_) = PMM_ALLOC_FLAG_ANY;
 
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // pages we hold compressed rather than in page_list_
+    fbl::WAVLTree<uint64_t, fbl::unique_ptr<CompressedPage>> compressed_pages_ TA_GUARDED(lock_);
+    size_t compressed_count_ TA_GUARDED(lock_) = 0;
+
+    // the options we were created with; clones inherit them
+    const uint32_t options_;
+
+    // set once, under option_list_lock_, when we join the option list
+    uint64_t option_seq_ = 0;
+
+    // Per-node state for the list of VMOs created with any options.
+    using OptionNodeState = fbl::DoublyLinkedListNodeState<VmObjectPaged*>;
+    OptionNodeState option_list_state_;
+
+    // The list of VMOs created with any options, oldest first.
+    struct OptionListTraits {
+        static OptionNodeState& node_state(VmObjectPaged& vmo) {
+            return vmo.option_list_state_;
+        }
+    };
+    using OptionList = fbl::DoublyLinkedList<VmObjectPaged*, OptionListTraits>;
+    static fbl::Mutex option_list_lock_;
+    static OptionList option_list_ TA_GUARDED(option_list_lock_);
+    static uint64_t option_seq_next_ TA_GUARDED(option_list_lock_);
 };
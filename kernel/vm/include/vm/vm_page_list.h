@@ -190,6 +190,9 @@ public:
     zx_status_t AddPage(vm_page*, uint64_t offset);
     vm_page* GetPage(uint64_t offset);
     zx_status_t FreePage(uint64_t offset);
+    // puts |p| in place of the page at |offset|, returning the old page, or
+    // returns nullptr and leaves the list alone if there is none
+    vm_page* ReplacePage(uint64_t offset, vm_page* p);
     size_t FreeAllPages();
 
 private:
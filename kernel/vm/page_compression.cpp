@@ -0,0 +1,218 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <vm/page_compression.h>
+
+#include "vm_priv.h"
+
+#include <arch/ops.h>
+#include <assert.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/auto_lock.h>
+#include <fbl/mutex.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/thread.h>
+#include <lib/counters.h>
+#include <lk/init.h>
+#include <lz4/lz4.h>
+#include <string.h>
+#include <trace.h>
+#include <vm/pmm.h>
+#include <vm/vm.h>
+#include <vm/vm_object_paged.h>
+#include <zircon/types.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+KCOUNTER(vm_compression_aged, "kernel.vm.compression.aged");
+KCOUNTER(vm_compression_compressed, "kernel.vm.compression.compressed");
+KCOUNTER(vm_compression_decompressed, "kernel.vm.compression.decompressed");
+KCOUNTER(vm_compression_rejected, "kernel.vm.compression.rejected");
+
+namespace {
+
+// Be sure to update kernel_cmdline.md if any of these defaults change.
+constexpr uint64_t kDefaultWatermarkMb = 150;
+constexpr uint64_t kDefaultStoreMb = 256;
+
+constexpr size_t kPagesPerPass = 1024;
+constexpr zx_duration_t kPassInterval = ZX_MSEC(500);
+// passes a page has to go unreferenced for before it is compressed
+constexpr uint kColdAge = 3;
+
+// a page has to shrink to this to be worth keeping compressed
+constexpr size_t kMaxCompressedSize = PAGE_SIZE * 3 / 4;
+
+// The compressor's state, too large for a kernel stack, and somewhere to put
+// its output before we know how large it is.
+fbl::Mutex compress_lock;
+LZ4_stream_t compress_state TA_GUARDED(compress_lock);
+char compress_buffer[kMaxCompressedSize] TA_GUARDED(compress_lock);
+
+// bytes of compressed data held, and the most we will hold
+size_t store_bytes;
+size_t store_limit = kDefaultStoreMb * MB;
+
+// set once at init, before any user VMO exists
+bool enabled;
+
+// Serializes passes, which share the cursor below. As in the page merge
+// scanner, the VMO is remembered by its option_seq() so that the cursor
+// doesn't keep it alive; 0 starts from the top.
+fbl::Mutex scan_lock;
+uint64_t cursor_seq TA_GUARDED(scan_lock);
+uint64_t cursor_offset TA_GUARDED(scan_lock);
+
+bool is_zero_page(const void* data) {
+    const uint64_t* words = static_cast<const uint64_t*>(data);
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (words[i])
+            return false;
+    }
+    return true;
+}
+
+int page_compression_thread(void* arg) {
+    const size_t watermark = reinterpret_cast<uintptr_t>(arg);
+
+    for (;;) {
+        // only spend time on this when memory is actually short
+        if (pmm_count_free_pages() * PAGE_SIZE < watermark)
+            page_compression_scan(kPagesPerPass, kColdAge);
+        thread_sleep_relative(kPassInterval);
+    }
+    return 0;
+}
+
+void page_compression_init(uint level) {
+    if (!cmdline_get_bool("kernel.vm.compression.enable", false))
+        return;
+    enabled = true;
+
+    store_limit = cmdline_get_uint64("kernel.vm.compression.store-mb", kDefaultStoreMb) * MB;
+    const size_t watermark =
+        cmdline_get_uint64("kernel.vm.compression.watermark-mb", kDefaultWatermarkMb) * MB;
+
+    thread_t* t = thread_create("page compression", page_compression_thread,
+                                reinterpret_cast<void*>(static_cast<uintptr_t>(watermark)),
+                                LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (t)
+        thread_detach_and_resume(t);
+}
+
+} // namespace
+
+LK_INIT_HOOK(page_compression, &page_compression_init, LK_INIT_LEVEL_THREADING);
+
+CompressedPage::CompressedPage(uint64_t offset, size_t size, fbl::unique_ptr<uint8_t[]> data)
+    : offset_(offset), size_(size), data_(fbl::move(data)) {}
+
+CompressedPage::~CompressedPage() {
+    __atomic_fetch_sub(&store_bytes, size_, __ATOMIC_RELAXED);
+}
+
+fbl::unique_ptr<CompressedPage> CompressedPage::Create(uint64_t offset, const void* data) {
+    fbl::AllocChecker ac;
+    size_t size = 0;
+    fbl::unique_ptr<uint8_t[]> buffer;
+
+    if (!is_zero_page(data)) {
+        fbl::AutoLock a(&compress_lock);
+        int ret = LZ4_compress_fast_extState(&compress_state, static_cast<const char*>(data),
+                                             compress_buffer, PAGE_SIZE,
+                                             static_cast<int>(kMaxCompressedSize), 1);
+        if (ret <= 0) {
+            kcounter_add(vm_compression_rejected, 1);
+            return nullptr;
+        }
+        size = ret;
+        buffer.reset(new (&ac) uint8_t[size]);
+        if (!ac.check())
+            return nullptr;
+        memcpy(buffer.get(), compress_buffer, size);
+    }
+
+    // hold the store to its limit
+    if (__atomic_add_fetch(&store_bytes, size, __ATOMIC_RELAXED) > store_limit) {
+        __atomic_fetch_sub(&store_bytes, size, __ATOMIC_RELAXED);
+        kcounter_add(vm_compression_rejected, 1);
+        return nullptr;
+    }
+
+    fbl::unique_ptr<CompressedPage> page(new (&ac) CompressedPage(offset, size,
+                                                                  fbl::move(buffer)));
+    if (!ac.check()) {
+        __atomic_fetch_sub(&store_bytes, size, __ATOMIC_RELAXED);
+        return nullptr;
+    }
+    kcounter_add(vm_compression_compressed, 1);
+    return page;
+}
+
+void CompressedPage::Decompress(void* data) const {
+    kcounter_add(vm_compression_decompressed, 1);
+
+    if (size_ == 0) {
+        arch_zero_page(data);
+        return;
+    }
+    __UNUSED int ret = LZ4_decompress_safe(reinterpret_cast<const char*>(data_.get()),
+                                           static_cast<char*>(data), static_cast<int>(size_),
+                                           PAGE_SIZE);
+    DEBUG_ASSERT(ret == PAGE_SIZE);
+}
+
+bool page_compression_enabled() {
+    return enabled;
+}
+
+size_t page_compression_store_bytes() {
+    return __atomic_load_n(&store_bytes, __ATOMIC_RELAXED);
+}
+
+size_t page_compression_scan(size_t max_pages, uint min_age) {
+    fbl::AutoLock a(&scan_lock);
+
+    // Age up to |max_pages| pages, visiting at most as many VMOs so a system
+    // full of empty ones doesn't hold the thread up.
+    size_t aged = 0;
+    size_t compressed = 0;
+    fbl::RefPtr<VmObjectPaged> vmo =
+        VmObjectPaged::FindWithOption(cursor_seq, VmObjectPaged::kCompressible);
+    if (vmo && vmo->option_seq() != cursor_seq)
+        cursor_offset = 0;
+    for (size_t steps = 0; aged < max_pages && steps < max_pages; steps++) {
+        if (!vmo) {
+            vmo = VmObjectPaged::NextWithOption(nullptr, VmObjectPaged::kCompressible);
+            cursor_offset = 0;
+            if (!vmo)
+                break;
+        }
+
+        uint64_t next;
+        size_t count;
+        aged += vmo->CompressColdPages(cursor_offset, max_pages - aged, min_age, &next, &count);
+        compressed += count;
+
+        if (next != UINT64_MAX) {
+            cursor_offset = next;
+        } else {
+            // Move on, ending the pass at the end of the list so the next one
+            // starts from the top.
+            vmo = VmObjectPaged::NextWithOption(vmo.get(), VmObjectPaged::kCompressible);
+            cursor_offset = 0;
+            if (!vmo)
+                break;
+        }
+    }
+    cursor_seq = vmo ? vmo->option_seq() : 0;
+    kcounter_add(vm_compression_aged, aged);
+
+    LTRACEF("aged %zu pages, compressed %zu, store %zu bytes\n",
+            aged, compressed, page_compression_store_bytes());
+    return compressed;
+}
@@ -0,0 +1,187 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <vm/page_merge.h>
+
+#include "vm_priv.h"
+
+#include <assert.h>
+#include <fbl/alloc_checker.h>
+#include <fbl/auto_lock.h>
+#include <fbl/mutex.h>
+#include <fbl/unique_ptr.h>
+#include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/thread.h>
+#include <lib/counters.h>
+#include <lk/init.h>
+#include <stdlib.h>
+#include <trace.h>
+#include <vm/pmm.h>
+#include <vm/vm.h>
+#include <vm/vm_object_paged.h>
+#include <zircon/types.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+KCOUNTER(vm_page_merge_scanned, "kernel.vm.page_merge.scanned");
+
+namespace {
+
+constexpr uint64_t kDefaultPagesPerPass = 256;
+constexpr uint64_t kDefaultIntervalMs = 100;
+
+// Serializes scan passes, which share the cursor below.
+fbl::Mutex scan_lock;
+
+// Where the next pass picks up: a VMO and an offset within it. A pass walks
+// the mergeable VMOs in creation order and wraps around at the end. The VMO
+// is remembered by its option_seq() rather than a reference, so one closed
+// while the scanner sleeps is freed; the next pass then starts on the VMO
+// after it. 0 starts from the top.
+uint64_t cursor_seq TA_GUARDED(scan_lock);
+uint64_t cursor_offset TA_GUARDED(scan_lock);
+
+int compare_candidates(const void* a, const void* b) {
+    auto ca = static_cast<const PageMergeCandidate*>(a);
+    auto cb = static_cast<const PageMergeCandidate*>(b);
+    if (ca->hash != cb->hash)
+        return ca->hash < cb->hash ? -1 : 1;
+    return 0;
+}
+
+// Merges the pages in |group|, which all hashed the same, into the first one
+// that can still be had. Returns the number of pages merged.
+size_t merge_group(const PageMergeCandidate* group, size_t count) {
+    size_t i = 0;
+    vm_page_t* shared = nullptr;
+    for (; i < count && !shared; i++)
+        shared = group[i].vmo->AcquirePageForMerge(group[i].offset);
+    if (!shared)
+        return 0;
+
+    // the rest of the group follows the page we kept
+    size_t merged = 0;
+    for (; i < count; i++) {
+        if (group[i].vmo->MergePage(group[i].offset, shared) == ZX_OK)
+            merged++;
+    }
+
+    if (page_merge_release(shared))
+        pmm_free_page(shared);
+    return merged;
+}
+
+int page_merge_thread(void* arg) {
+    const size_t pages_per_pass = reinterpret_cast<uintptr_t>(arg);
+    const zx_duration_t interval =
+        ZX_MSEC(cmdline_get_uint64("kernel.vm.page-merge-interval-ms", kDefaultIntervalMs));
+
+    for (;;) {
+        page_merge_scan(pages_per_pass);
+        thread_sleep_relative(interval);
+    }
+    return 0;
+}
+
+void page_merge_init(uint level) {
+    const uint64_t pages_per_pass =
+        cmdline_get_uint64("kernel.vm.page-merge-pages-per-pass", kDefaultPagesPerPass);
+    if (pages_per_pass == 0)
+        return;
+
+    thread_t* t = thread_create("page merge", page_merge_thread,
+                                reinterpret_cast<void*>(static_cast<uintptr_t>(pages_per_pass)),
+                                LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (t)
+        thread_detach_and_resume(t);
+}
+
+} // namespace
+
+LK_INIT_HOOK(page_merge, &page_merge_init, LK_INIT_LEVEL_THREADING);
+
+uint64_t page_merge_hash(const void* data) {
+    // FNV-1a over 64-bit words; good enough to sort likely duplicates next to
+    // each other, and every match is checked with a full compare.
+    const uint64_t* words = static_cast<const uint64_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        hash ^= words[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+size_t page_merge_scan(size_t max_pages) {
+    if (max_pages == 0)
+        return 0;
+
+    fbl::AllocChecker ac;
+    fbl::unique_ptr<PageMergeCandidate[]> candidates(new (&ac) PageMergeCandidate[max_pages]);
+    if (!ac.check())
+        return 0;
+    // the candidates point at these, which keep their VMOs alive for the pass
+    fbl::unique_ptr<fbl::RefPtr<VmObjectPaged>[]> vmos(
+        new (&ac) fbl::RefPtr<VmObjectPaged>[max_pages]);
+    if (!ac.check())
+        return 0;
+
+    fbl::AutoLock a(&scan_lock);
+
+    // Collect up to |max_pages| pages, visiting at most as many VMOs so a
+    // system full of empty ones doesn't hold the scanner up.
+    size_t count = 0;
+    size_t vmo_count = 0;
+    fbl::RefPtr<VmObjectPaged> vmo =
+        VmObjectPaged::FindWithOption(cursor_seq, VmObjectPaged::kMergeable);
+    if (vmo && vmo->option_seq() != cursor_seq)
+        cursor_offset = 0;
+    for (size_t steps = 0; count < max_pages && steps < max_pages; steps++) {
+        if (!vmo) {
+            vmo = VmObjectPaged::NextWithOption(nullptr, VmObjectPaged::kMergeable);
+            cursor_offset = 0;
+            if (!vmo)
+                break;
+        }
+
+        uint64_t next;
+        size_t found = vmo->HashPagesForMerge(cursor_offset, max_pages - count,
+                                              &candidates[count], &next);
+        if (found > 0) {
+            count += found;
+            vmos[vmo_count++] = vmo;
+        }
+
+        if (next != UINT64_MAX) {
+            cursor_offset = next;
+        } else {
+            // Move on, ending the pass at the end of the list so the next one
+            // starts from the top.
+            vmo = VmObjectPaged::NextWithOption(vmo.get(), VmObjectPaged::kMergeable);
+            cursor_offset = 0;
+            if (!vmo)
+                break;
+        }
+    }
+    cursor_seq = vmo ? vmo->option_seq() : 0;
+    kcounter_add(vm_page_merge_scanned, count);
+
+    qsort(candidates.get(), count, sizeof(PageMergeCandidate), compare_candidates);
+
+    size_t merged = 0;
+    for (size_t i = 0; i < count;) {
+        size_t j = i + 1;
+        while (j < count && candidates[j].hash == candidates[i].hash)
+            j++;
+        if (j - i > 1)
+            merged += merge_group(&candidates[i], j - i);
+        i = j;
+    }
+
+    LTRACEF("scanned %zu pages in %zu vmos, merged %zu\n", count, vmo_count, merged);
+    return merged;
+}
@@ -10,9 +10,14 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <lk/init.h>
 #include <platform.h>
 #include <pow2.h>
@@ -42,6 +47,61 @@ static fbl::Mutex arena_lock;
 static fbl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Per-cpu caches of free pages from KMAP arenas. Single page allocations and frees are
+// normally satisfied by the current cpu's cache under a cpu local spinlock, and only go
+// to the arenas (and arena_lock) to refill or drain a batch of pages at a time.
+// Cached pages stay in the ALLOC state as far as the arenas are concerned.
+namespace {
+
+// number of pages moved between a cache and the arenas at once
+constexpr size_t kPageCacheBatch = 32;
+// most pages a cache holds; freeing into a full cache returns a batch to the arenas
+constexpr size_t kPageCacheMax = 4 * kPageCacheBatch;
+
+struct PageCache {
+    SpinLock lock;
+    list_node pages TA_GUARDED(lock);
+    // only written with the lock held, read racily to report free memory
+    size_t count TA_GUARDED(lock);
+} __CPU_ALIGN;
+
+PageCache page_cache[SMP_MAX_CPUS];
+bool page_cache_enabled;
+
+} // namespace
+
+static void pmm_page_cache_init(uint level) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (auto& cache : page_cache) {
+        list_initialize(&cache.pages);
+        cache.count = 0;
+    }
+    page_cache_enabled = true;
+}
+LK_INIT_HOOK(pmm_page_cache, &pmm_page_cache_init, LK_INIT_LEVEL_VM);
+
+// Pool of pages cleared ahead of time by a low priority thread, used to satisfy
+// PMM_ALLOC_FLAG_ZEROED allocations without zeroing on the allocating thread.
+// The thread tops the pool back up to the high watermark whenever an allocation
+// leaves it below the low watermark.
+namespace {
+
+constexpr size_t kZeroPoolDefaultPages = 2048;
+
+SpinLock zero_pool_lock;
+list_node zero_pool TA_GUARDED(zero_pool_lock) = LIST_INITIAL_VALUE(zero_pool);
+size_t zero_pool_count TA_GUARDED(zero_pool_lock);
+
+// zero if the pool is disabled
+size_t zero_pool_high_watermark;
+size_t zero_pool_low_watermark;
+
+event_t zero_pool_event = EVENT_INITIAL_VALUE(zero_pool_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+} // namespace
+
+KCOUNTER(zero_pool_hit_count, "kernel.pmm.zero_pool.hit");
+KCOUNTER(zero_pool_miss_count, "kernel.pmm.zero_pool.miss");
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -75,6 +135,16 @@ vm_page_t* paddr_to_vm_page(paddr_t addr) TA_NO_THREAD_SAFETY_ANALYSIS {
     return nullptr;
 }
 
+// Like vm_page_to_paddr, the arena list is stable after boot so no lock is needed.
+static bool page_is_cacheable(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (const auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page)) {
+            return (a.flags() & PMM_ARENA_FLAG_KMAP) != 0;
+        }
+    }
+    return false;
+}
+
 // We disable thread safety analysis here, since this function is only called
 // during early boot before threading exists.
 zx_status_t pmm_add_arena(const pmm_arena_info_t* info) TA_NO_THREAD_SAFETY_ANALYSIS {
@@ -113,9 +183,7 @@ done_add:
     return ZX_OK;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
-    AutoLock al(&arena_lock);
-
+static vm_page_t* pmm_alloc_page_locked(uint alloc_flags, paddr_t* pa) TA_REQ(arena_lock) {
     /* walk the arenas in order until we find one with a free page */
     for (auto& a : arena_list) {
         /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
@@ -130,21 +198,11 @@ vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
             return page;
     }
 
-    LTRACEF("failed to allocate page\n");
     return nullptr;
 }
 
-size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
-    LTRACEF("count %zu\n", count);
-
-    /* list must be initialized prior to calling this */
-    DEBUG_ASSERT(list);
-
-    if (count == 0)
-        return 0;
-
-    AutoLock al(&arena_lock);
-
+static size_t pmm_alloc_pages_locked(size_t count, uint alloc_flags, struct list_node* list)
+    TA_REQ(arena_lock) {
     /* walk the arenas in order, allocating as many pages as we can from each */
     size_t allocated = 0;
     for (auto& a : arena_list) {
@@ -166,6 +224,293 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     return allocated;
 }
 
+static size_t pmm_free_locked(struct list_node* list) TA_REQ(arena_lock) {
+    uint count = 0;
+    while (!list_is_empty(list)) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+
+        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+
+        /* see which arena this page belongs to and add it */
+        for (auto& a : arena_list) {
+            if (a.FreePage(page) >= 0) {
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// Take a page out of the zeroed pool, waking the zeroing thread if that leaves the pool
+// below its low watermark. Returns nullptr if the pool is empty.
+static vm_page_t* zero_pool_take() {
+    if (zero_pool_high_watermark == 0)
+        return nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    zero_pool_lock.Acquire();
+    vm_page_t* page = list_remove_head_type(&zero_pool, vm_page_t, free.node);
+    if (page)
+        zero_pool_count--;
+    bool low = zero_pool_count < zero_pool_low_watermark;
+    zero_pool_lock.Release();
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (low && !event_signaled(&zero_pool_event))
+        event_signal(&zero_pool_event, false);
+
+    return page;
+}
+
+static size_t zero_pool_count_pages() TA_NO_THREAD_SAFETY_ANALYSIS {
+    return __atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED);
+}
+
+// Return every page in the zeroed pool to the arenas.
+static void zero_pool_drain() TA_EXCL(arena_lock) {
+    list_node drain = LIST_INITIAL_VALUE(drain);
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    zero_pool_lock.Acquire();
+    list_move(&zero_pool, &drain);
+    zero_pool_count = 0;
+    zero_pool_lock.Release();
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (!list_is_empty(&drain)) {
+        AutoLock al(&arena_lock);
+        pmm_free_locked(&drain);
+    }
+}
+
+static int zero_pool_thread(void*) {
+    for (;;) {
+        event_wait(&zero_pool_event);
+
+        while (zero_pool_count_pages() < zero_pool_high_watermark) {
+            paddr_t pa;
+            vm_page_t* page = pmm_alloc_page(PMM_ALLOC_FLAG_KMAP, &pa);
+            if (!page)
+                break;
+
+            arch_zero_page(paddr_to_physmap(pa));
+
+            spin_lock_saved_state_t state;
+            arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+            zero_pool_lock.Acquire();
+            list_add_tail(&zero_pool, &page->free.node);
+            zero_pool_count++;
+            zero_pool_lock.Release();
+            arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+        }
+    }
+    return 0;
+}
+
+static void zero_pool_init(uint level) {
+    zero_pool_high_watermark = cmdline_get_uint64("kernel.pmm.zero-pool-pages", kZeroPoolDefaultPages);
+    if (zero_pool_high_watermark == 0)
+        return;
+    zero_pool_low_watermark = zero_pool_high_watermark / 4;
+
+    thread_t* t = thread_create("pmm zero pool", zero_pool_thread, nullptr,
+                                LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t) {
+        zero_pool_high_watermark = 0;
+        return;
+    }
+    thread_detach_and_resume(t);
+
+    // fill the pool for the first time
+    event_signal(&zero_pool_event, false);
+}
+LK_INIT_HOOK(pmm_zero_pool, &zero_pool_init, LK_INIT_LEVEL_THREADING);
+
+// Take up to |count| pages out of the current cpu's cache, adding them to the tail of |list|.
+static size_t page_cache_take(size_t count, struct list_node* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PageCache& cache = page_cache[arch_curr_cpu_num()];
+
+    size_t taken = 0;
+    cache.lock.Acquire();
+    while (taken < count) {
+        vm_page_t* page = list_remove_head_type(&cache.pages, vm_page_t, free.node);
+        if (!page)
+            break;
+        list_add_tail(list, &page->free.node);
+        taken++;
+    }
+    cache.count -= taken;
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return taken;
+}
+
+// Move the pages on |list| into the current cpu's cache. Whatever does not fit, plus a
+// batch of the cache's coldest pages to leave room for later frees, goes back to the arenas.
+static void page_cache_put(struct list_node* list) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PageCache& cache = page_cache[arch_curr_cpu_num()];
+
+    cache.lock.Acquire();
+    while (cache.count < kPageCacheMax) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+        if (!page)
+            break;
+        list_add_head(&cache.pages, &page->free.node);
+        cache.count++;
+    }
+    if (!list_is_empty(list)) {
+        for (size_t i = 0; i < kPageCacheBatch; i++) {
+            vm_page_t* page = list_remove_tail_type(&cache.pages, vm_page_t, free.node);
+            list_add_tail(list, &page->free.node);
+        }
+        cache.count -= kPageCacheBatch;
+    }
+    cache.lock.Release();
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (!list_is_empty(list)) {
+        AutoLock al(&arena_lock);
+        pmm_free_locked(list);
+    }
+}
+
+// Move every cached page on every cpu, and the zeroed pool, back to the arenas so that
+// allocations needing specific or contiguous pages can see them.
+static void page_cache_drain_all() TA_EXCL(arena_lock) {
+    zero_pool_drain();
+
+    if (!page_cache_enabled)
+        return;
+
+    for (auto& cache : page_cache) {
+        list_node drain = LIST_INITIAL_VALUE(drain);
+
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        cache.lock.Acquire();
+        list_move(&cache.pages, &drain);
+        cache.count = 0;
+        cache.lock.Release();
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+        if (!list_is_empty(&drain)) {
+            AutoLock al(&arena_lock);
+            pmm_free_locked(&drain);
+        }
+    }
+}
+
+static vm_page_t* pmm_alloc_page_internal(uint alloc_flags, paddr_t* pa) {
+    if (likely(page_cache_enabled)) {
+        list_node list = LIST_INITIAL_VALUE(list);
+        vm_page_t* page = nullptr;
+
+        if (page_cache_take(1, &list) == 0) {
+            // the local cache is empty, refill it with a batch from the arenas
+            size_t count;
+            {
+                AutoLock al(&arena_lock);
+                count = pmm_alloc_pages_locked(kPageCacheBatch, PMM_ALLOC_FLAG_KMAP, &list);
+            }
+            if (count > 1) {
+                page = list_remove_head_type(&list, vm_page_t, free.node);
+                page_cache_put(&list);
+            }
+        }
+        if (!page)
+            page = list_remove_head_type(&list, vm_page_t, free.node);
+
+        if (page) {
+            DEBUG_ASSERT(page->state == VM_PAGE_STATE_ALLOC);
+            if (pa)
+                *pa = vm_page_to_paddr(page);
+            return page;
+        }
+    }
+
+    vm_page_t* page;
+    {
+        AutoLock al(&arena_lock);
+        page = pmm_alloc_page_locked(alloc_flags, pa);
+    }
+    if (page)
+        return page;
+
+    // the arenas are empty, pull back whatever the other cpus have cached and try again
+    page_cache_drain_all();
+
+    AutoLock al(&arena_lock);
+    page = pmm_alloc_page_locked(alloc_flags, pa);
+    if (!page)
+        LTRACEF("failed to allocate page\n");
+    return page;
+}
+
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    if (!(alloc_flags & PMM_ALLOC_FLAG_ZEROED))
+        return pmm_alloc_page_internal(alloc_flags, pa);
+
+    vm_page_t* page = zero_pool_take();
+    if (page) {
+        kcounter_add(zero_pool_hit_count, 1);
+        if (pa)
+            *pa = vm_page_to_paddr(page);
+        return page;
+    }
+
+    kcounter_add(zero_pool_miss_count, 1);
+
+    paddr_t page_pa;
+    page = pmm_alloc_page_internal(alloc_flags, &page_pa);
+    if (!page)
+        return nullptr;
+
+    arch_zero_page(paddr_to_physmap(page_pa));
+    if (pa)
+        *pa = page_pa;
+    return page;
+}
+
+size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
+    LTRACEF("count %zu\n", count);
+
+    /* list must be initialized prior to calling this */
+    DEBUG_ASSERT(list);
+
+    if (count == 0)
+        return 0;
+
+    size_t allocated = 0;
+    if (likely(page_cache_enabled)) {
+        allocated = page_cache_take(count, list);
+        if (allocated == count)
+            return allocated;
+    }
+
+    {
+        AutoLock al(&arena_lock);
+        allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
+        if (allocated == count)
+            return allocated;
+    }
+
+    // the arenas are short, pull back whatever the other cpus have cached and try again
+    page_cache_drain_all();
+
+    AutoLock al(&arena_lock);
+    allocated += pmm_alloc_pages_locked(count - allocated, alloc_flags, list);
+    return allocated;
+}
+
 size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
     LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
 
@@ -175,6 +520,9 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
 
     address = ROUNDDOWN(address, PAGE_SIZE);
 
+    // the requested pages may be sitting in a cpu's page cache
+    page_cache_drain_all();
+
     AutoLock al(&arena_lock);
 
     /* walk through the arenas, looking to see if the physical page belongs to it */
@@ -217,19 +565,25 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
         return 1;
     }
 
-    AutoLock al(&arena_lock);
+    for (int pass = 0; pass < 2; pass++) {
+        // cached pages break up free runs, so on a miss return them to the arenas and retry
+        if (pass > 0)
+            page_cache_drain_all();
 
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
+        AutoLock al(&arena_lock);
 
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
+
+            size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
+            if (allocated > 0) {
+                DEBUG_ASSERT(allocated == count);
+                return allocated;
+            }
         }
     }
 
@@ -311,24 +665,41 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
-    AutoLock al(&arena_lock);
-
-    uint count = 0;
-    while (!list_is_empty(list)) {
-        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
-
-        DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
-
-        /* see which arena this page belongs to and add it */
-        for (auto& a : arena_list) {
-            if (a.FreePage(page) >= 0) {
-                count++;
-                break;
+    size_t count = 0;
+    if (likely(page_cache_enabled)) {
+        // pages from KMAP arenas go back to the local cache, the rest straight to their arena
+        list_node cached = LIST_INITIAL_VALUE(cached);
+        list_node uncached = LIST_INITIAL_VALUE(uncached);
+        size_t cached_count = 0;
+
+        while (!list_is_empty(list)) {
+            vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+
+            DEBUG_ASSERT_MSG(!page_is_free(page), "page %p state %u\n", page, page->state);
+            DEBUG_ASSERT(page->state != VM_PAGE_STATE_OBJECT || page->object.pin_count == 0);
+
+            if (page_is_cacheable(page)) {
+                page->state = VM_PAGE_STATE_ALLOC;
+                list_add_tail(&cached, &page->free.node);
+                cached_count++;
+            } else {
+                list_add_tail(&uncached, &page->free.node);
             }
         }
+
+        if (cached_count > 0)
+            page_cache_put(&cached);
+        count = cached_count;
+
+        if (list_is_empty(&uncached))
+            return count;
+        list = &uncached;
     }
 
-    LTRACEF("returning count %u\n", count);
+    AutoLock al(&arena_lock);
+    count += pmm_free_locked(list);
+
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -350,13 +721,23 @@ static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
     return free;
 }
 
+// Number of free pages sitting in the per-cpu caches and the zeroed pool. The counts are
+// read without their locks, so the total is only a snapshot.
+static size_t pmm_count_cached_pages() TA_NO_THREAD_SAFETY_ANALYSIS {
+    size_t cached = zero_pool_count_pages();
+    for (const auto& cache : page_cache) {
+        cached += __atomic_load_n(&cache.count, __ATOMIC_RELAXED);
+    }
+    return cached;
+}
+
 size_t pmm_count_free_pages() {
     AutoLock al(&arena_lock);
-    return pmm_count_free_pages_locked();
+    return pmm_count_free_pages_locked() + pmm_count_cached_pages();
 }
 
 static void pmm_dump_free() TA_REQ(arena_lock) {
-    auto megabytes_free = pmm_count_free_pages_locked() / 256u;
+    auto megabytes_free = (pmm_count_free_pages_locked() + pmm_count_cached_pages()) / 256u;
     printf(" %zu free MBs\n", megabytes_free);
 }
 
@@ -376,6 +757,12 @@ void pmm_count_total_states(size_t state_count[_VM_PAGE_STATE_COUNT]) {
     for (auto& a : arena_list) {
         a.CountStates(state_count);
     }
+
+    // cached pages are allocated as far as the arenas know, but are really free
+    size_t cached = pmm_count_cached_pages();
+    cached = MIN(cached, state_count[VM_PAGE_STATE_ALLOC]);
+    state_count[VM_PAGE_STATE_ALLOC] -= cached;
+    state_count[VM_PAGE_STATE_FREE] += cached;
 }
 
 extern "C" enum handler_return pmm_dump_timer(struct timer* t, zx_time_t now, void*) TA_REQ(arena_lock) {
@@ -392,6 +779,7 @@ static void arena_dump(bool is_panic) TA_NO_THREAD_SAFETY_ANALYSIS {
     for (auto& a : arena_list) {
         a.Dump(false, false);
     }
+    printf("per-cpu page caches and zeroed pool hold %zu pages\n", pmm_count_cached_pages());
     if (!is_panic) {
         arena_lock.Release();
     }
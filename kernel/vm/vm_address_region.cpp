@@ -100,6 +100,9 @@ zx_status_t VmAddressRegion::CreateSubVmarInternal(size_t offset, size_t size, u
         return ZX_ERR_ACCESS_DENIED;
     }
 
+    // Everything created inside a region that uses large pages does as well.
+    vmar_flags |= flags_ & VMAR_FLAG_LARGE_PAGES;
+
     bool is_specific_overwrite = static_cast<bool>(vmar_flags & VMAR_FLAG_SPECIFIC_OVERWRITE);
     bool is_specific = static_cast<bool>(vmar_flags & VMAR_FLAG_SPECIFIC) || is_specific_overwrite;
     if (!is_specific && offset != 0) {
@@ -157,7 +160,16 @@ zx_status_t VmAddressRegion::CreateSubVmarInternal(size_t offset, size_t size, u
         }
     } else {
         // If we're not mapping to a specific place, search for an opening.
-        zx_status_t status = AllocSpotLocked(size, align_pow2, arch_mmu_flags, &new_base);
+        // Large pages can only be used if the region lines up with them, so
+        // prefer a large page aligned spot when there is room for one.
+        zx_status_t status = ZX_ERR_NO_MEMORY;
+        if ((vmar_flags & VMAR_FLAG_LARGE_PAGES) && size >= LARGE_PAGE_SIZE &&
+            IS_LARGE_PAGE_ALIGNED(vmo_offset) && align_pow2 < LARGE_PAGE_SIZE_SHIFT) {
+            status = AllocSpotLocked(size, LARGE_PAGE_SIZE_SHIFT, arch_mmu_flags, &new_base);
+        }
+        if (status != ZX_OK) {
+            status = AllocSpotLocked(size, align_pow2, arch_mmu_flags, &new_base);
+        }
         if (status != ZX_OK) {
             return status;
         }
@@ -213,7 +225,8 @@ zx_status_t VmAddressRegion::CreateSubVmar(size_t offset, size_t size, uint8_t a
     }
 
     // Check that only allowed flags have been set
-    if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_CAN_MAP_SPECIFIC | VMAR_FLAG_COMPACT | VMAR_CAN_RWX_FLAGS)) {
+    if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_CAN_MAP_SPECIFIC | VMAR_FLAG_COMPACT |
+                       VMAR_CAN_RWX_FLAGS | VMAR_FLAG_LARGE_PAGES)) {
         return ZX_ERR_INVALID_ARGS;
     }
 
@@ -236,7 +249,8 @@ zx_status_t VmAddressRegion::CreateVmMapping(size_t mapping_offset, size_t size,
     LTRACEF("%p %#zx %#zx %x\n", this, mapping_offset, size, vmar_flags);
 
     // Check that only allowed flags have been set
-    if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE | VMAR_CAN_RWX_FLAGS)) {
+    if (vmar_flags & ~(VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE | VMAR_CAN_RWX_FLAGS |
+                       VMAR_FLAG_NO_FAULT_AROUND | VMAR_FLAG_LARGE_PAGES)) {
         return ZX_ERR_INVALID_ARGS;
     }
 
@@ -384,14 +398,25 @@ zx_status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
     canary_.Assert();
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
 
+    auto mapping = FindMappingLocked(va);
+    if (!mapping)
+        return ZX_ERR_NOT_FOUND;
+
+    return mapping->PageFault(va, pf_flags);
+}
+
+fbl::RefPtr<VmMapping> VmAddressRegion::FindMappingLocked(vaddr_t va) {
+    canary_.Assert();
+    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+
     for (auto vmar = WrapRefPtr(this);
          auto next = vmar->FindRegionLocked(va);
          vmar = next->as_vm_address_region()) {
         if (next->is_mapping())
-            return next->PageFault(va, pf_flags);
+            return next->as_vm_mapping();
     }
 
-    return ZX_ERR_NOT_FOUND;
+    return nullptr;
 }
 
 bool VmAddressRegion::IsRangeAvailableLocked(vaddr_t base, size_t size) {
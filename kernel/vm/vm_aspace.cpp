@@ -18,6 +18,7 @@
 #include <inttypes.h>
 #include <kernel/cmdline.h>
 #include <kernel/thread.h>
+#include <lib/counters.h>
 #include <lib/crypto/global_prng.h>
 #include <lib/crypto/prng.h>
 #include <safeint/safe_math.h>
@@ -53,6 +54,8 @@ static VmAddressRegion* dummy_root_vmar = nullptr;
 static fbl::Mutex aspace_list_lock;
 static fbl::DoublyLinkedList<VmAspace*> aspaces TA_GUARDED(aspace_list_lock);
 
+KCOUNTER(vm_unlocked_fault_commits, "kernel.vm.fault.unlocked_commits");
+
 // Called once at boot to initialize the singleton kernel address
 // space. Thread safety analysis is disabled since we don't need to
 // lock yet.
@@ -544,9 +547,46 @@ zx_status_t VmAspace::PageFault(vaddr_t va, uint flags) {
         flags |= VMM_PF_FLAG_GUEST;
     }
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
+    // Committing a page (zero fill or copy-on-write) is the expensive part of
+    // a write fault and only needs the vmo lock, so do it without holding the
+    // aspace lock. This lets faults on different regions of the same aspace
+    // proceed in parallel instead of serializing behind lock_.
+    if (flags & VMM_PF_FLAG_WRITE) {
+        fbl::RefPtr<VmObject> vmo;
+        uint64_t vmo_offset;
+        uint commit_flags = flags;
+        {
+            AutoLock a(&lock_);
+
+            auto mapping = root_vmar_->FindMappingLocked(va);
+            if (!mapping)
+                return ZX_ERR_NOT_FOUND;
+            zx_status_t status = mapping->CheckFaultPermissions(flags);
+            if (status != ZX_OK)
+                return status;
+
+            vmo = mapping->vmo();
+            vmo_offset = ROUNDDOWN(va, PAGE_SIZE) - mapping->base() + mapping->object_offset();
+            if (mapping->CanMapLargePage(va))
+                commit_flags |= VMM_PF_FLAG_LARGE_PAGE;
+        }
+
+        if (vmo->is_paged()) {
+            AutoLock al(vmo->lock());
+            // A page the vmo already holds needs no commit; the locked pass
+            // below finds it directly. Errors are also left to that pass,
+            // which retries the lookup against the (possibly changed) mapping.
+            paddr_t pa;
+            if (vmo->GetResidentPagesLocked(vmo_offset, 1, &pa) == 0 &&
+                vmo->GetPageLocked(vmo_offset, commit_flags, nullptr, nullptr, nullptr) == ZX_OK)
+                kcounter_add(vm_unlocked_fault_commits, 1);
+        }
+    }
+
+    // Hold the aspace lock to install the translation, which stops any other
+    // operations on the address space from moving the region out from
+    // underneath it. The mapping is looked up again here since it may have
+    // been changed while the lock was dropped above.
     AutoLock a(&lock_);
 
     return root_vmar_->PageFault(va, flags);
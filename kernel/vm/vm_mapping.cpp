@@ -9,10 +9,14 @@
 #include "vm_priv.h"
 #include <assert.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_call.h>
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
+#include <lib/counters.h>
+#include <lk/init.h>
 #include <safeint/safe_math.h>
 #include <trace.h>
 #include <vm/fault.h>
@@ -25,6 +29,28 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+KCOUNTER(vm_fault_around_count, "kernel.vm.fault_around.faults");
+KCOUNTER(vm_fault_around_pages, "kernel.vm.fault_around.pages");
+KCOUNTER(vm_large_page_mappings, "kernel.vm.large_page.mappings");
+
+// Upper bound on kernel.vm.fault-around-pages, which sizes an array on the
+// stack of the fault path.
+static constexpr size_t kFaultAroundMaxPages = 64;
+
+// Size of the naturally aligned window of pages, including the faulting one,
+// that a page fault maps from the VMO's resident pages.  Always a power of two;
+// 1 disables fault-around.
+static size_t fault_around_pages = 16;
+
+static void fault_around_init(uint level) {
+    uint64_t pages = cmdline_get_uint64("kernel.vm.fault-around-pages", fault_around_pages);
+    pages = fbl::clamp<uint64_t>(pages, 1, kFaultAroundMaxPages);
+    // Round down to a power of two so the window can be aligned with ROUNDDOWN.
+    fault_around_pages = 1ul << (63 - __builtin_clzll(pages));
+}
+
+LK_INIT_HOOK(vm_fault_around, fault_around_init, LK_INIT_LEVEL_VM);
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      fbl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags)
     : VmAddressRegionOrMapping(base, size, vmar_flags,
@@ -595,21 +621,7 @@ zx_status_t VmMapping::DestroyLocked() {
     return ZX_OK;
 }
 
-zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
-    canary_.Assert();
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
-
-    DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
-
-    va = ROUNDDOWN(va, PAGE_SIZE);
-    uint64_t vmo_offset = va - base_ + object_offset_;
-
-    __UNUSED char pf_string[5];
-    LTRACEF("%p va %#" PRIxPTR " vmo_offset %#" PRIx64 ", pf_flags %#x (%s)\n",
-            this, va, vmo_offset, pf_flags,
-            vmm_pf_flags_to_string(pf_flags, pf_string));
-
-    // make sure we have permission to continue
+zx_status_t VmMapping::CheckFaultPermissions(uint pf_flags) const {
     if ((pf_flags & VMM_PF_FLAG_USER) && !(arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_USER)) {
         // user page fault on non user mapped region
         LTRACEF("permission failure: user fault on non user region\n");
@@ -630,6 +642,27 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         LTRACEF("permission failure: execute fault on no execute region\n");
         return ZX_ERR_ACCESS_DENIED;
     }
+    return ZX_OK;
+}
+
+zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
+    canary_.Assert();
+    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+
+    DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
+
+    va = ROUNDDOWN(va, PAGE_SIZE);
+    uint64_t vmo_offset = va - base_ + object_offset_;
+
+    __UNUSED char pf_string[5];
+    LTRACEF("%p va %#" PRIxPTR " vmo_offset %#" PRIx64 ", pf_flags %#x (%s)\n",
+            this, va, vmo_offset, pf_flags,
+            vmm_pf_flags_to_string(pf_flags, pf_string));
+
+    // make sure we have permission to continue
+    zx_status_t status = CheckFaultPermissions(pf_flags);
+    if (status != ZX_OK)
+        return status;
 
     // grab the lock for the vmo
     AutoLock al(object_->lock());
@@ -645,13 +678,20 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     // fault in or grab an existing page
     paddr_t new_pa;
     vm_page_t* page;
-    zx_status_t status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, &page, &new_pa);
+    const bool large_page = CanMapLargePage(va);
+    status = object_->GetPageLocked(vmo_offset,
+                                    large_page ? pf_flags | VMM_PF_FLAG_LARGE_PAGE : pf_flags,
+                                    nullptr, &page, &new_pa);
     if (status < 0) {
         TRACEF("ERROR: failed to fault in or grab existing page\n");
         TRACEF("%p vmo_offset %#" PRIx64 ", pf_flags %#x\n", this, vmo_offset, pf_flags);
         return status;
     }
 
+    // if the object holds the whole large page around us, map all of it at once
+    if (large_page && MapLargePageLocked(va, pf_flags) == ZX_OK)
+        return ZX_OK;
+
     // if we read faulted, make sure we map or modify the page without any write permissions
     // this ensures we will fault again if a write is attempted so we can potentially
     // replace this page with a copy or a new one
@@ -726,6 +766,10 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return ZX_ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+
+        if (!(pf_flags & VMM_PF_FLAG_GUEST)) {
+            FaultAroundLocked(va);
+        }
     }
 
 // TODO: figure out what to do with this
@@ -739,6 +783,112 @@ zx_status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return ZX_OK;
 }
 
+bool VmMapping::CanMapLargePage(vaddr_t va) const {
+    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+
+    if (!(flags_ & VMAR_FLAG_LARGE_PAGES))
+        return false;
+
+    // the vmo offset must be large page aligned wherever the virtual address is
+    if (!IS_LARGE_PAGE_ALIGNED(base_ - object_offset_))
+        return false;
+
+    const vaddr_t large_va = ROUNDDOWN(va, LARGE_PAGE_SIZE);
+    return size_ >= LARGE_PAGE_SIZE && large_va >= base_ &&
+           large_va - base_ <= size_ - LARGE_PAGE_SIZE;
+}
+
+zx_status_t VmMapping::MapLargePageLocked(vaddr_t va, uint pf_flags) {
+    DEBUG_ASSERT(CanMapLargePage(va));
+
+    const vaddr_t large_va = ROUNDDOWN(va, LARGE_PAGE_SIZE);
+    paddr_t pa;
+    if (!object_->GetLargePageLocked(large_va - base_ + object_offset_, &pa))
+        return ZX_ERR_NOT_FOUND;
+
+    // The pages are all the object's own, so they can be mapped with the full
+    // permissions of the mapping, replacing whatever smaller pages were there.
+    const size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+    zx_status_t status = aspace_->arch_aspace().Unmap(large_va, count, nullptr);
+    if (status < 0) {
+        TRACEF("failed to remove old mappings before mapping large page\n");
+        return status;
+    }
+
+    size_t mapped;
+    status = aspace_->arch_aspace().MapContiguous(large_va, pa, count, arch_mmu_flags_, &mapped);
+    if (status < 0) {
+        // Fall back to the single page path, the rest will fault back in.
+        TRACEF("failed to map large page\n");
+        return status;
+    }
+    DEBUG_ASSERT(mapped == count);
+
+    kcounter_add(vm_large_page_mappings, 1);
+    LTRACEF("mapped large page pa %#" PRIxPTR " at va %#" PRIxPTR "\n", pa, large_va);
+
+#if ARCH_ARM64
+    if (!(pf_flags & VMM_PF_FLAG_GUEST) && (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)) {
+        arch_sync_cache_range(large_va, LARGE_PAGE_SIZE);
+    }
+#endif
+    return ZX_OK;
+}
+
+void VmMapping::FaultAroundLocked(vaddr_t va) {
+    if (fault_around_pages <= 1 || (flags_ & VMAR_FLAG_NO_FAULT_AROUND))
+        return;
+
+    // Clip the aligned window containing |va| to the mapping.
+    const size_t window_size = fault_around_pages * PAGE_SIZE;
+    vaddr_t start = fbl::max(ROUNDDOWN(va, window_size), base_);
+    vaddr_t end = fbl::min(ROUNDDOWN(va, window_size) + window_size, base_ + size_);
+    size_t count = (end - start) / PAGE_SIZE;
+
+    // Only pages the VMO holds itself are mapped; they may be mapped with the
+    // full permissions of the mapping since a write fault would resolve to the
+    // same page.  Anything that would have to come from a parent or be
+    // allocated is left to its own fault.
+    paddr_t pa[kFaultAroundMaxPages];
+    if (object_->GetResidentPagesLocked(start - base_ + object_offset_, count, pa) <= 1)
+        return;
+
+    size_t mapped_ahead = 0;
+    size_t run = 0;
+    auto map_run = [&](size_t next) {
+        if (run == 0)
+            return;
+        vaddr_t run_va = start + (next - run) * PAGE_SIZE;
+        size_t mapped;
+        zx_status_t status = aspace_->arch_aspace().Map(run_va, &pa[next - run], run,
+                                                        arch_mmu_flags_, &mapped);
+        if (status == ZX_OK) {
+            mapped_ahead += mapped;
+#if ARCH_ARM64
+            if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE) {
+                arch_sync_cache_range(run_va, mapped * PAGE_SIZE);
+            }
+#endif
+        }
+        run = 0;
+    };
+    for (size_t i = 0; i < count; i++) {
+        vaddr_t v = start + i * PAGE_SIZE;
+        // Skip holes in the VMO and pages that are already mapped.
+        if (pa[i] == 0 || v == va || aspace_->arch_aspace().Query(v, nullptr, nullptr) == ZX_OK) {
+            map_run(i);
+            continue;
+        }
+        run++;
+    }
+    map_run(count);
+
+    if (mapped_ahead > 0) {
+        kcounter_add(vm_fault_around_count, 1);
+        kcounter_add(vm_fault_around_pages, mapped_ahead);
+    }
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
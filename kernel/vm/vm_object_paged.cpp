@@ -11,10 +11,12 @@
 #include <arch/ops.h>
 #include <assert.h>
 #include <err.h>
+#include <fbl/algorithm.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/auto_lock.h>
 #include <inttypes.h>
 #include <lib/console.h>
+#include <lib/counters.h>
 #include <safeint/safe_math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +31,14 @@ using fbl::AutoLock;
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+KCOUNTER(vm_large_page_commits, "kernel.vm.large_page.commits");
+KCOUNTER(vm_large_page_commit_failures, "kernel.vm.large_page.commit_failures");
+KCOUNTER(vm_cow_collapses, "kernel.vm.cow.collapses");
+KCOUNTER(vm_cow_pages_absorbed, "kernel.vm.cow.pages_absorbed");
+KCOUNTER(vm_cow_pages_freed, "kernel.vm.cow.pages_freed");
+KCOUNTER(vm_page_merge_merged, "kernel.vm.page_merge.merged");
+KCOUNTER(vm_page_merge_unmerged, "kernel.vm.page_merge.unmerged");
+
 namespace {
 
 void ZeroPage(paddr_t pa) {
@@ -43,18 +53,38 @@ void ZeroPage(vm_page_t* p) {
     ZeroPage(pa);
 }
 
+// |a| - |b|, or 0 if |b| is larger.
+uint64_t SubtractOrZero(uint64_t a, uint64_t b) {
+    return a > b ? a - b : 0;
+}
+
 void InitializeVmPage(vm_page_t* p) {
     DEBUG_ASSERT(p->state == VM_PAGE_STATE_ALLOC);
     p->state = VM_PAGE_STATE_OBJECT;
     p->object.pin_count = 0;
     p->object.contiguous_pin = 0;
+    p->object.merged = 0;
+    p->object.referenced = 1;
+    p->object.age = 0;
+    p->object.share_count = 0;
 }
 
 } // namespace
 
-VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, fbl::RefPtr<VmObject> parent)
-    : VmObject(fbl::move(parent)), pmm_alloc_flags_(pmm_alloc_flags) {
+fbl::Mutex VmObjectPaged::option_list_lock_ = {};
+VmObjectPaged::OptionList VmObjectPaged::option_list_ = {};
+uint64_t VmObjectPaged::option_seq_next_ = 1;
+
+VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, uint32_t options,
+                             fbl::RefPtr<VmObject> parent)
+    : VmObject(fbl::move(parent)), pmm_alloc_flags_(pmm_alloc_flags), options_(options) {
     LTRACEF("%p\n", this);
+
+    if (options_) {
+        AutoLock a(&option_list_lock_);
+        option_seq_ = option_seq_next_++;
+        option_list_.push_back(this);
+    }
 }
 
 VmObjectPaged::~VmObjectPaged() {
@@ -62,6 +92,11 @@ VmObjectPaged::~VmObjectPaged() {
 
     LTRACEF("%p\n", this);
 
+    if (options_) {
+        AutoLock a(&option_list_lock_);
+        option_list_.erase(*this);
+    }
+
     page_list_.ForEveryPage(
         [](const auto p, uint64_t off) {
             if (p->object.contiguous_pin) {
@@ -73,15 +108,20 @@ VmObjectPaged::~VmObjectPaged() {
 
     // free all of the pages attached to us
     page_list_.FreeAllPages();
+    DropCompressedLocked(0, UINT64_MAX);
 }
 
-zx_status_t VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size, fbl::RefPtr<VmObject>* obj) {
+zx_status_t VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint32_t options, uint64_t size,
+                                  fbl::RefPtr<VmObject>* obj) {
     // there's a max size to keep indexes within range
     if (size > MAX_SIZE)
         return ZX_ERR_INVALID_ARGS;
 
+    if (options & ~(kMergeable | kCompressible))
+        return ZX_ERR_INVALID_ARGS;
+
     fbl::AllocChecker ac;
-    auto vmo = fbl::AdoptRef<VmObject>(new (&ac) VmObjectPaged(pmm_alloc_flags, nullptr));
+    auto vmo = fbl::AdoptRef<VmObject>(new (&ac) VmObjectPaged(pmm_alloc_flags, options, nullptr));
     if (!ac.check())
         return ZX_ERR_NO_MEMORY;
 
@@ -100,7 +140,8 @@ zx_status_t VmObjectPaged::CloneCOW(uint64_t offset, uint64_t size, bool copy_na
     canary_.Assert();
 
     fbl::AllocChecker ac;
-    auto vmo = fbl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(pmm_alloc_flags_, fbl::WrapRefPtr(this)));
+    auto vmo = fbl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(pmm_alloc_flags_, options_,
+                                                                    fbl::WrapRefPtr(this)));
     if (!ac.check())
         return ZX_ERR_NO_MEMORY;
 
@@ -140,13 +181,14 @@ void VmObjectPaged::Dump(uint depth, bool verbose) {
         count++;
         return ZX_ERR_NEXT;
     });
+    size_t shared = SharedPagesLocked();
 
     for (uint i = 0; i < depth; ++i) {
         printf("  ");
     }
     printf("vmo %p/k%" PRIu64 " size %#" PRIx64
-           " pages %zu ref %d parent k%" PRIu64 "\n",
-           this, user_id_, size_, count, ref_count_debug(), parent_id);
+           " pages %zu shared %zu compressed %zu ref %d parent k%" PRIu64 "\n",
+           this, user_id_, size_, count, shared, compressed_count_, ref_count_debug(), parent_id);
 
     if (verbose) {
         auto f = [depth](const auto p, uint64_t offset) {
@@ -160,6 +202,149 @@ void VmObjectPaged::Dump(uint depth, bool verbose) {
     }
 }
 
+void VmObjectPaged::CollapseParentLocked() {
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(parent_);
+
+    // nothing is looked up in the parent any more, e.g. after an earlier
+    // collapse into a root that had to stay around
+    if (parent_limit_ == 0 || !parent_->is_paged())
+        return;
+    auto parent = static_cast<VmObjectPaged*>(parent_.get());
+
+    // The parent is only ours once nothing else refers to it: with no handles,
+    // mappings or other kernel references, nothing but us can read or change
+    // its pages.  New references are only made from existing ones, and the one
+    // left is our parent_, which is guarded by the lock we hold, so the count
+    // cannot grow underneath us.
+    if (parent->collapse_blocked_ || parent->children_list_len_ != 1 ||
+        parent->mapping_list_len_ != 0 || parent->ref_count_debug() != 1) {
+        return;
+    }
+
+    // Pages the parent holds compressed would have to move with the rest;
+    // leave such a parent alone.
+    if (parent->compressed_count_ > 0)
+        return;
+
+    // Work out how much of the chain above the parent we will see through it,
+    // in our own offsets, before touching anything.
+    uint64_t limit = fbl::min(ROUNDUP_PAGE_SIZE(size_), parent_limit_);
+    fbl::RefPtr<VmObject> grandparent = parent->parent_;
+    safeint::CheckedNumeric<uint64_t> grandparent_offset = parent_offset_;
+    grandparent_offset += parent->parent_offset_;
+    if (grandparent) {
+        if (!grandparent_offset.IsValid())
+            return;
+        limit = fbl::min(limit, SubtractOrZero(ROUNDUP_PAGE_SIZE(parent->size_), parent_offset_));
+        limit = fbl::min(limit, SubtractOrZero(parent->parent_limit_, parent_offset_));
+    }
+
+    // Pinned pages have to stay where they are.  Only the pages' owner can
+    // unpin them, so don't scan for them again until that happens.
+    if (parent->AnyPagesPinnedLocked(0, ROUNDUP_PAGE_SIZE(parent->size_))) {
+        parent->collapse_blocked_ = true;
+        return;
+    }
+
+    // Move every parent page we can see and don't already have a copy of into
+    // our own list, and free the rest, which nothing can reach any more.
+    list_node free_list;
+    list_initialize(&free_list);
+    const uint64_t window = fbl::min(ROUNDUP_PAGE_SIZE(size_), parent_limit_);
+    bool complete = true;
+    size_t absorbed = 0;
+    size_t freed = 0;
+    parent->page_list_.ForEveryPage(
+        [this, window, &free_list, &complete, &absorbed, &freed](vm_page_t*& p, uint64_t off) {
+            if (off >= parent_offset_ && off - parent_offset_ < window &&
+                !page_list_.GetPage(off - parent_offset_)) {
+                if (page_list_.AddPage(p, off - parent_offset_) != ZX_OK) {
+                    // Out of memory for the page list; whatever is still in
+                    // the parent keeps being found there.
+                    complete = false;
+                    return ZX_ERR_STOP;
+                }
+                absorbed++;
+            } else {
+                if (page_merge_release(p))
+                    list_add_tail(&free_list, &p->free.node);
+                freed++;
+            }
+            p = nullptr;
+            return ZX_ERR_NEXT;
+        });
+    pmm_free(&free_list);
+
+    // Whatever was freed is beyond what we look up from now on, even if we
+    // are grown later.
+    parent_limit_ = window;
+
+    kcounter_add(vm_cow_pages_absorbed, absorbed);
+    kcounter_add(vm_cow_pages_freed, freed);
+    LTRACEF("vmo %p absorbed %zu pages from parent %p, freed %zu\n",
+            this, absorbed, parent, freed);
+
+    if (!complete) {
+        // What is left keeps being found in the parent; rescanning it on
+        // every lookup would not help while memory is short.
+        parent->collapse_blocked_ = true;
+        return;
+    }
+    kcounter_add(vm_cow_collapses, 1);
+
+    if (!grandparent) {
+        // The parent is the root of the clone tree and owns the lock we share,
+        // so it has to stay around, but it is empty now and needn't be asked
+        // for pages again.
+        parent->page_list_.FreeAllPages();
+        parent_limit_ = 0;
+        return;
+    }
+
+    // Take the parent's place under the grandparent.  The parent is destroyed
+    // when parent_ is replaced, removing itself from the grandparent.
+    parent->RemoveChildLocked(this);
+    grandparent->AddChildLocked(this);
+    parent_offset_ = grandparent_offset.ValueOrDie();
+    parent_limit_ = fbl::min(limit, window);
+    parent_ = fbl::move(grandparent);
+}
+
+size_t VmObjectPaged::SharedPagesLocked() {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    // For each ancestor, count the pages it holds at offsets we would look up
+    // in it, skipping those hidden by a copy further down the chain.
+    size_t count = 0;
+    uint64_t shift = 0;
+    uint64_t limit = ROUNDUP_PAGE_SIZE(size_);
+    for (VmObjectPaged* child = this; child->parent_ && child->parent_->is_paged();) {
+        auto ancestor = static_cast<VmObjectPaged*>(child->parent_.get());
+        limit = fbl::min(limit, SubtractOrZero(child->parent_limit_, shift));
+        shift += child->parent_offset_;
+        limit = fbl::min(limit, SubtractOrZero(ROUNDUP_PAGE_SIZE(ancestor->size_), shift));
+        if (limit == 0)
+            break;
+
+        ancestor->page_list_.ForEveryPageInRange(
+            [this, ancestor, shift, &count](const auto p, uint64_t off) {
+                uint64_t o = off - shift;
+                for (VmObjectPaged* v = this; v != ancestor;
+                     v = static_cast<VmObjectPaged*>(v->parent_.get())) {
+                    if (v->page_list_.GetPage(o))
+                        return ZX_ERR_NEXT;
+                    o += v->parent_offset_;
+                }
+                count++;
+                return ZX_ERR_NEXT;
+            },
+            shift, shift + limit);
+        child = ancestor;
+    }
+    return count;
+}
+
 size_t VmObjectPaged::AllocatedPagesInRange(uint64_t offset, uint64_t len) const {
     canary_.Assert();
     AutoLock a(&lock_);
@@ -256,6 +441,140 @@ zx_status_t VmObjectPaged::CreateFromROData(const void* data, size_t size, fbl::
     return ZX_OK;
 }
 
+// Only pages this VMO holds itself are reported; nothing is faulted in and
+// the parent is not searched.
+size_t VmObjectPaged::GetResidentPagesLocked(uint64_t offset, size_t count, paddr_t* pa) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset));
+
+    for (size_t i = 0; i < count; i++) {
+        pa[i] = 0;
+    }
+    if (offset >= size_)
+        return 0;
+    uint64_t end = offset + fbl::min(count * PAGE_SIZE, size_ - offset);
+
+    size_t found = 0;
+    page_list_.ForEveryPageInRange(
+        [pa, offset, &found](const auto p, uint64_t off) {
+            // merged pages may only be mapped read-only, and pages the aging
+            // pass unmapped have to fault to be seen as used again
+            if (p->state == VM_PAGE_STATE_OBJECT && (p->object.merged || !p->object.referenced))
+                return ZX_ERR_NEXT;
+            pa[(off - offset) / PAGE_SIZE] = vm_page_to_paddr(p);
+            found++;
+            return ZX_ERR_NEXT;
+        },
+        offset, end);
+    return found;
+}
+
+bool VmObjectPaged::GetLargePageLocked(uint64_t offset, paddr_t* pa) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_LARGE_PAGE_ALIGNED(offset));
+
+    if (offset >= size_ || size_ - offset < LARGE_PAGE_SIZE)
+        return false;
+
+    // the scanner may swap out any page of a mergeable VMO, so its runs are
+    // not worth mapping as one
+    if (options_ & kMergeable)
+        return false;
+
+    paddr_t base = 0;
+    size_t found = 0;
+    page_list_.ForEveryPageInRange(
+        [offset, &base, &found](const auto p, uint64_t off) {
+            // as in GetResidentPagesLocked, a page the aging pass unmapped
+            // has to fault on its own to be seen as used again
+            if (p->state == VM_PAGE_STATE_OBJECT && (p->object.merged || !p->object.referenced))
+                return ZX_ERR_STOP;
+            paddr_t page_pa = vm_page_to_paddr(p);
+            if (off == offset) {
+                if (!IS_LARGE_PAGE_ALIGNED(page_pa))
+                    return ZX_ERR_STOP;
+                base = page_pa;
+            } else if (found == 0 || page_pa != base + (off - offset)) {
+                return ZX_ERR_STOP;
+            }
+            found++;
+            return ZX_ERR_NEXT;
+        },
+        offset, offset + LARGE_PAGE_SIZE);
+
+    if (found != LARGE_PAGE_SIZE / PAGE_SIZE)
+        return false;
+
+    *pa = base;
+    return true;
+}
+
+zx_status_t VmObjectPaged::CommitLargePageLocked(uint64_t offset, vm_page_t** page_out,
+                                                 paddr_t* pa_out) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(!parent_);
+
+    const uint64_t start = ROUNDDOWN(offset, LARGE_PAGE_SIZE);
+    if (start >= size_ || size_ - start < LARGE_PAGE_SIZE)
+        return ZX_ERR_OUT_OF_RANGE;
+
+    // only take over a range that is entirely uncommitted
+    bool empty = true;
+    page_list_.ForEveryPageInRange(
+        [&empty](const auto, uint64_t) {
+            empty = false;
+            return ZX_ERR_STOP;
+        },
+        start, start + LARGE_PAGE_SIZE);
+    if (!empty)
+        return ZX_ERR_BAD_STATE;
+
+    const size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+    list_node page_list;
+    list_initialize(&page_list);
+
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, LARGE_PAGE_SIZE_SHIFT,
+                                            nullptr, &page_list);
+    if (allocated < count) {
+        LTRACEF("failed to allocate a large page (got %zu pages)\n", allocated);
+        pmm_free(&page_list);
+        kcounter_add(vm_large_page_commit_failures, 1);
+        return ZX_ERR_NO_MEMORY;
+    }
+
+    vm_page_t* page = nullptr;
+    for (uint64_t o = start; o < start + LARGE_PAGE_SIZE; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, free.node);
+        ASSERT(p);
+
+        InitializeVmPage(p);
+        ZeroPage(p);
+
+        zx_status_t status = page_list_.AddPage(p, o);
+        DEBUG_ASSERT(status == ZX_OK);
+
+        if (o == ROUNDDOWN(offset, PAGE_SIZE))
+            page = p;
+    }
+    DEBUG_ASSERT(page);
+
+    // other mappings may have the zero page mapped in this range
+    RangeChangeUpdateLocked(start, LARGE_PAGE_SIZE);
+
+    kcounter_add(vm_large_page_commits, 1);
+    LTRACEF("committed large page at offset %#" PRIx64 "\n", start);
+
+    if (page_out)
+        *page_out = page;
+    if (pa_out)
+        *pa_out = vm_page_to_paddr(page);
+
+    return ZX_OK;
+}
+
 // Looks up the page at the requested offset, faulting it in if requested and necessary.  If
 // this VMO has a parent and the requested page isn't found, the parent will be searched.
 //
@@ -274,9 +593,35 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
     vm_page_t* p;
     paddr_t pa;
 
+    // a parent only we can reach is folded into us first, which saves walking
+    // it on this and later lookups
+    if (parent_)
+        CollapseParentLocked();
+
     // see if we already have a page at that offset
     p = page_list_.GetPage(offset);
     if (p) {
+        // a merged page is shared read-only, so writing needs a copy of our own
+        if (page_is_merged(p) && (pf_flags & VMM_PF_FLAG_WRITE)) {
+            zx_status_t status = UnmergePageLocked(offset, &p);
+            if (status != ZX_OK)
+                return status;
+        }
+        if (p->state == VM_PAGE_STATE_OBJECT && !p->object.merged)
+            p->object.referenced = true;
+        if (page_out)
+            *page_out = p;
+        if (pa_out)
+            *pa_out = vm_page_to_paddr(p);
+        return ZX_OK;
+    }
+
+    // or one we compressed, which has to come back before anything else is
+    // consulted
+    if (compressed_count_ > 0 && compressed_pages_.find(offset).IsValid()) {
+        zx_status_t status = DecompressPageLocked(offset, free_list, &p);
+        if (status != ZX_OK)
+            return status;
         if (page_out)
             *page_out = p;
         if (pa_out)
@@ -289,7 +634,7 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
             vmm_pf_flags_to_string(pf_flags, pf_string));
 
     // if we have a parent see if they have a page for us
-    if (parent_) {
+    if (parent_ && offset < parent_limit_) {
         safeint::CheckedNumeric<uint64_t> parent_offset = parent_offset_;
         parent_offset += offset;
         DEBUG_ASSERT(parent_offset.IsValid());
@@ -370,15 +715,24 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
         return ZX_OK;
     }
 
-    // allocate a page
+    // if the faulting mapping can use large pages, try to back the whole large
+    // page around this offset with one contiguous run so it can be mapped with
+    // a single entry; fall back to a single page if that isn't possible
+    if ((pf_flags & VMM_PF_FLAG_LARGE_PAGE) && !parent_ && !(options_ & kMergeable)) {
+        if (CommitLargePageLocked(offset, page_out, pa_out) == ZX_OK)
+            return ZX_OK;
+    }
+
+    // allocate a page, preferring one the pmm has already zeroed
     if (free_list) {
         p = list_remove_head_type(free_list, vm_page_t, free.node);
         if (p) {
             pa = vm_page_to_paddr(p);
+            ZeroPage(pa);
         }
     }
     if (!p) {
-        p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+        p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &pa);
     }
     if (!p) {
         return ZX_ERR_NO_MEMORY;
@@ -386,9 +740,6 @@ zx_status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, list_no
 
     InitializeVmPage(p);
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
     zx_status_t status = AddPageLocked(p, offset);
     DEBUG_ASSERT(status == ZX_OK);
 
@@ -428,6 +779,11 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
     DEBUG_ASSERT(end > offset);
     offset = ROUNDDOWN(offset, PAGE_SIZE);
 
+    // fold in a parent only we can reach before counting, since the pages
+    // it hands over need none of the ones allocated below
+    if (parent_)
+        CollapseParentLocked();
+
     // make a pass through the list, counting the number of pages we need to allocate
     size_t count = 0;
     uint64_t expected_next_off = offset;
@@ -481,10 +837,11 @@ zx_status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t*
             *committed += PAGE_SIZE;
     }
 
-    DEBUG_ASSERT(list_is_empty(&page_list));
+    // a lookup may still have collapsed more of the chain into us, in which
+    // case some of the pages were not needed
+    pmm_free(&page_list);
 
-    // for now we only support committing as much as we were asked for
-    DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
+    DEBUG_ASSERT(!committed || *committed <= count * PAGE_SIZE);
 
     return ZX_OK;
 }
@@ -611,6 +968,11 @@ zx_status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(start, page_aligned_len);
 
+    // compressed pages go too
+    size_t dropped = DropCompressedLocked(start, end);
+    if (decommitted)
+        *decommitted += dropped * PAGE_SIZE;
+
     // iterate through the pages, freeing them
     while (start < end) {
         auto status = page_list_.FreePage(start);
@@ -643,6 +1005,22 @@ zx_status_t VmObjectPaged::PinLocked(uint64_t offset, uint64_t len) {
     const uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
+    // pinned pages have to be resident
+    if (compressed_count_ > 0) {
+        zx_status_t status = DecompressRangeLocked(start_page_offset,
+                                                   end_page_offset - start_page_offset);
+        if (status != ZX_OK)
+            return status;
+    }
+
+    // and are handed to devices that may write them
+    if (options_ & kMergeable) {
+        zx_status_t status = UnmergeRangeLocked(start_page_offset,
+                                                end_page_offset - start_page_offset);
+        if (status != ZX_OK)
+            return status;
+    }
+
     uint64_t expected_next_off = start_page_offset;
     zx_status_t status = page_list_.ForEveryPageInRange(
         [&expected_next_off](const auto p, uint64_t off) {
@@ -687,6 +1065,9 @@ void VmObjectPaged::UnpinLocked(uint64_t offset, uint64_t len) {
     if (unlikely(len == 0))
         return;
 
+    // our child may be able to take our pages now
+    collapse_blocked_ = false;
+
     const uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
@@ -709,6 +1090,317 @@ void VmObjectPaged::UnpinLocked(uint64_t offset, uint64_t len) {
     return;
 }
 
+zx_status_t VmObjectPaged::UnmergePageLocked(uint64_t offset, vm_page_t** page_out) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    vm_page_t* p = page_list_.GetPage(offset);
+    DEBUG_ASSERT(p && p->object.merged);
+
+    // whoever shared the page with us has since let go of it
+    if (page_merge_try_unshare(p)) {
+        kcounter_add(vm_page_merge_unmerged, 1);
+        *page_out = p;
+        return ZX_OK;
+    }
+
+    paddr_t pa;
+    vm_page_t* copy = pmm_alloc_page(pmm_alloc_flags_, &pa);
+    if (!copy)
+        return ZX_ERR_NO_MEMORY;
+
+    InitializeVmPage(copy);
+    memcpy(paddr_to_physmap(pa), paddr_to_physmap(vm_page_to_paddr(p)), PAGE_SIZE);
+
+    __UNUSED vm_page_t* old = page_list_.ReplacePage(offset, copy);
+    DEBUG_ASSERT(old == p);
+
+    // mappings of the shared page have to go
+    RangeChangeUpdateLocked(offset, PAGE_SIZE);
+
+    if (page_merge_release(p))
+        pmm_free_page(p);
+
+    kcounter_add(vm_page_merge_unmerged, 1);
+    LTRACEF("vmo %p unmerged page at offset %#" PRIx64 "\n", this, offset);
+
+    *page_out = copy;
+    return ZX_OK;
+}
+
+zx_status_t VmObjectPaged::UnmergeRangeLocked(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.GetPage(o);
+        if (p && page_is_merged(p)) {
+            zx_status_t status = UnmergePageLocked(o, &p);
+            if (status != ZX_OK)
+                return status;
+        }
+    }
+    return ZX_OK;
+}
+
+fbl::RefPtr<VmObjectPaged> VmObjectPaged::NextWithOption(const VmObjectPaged* prev,
+                                                          uint32_t option) {
+    AutoLock a(&option_list_lock_);
+
+    auto iter = prev ? ++option_list_.make_iterator(*const_cast<VmObjectPaged*>(prev))
+                     : option_list_.begin();
+    for (; iter != option_list_.end(); ++iter) {
+        if (!(iter->options_ & option))
+            continue;
+        // skip VMOs that are on their way out
+        auto vmo = fbl::internal::MakeRefPtrUpgradeFromRaw(&*iter, option_list_lock_);
+        if (vmo)
+            return vmo;
+    }
+    return nullptr;
+}
+
+fbl::RefPtr<VmObjectPaged> VmObjectPaged::FindWithOption(uint64_t seq, uint32_t option) {
+    AutoLock a(&option_list_lock_);
+
+    // the list is in creation order, so it is sorted by option_seq_
+    for (auto iter = option_list_.begin(); iter != option_list_.end(); ++iter) {
+        if (iter->option_seq_ < seq || !(iter->options_ & option))
+            continue;
+        auto vmo = fbl::internal::MakeRefPtrUpgradeFromRaw(&*iter, option_list_lock_);
+        if (vmo)
+            return vmo;
+    }
+    return nullptr;
+}
+
+size_t VmObjectPaged::HashPagesForMerge(uint64_t offset, size_t max, PageMergeCandidate* out,
+                                        uint64_t* next) {
+    canary_.Assert();
+    AutoLock a(&lock_);
+
+    size_t count = 0;
+    *next = UINT64_MAX;
+    page_list_.ForEveryPageInRange(
+        [this, max, out, next, &count](const auto p, uint64_t off) {
+            if (count == max) {
+                *next = off;
+                return ZX_ERR_STOP;
+            }
+            if (p->state != VM_PAGE_STATE_OBJECT || p->object.pin_count > 0)
+                return ZX_ERR_NEXT;
+            out[count].hash = page_merge_hash(paddr_to_physmap(vm_page_to_paddr(p)));
+            out[count].offset = off;
+            out[count].vmo = this;
+            count++;
+            return ZX_ERR_NEXT;
+        },
+        offset, ROUNDUP_PAGE_SIZE(size_));
+    return count;
+}
+
+vm_page_t* VmObjectPaged::AcquirePageForMerge(uint64_t offset) {
+    canary_.Assert();
+    AutoLock a(&lock_);
+
+    vm_page_t* p = page_list_.GetPage(offset);
+    if (!p || p->state != VM_PAGE_STATE_OBJECT || p->object.pin_count > 0)
+        return nullptr;
+
+    if (!p->object.merged) {
+        page_merge_mark(p);
+        // from now on the page may only be mapped read-only
+        RangeChangeUpdateLocked(offset, PAGE_SIZE);
+    }
+    page_merge_acquire(p);
+    return p;
+}
+
+zx_status_t VmObjectPaged::MergePage(uint64_t offset, vm_page_t* shared) {
+    canary_.Assert();
+    DEBUG_ASSERT(shared->object.merged);
+
+    AutoLock a(&lock_);
+
+    vm_page_t* p = page_list_.GetPage(offset);
+    if (!p || p == shared)
+        return ZX_ERR_NOT_FOUND;
+    if (p->state != VM_PAGE_STATE_OBJECT || p->object.pin_count > 0)
+        return ZX_ERR_BAD_STATE;
+
+    const void* src = paddr_to_physmap(vm_page_to_paddr(shared));
+    const void* dst = paddr_to_physmap(vm_page_to_paddr(p));
+    if (memcmp(src, dst, PAGE_SIZE))
+        return ZX_ERR_BAD_STATE;
+
+    // Nothing can write the page once it is unmapped and we hold the lock, so
+    // compare again to catch a write that raced with the first check.
+    RangeChangeUpdateLocked(offset, PAGE_SIZE);
+    if (memcmp(src, dst, PAGE_SIZE))
+        return ZX_ERR_BAD_STATE;
+
+    page_merge_acquire(shared);
+    __UNUSED vm_page_t* old = page_list_.ReplacePage(offset, shared);
+    DEBUG_ASSERT(old == p);
+    if (page_merge_release(p))
+        pmm_free_page(p);
+
+    kcounter_add(vm_page_merge_merged, 1);
+    LTRACEF("vmo %p merged page at offset %#" PRIx64 " into %p\n", this, offset, shared);
+
+    return ZX_OK;
+}
+
+size_t VmObjectPaged::CompressedPagesInRange(uint64_t offset, uint64_t len) const {
+    canary_.Assert();
+    AutoLock a(&lock_);
+    uint64_t new_len;
+    if (!TrimRange(offset, len, size_, &new_len))
+        return 0;
+
+    size_t count = 0;
+    for (auto iter = compressed_pages_.lower_bound(offset);
+         iter.IsValid() && iter->offset() < offset + new_len; ++iter) {
+        count++;
+    }
+    return count;
+}
+
+size_t VmObjectPaged::CompressColdPages(uint64_t offset, size_t max, uint min_age,
+                                        uint64_t* next, size_t* compressed) {
+    canary_.Assert();
+    AutoLock a(&lock_);
+
+    *next = UINT64_MAX;
+    *compressed = 0;
+
+    // Pages shared along a clone chain are looked up by more than one VMO;
+    // only compress pages that are ours alone.
+    if (parent_ || children_list_len_ > 0)
+        return 0;
+
+    // Age the pages, noting which ones have gone cold.
+    static constexpr size_t kMaxBatch = 32;
+    uint64_t cold[kMaxBatch];
+    size_t cold_count = 0;
+    size_t aged = 0;
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    max = fbl::min(max, kMaxBatch);
+    page_list_.ForEveryPageInRange(
+        [&](const auto p, uint64_t off) {
+            if (aged == max) {
+                *next = off;
+                return ZX_ERR_STOP;
+            }
+            aged++;
+            first = fbl::min(first, off);
+            last = off;
+
+            if (p->state != VM_PAGE_STATE_OBJECT || p->object.pin_count > 0 || p->object.merged)
+                return ZX_ERR_NEXT;
+            if (p->object.referenced) {
+                p->object.referenced = false;
+                p->object.age = 0;
+                return ZX_ERR_NEXT;
+            }
+            if (p->object.age < UINT8_MAX)
+                p->object.age++;
+            if (p->object.age >= min_age)
+                cold[cold_count++] = off;
+            return ZX_ERR_NEXT;
+        },
+        offset, ROUNDUP_PAGE_SIZE(size_));
+    if (aged == 0)
+        return 0;
+
+    // Unmap what we looked at, so that any use of it from here on goes
+    // through GetPageLocked and marks it referenced again. This also keeps
+    // the cold pages from being written while they are compressed.
+    RangeChangeUpdateLocked(first, last + PAGE_SIZE - first);
+
+    for (size_t i = 0; i < cold_count; i++) {
+        vm_page_t* p = page_list_.GetPage(cold[i]);
+        DEBUG_ASSERT(p);
+        auto page = CompressedPage::Create(cold[i], paddr_to_physmap(vm_page_to_paddr(p)));
+        if (!page)
+            continue;
+        compressed_pages_.insert(fbl::move(page));
+        compressed_count_++;
+        page_list_.FreePage(cold[i]);
+        (*compressed)++;
+    }
+    LTRACEF("vmo %p aged %zu pages, compressed %zu\n", this, aged, *compressed);
+
+    return aged;
+}
+
+zx_status_t VmObjectPaged::DecompressPageLocked(uint64_t offset, list_node* free_list,
+                                                vm_page_t** page_out) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    auto compressed = compressed_pages_.find(offset);
+    DEBUG_ASSERT(compressed.IsValid());
+
+    paddr_t pa;
+    vm_page_t* p = nullptr;
+    if (free_list) {
+        p = list_remove_head_type(free_list, vm_page_t, free.node);
+        if (p)
+            pa = vm_page_to_paddr(p);
+    }
+    if (!p)
+        p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+    if (!p)
+        return ZX_ERR_NO_MEMORY;
+
+    InitializeVmPage(p);
+    compressed->Decompress(paddr_to_physmap(pa));
+
+    zx_status_t status = page_list_.AddPage(p, offset);
+    if (status != ZX_OK) {
+        pmm_free_page(p);
+        return status;
+    }
+    compressed_pages_.erase(compressed);
+    compressed_count_--;
+
+    // nothing could map the offset while it was compressed, so there are no
+    // mappings to update
+
+    LTRACEF("vmo %p decompressed page at offset %#" PRIx64 "\n", this, offset);
+
+    *page_out = p;
+    return ZX_OK;
+}
+
+zx_status_t VmObjectPaged::DecompressRangeLocked(uint64_t offset, uint64_t len) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    for (;;) {
+        auto iter = compressed_pages_.lower_bound(offset);
+        if (!iter.IsValid() || iter->offset() >= offset + len)
+            return ZX_OK;
+        vm_page_t* p;
+        zx_status_t status = DecompressPageLocked(iter->offset(), nullptr, &p);
+        if (status != ZX_OK)
+            return status;
+    }
+}
+
+size_t VmObjectPaged::DropCompressedLocked(uint64_t start, uint64_t end) {
+    size_t dropped = 0;
+    for (;;) {
+        auto iter = compressed_pages_.lower_bound(start);
+        if (!iter.IsValid() || iter->offset() >= end)
+            break;
+        compressed_pages_.erase(iter);
+        dropped++;
+    }
+    compressed_count_ -= dropped;
+    return dropped;
+}
+
 bool VmObjectPaged::AnyPagesPinnedLocked(uint64_t offset, size_t len) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -759,6 +1451,8 @@ zx_status_t VmObjectPaged::ResizeLocked(uint64_t s) {
             // unmap all of the pages in this range on all the mapping regions
             RangeChangeUpdateLocked(start, page_aligned_len);
 
+            DropCompressedLocked(start, end);
+
             // iterate through the pages, freeing them
             while (start < end) {
                 page_list_.FreePage(start);
@@ -915,6 +1609,14 @@ zx_status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, uint pf_flags,
     const uint64_t start_page_offset = ROUNDDOWN(offset, PAGE_SIZE);
     const uint64_t end_page_offset = ROUNDUP(offset + len, PAGE_SIZE);
 
+    // the pages we hand out for writing must be our own
+    if ((options_ & kMergeable) && (pf_flags & VMM_PF_FLAG_WRITE)) {
+        zx_status_t status = UnmergeRangeLocked(start_page_offset,
+                                                end_page_offset - start_page_offset);
+        if (status != ZX_OK)
+            return status;
+    }
+
     uint64_t expected_next_off = start_page_offset;
     zx_status_t status = page_list_.ForEveryPageInRange(
         [&expected_next_off, this, pf_flags, lookup_fn, context,
@@ -10,6 +10,7 @@
 #include <fbl/alloc_checker.h>
 #include <inttypes.h>
 #include <trace.h>
+#include <vm/page_merge.h>
 #include <vm/pmm.h>
 #include <vm/vm.h>
 #include <zircon/types.h>
@@ -135,12 +136,30 @@ zx_status_t VmPageList::FreePage(uint64_t offset) {
             list_.erase(*pln);
         }
 
-        pmm_free_page(page);
+        if (page_merge_release(page))
+            pmm_free_page(page);
     }
 
     return ZX_OK;
 }
 
+vm_page* VmPageList::ReplacePage(uint64_t offset, vm_page* p) {
+    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
+    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
+
+    auto pln = list_.find(node_offset);
+    if (!pln.IsValid()) {
+        return nullptr;
+    }
+
+    auto old = pln->RemovePage(index);
+    if (old) {
+        __UNUSED auto status = pln->AddPage(p, index);
+        DEBUG_ASSERT(status == ZX_OK);
+    }
+    return old;
+}
+
 size_t VmPageList::FreeAllPages() {
     LTRACEF("%p\n", this);
 
@@ -149,10 +168,17 @@ size_t VmPageList::FreeAllPages() {
 
     size_t count = 0;
 
+    size_t shared = 0;
+
     // per page get a reference to the page pointer inside the page list node
     auto per_page_func = [&](vm_page*& p, uint64_t offset) {
-        // add the page to our list and null out the inner node
-        list_add_tail(&list, &p->free.node);
+        // add the page to our list and null out the inner node, unless other
+        // page lists still share it
+        if (page_merge_release(p)) {
+            list_add_tail(&list, &p->free.node);
+        } else {
+            shared++;
+        }
         p = nullptr;
         count++;
         return ZX_ERR_NEXT;
@@ -163,7 +189,7 @@ size_t VmPageList::FreeAllPages() {
 
     // return all the pages to the pmm at once
     __UNUSED auto freed = pmm_free(&list);
-    DEBUG_ASSERT(freed == count);
+    DEBUG_ASSERT(freed + shared == count);
 
     // empty the tree
     list_.clear();
@@ -8,7 +8,11 @@
 #include <err.h>
 #include <fbl/alloc_checker.h>
 #include <fbl/array.h>
+#include <fbl/auto_call.h>
+#include <fbl/auto_lock.h>
+#include <kernel/cmdline.h>
 #include <unittest.h>
+#include <vm/page_merge.h>
 #include <vm/vm.h>
 #include <vm/vm_address_region.h>
 #include <vm/vm_aspace.h>
@@ -72,6 +76,25 @@ static bool pmm_oversized_alloc_test(void* context) {
     END_TEST;
 }
 
+// Makes sure pages held in the per-cpu page caches are still reported as free.
+static bool pmm_free_count_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 16;
+
+    size_t free_before = pmm_count_free_pages();
+    auto count = pmm_alloc_pages(alloc_count, 0, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages count");
+
+    auto ret = pmm_free(&list);
+    EXPECT_EQ(alloc_count, ret, "pmm_free count");
+
+    // freed pages may have landed in a per-cpu cache rather than an arena
+    EXPECT_GE(pmm_count_free_pages(), free_before, "free pages after free");
+    END_TEST;
+}
+
 static uint32_t test_rand(uint32_t seed) {
     return (seed = seed * 1664525 + 1013904223);
 }
@@ -537,6 +560,101 @@ static bool vmo_demand_paged_map_test(void* context) {
     END_TEST;
 }
 
+// Creates a committed vm object, maps it demand paged and checks that a single
+// fault also maps its neighbors, unless the mapping opted out.
+static bool vmo_fault_around_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 16;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    uint64_t committed;
+    status = vmo->CommitRange(0, alloc_size, &committed);
+    REQUIRE_EQ(status, ZX_OK, "committing vm object\n");
+
+    const bool enabled = cmdline_get_uint64("kernel.vm.fault-around-pages", 16) > 1;
+    auto ka = VmAspace::kernel_aspace();
+    static const uint32_t kVmarFlags[] = {0u, VMAR_FLAG_NO_FAULT_AROUND};
+    for (uint32_t vmar_flags : kVmarFlags) {
+        fbl::RefPtr<VmMapping> mapping;
+        status = ka->RootVmar()->CreateVmMapping(0, alloc_size, 0, vmar_flags, vmo, 0,
+                                                 kArchRwFlags, "test", &mapping);
+        REQUIRE_EQ(status, ZX_OK, "mapping object\n");
+
+        // Touch a page in the middle so that any window around it stays
+        // mostly inside the mapping.
+        vaddr_t base = mapping->base();
+        volatile uint8_t* middle = reinterpret_cast<volatile uint8_t*>(base + alloc_size / 2);
+        (void)*middle;
+
+        size_t mapped = 0;
+        for (size_t off = 0; off < alloc_size; off += PAGE_SIZE) {
+            if (ka->arch_aspace().Query(base + off, nullptr, nullptr) == ZX_OK)
+                mapped++;
+        }
+        if (enabled && vmar_flags == 0) {
+            EXPECT_GT(mapped, 1u, "neighbors mapped\n");
+        } else {
+            EXPECT_EQ(mapped, 1u, "only the faulting page mapped\n");
+        }
+
+        status = mapping->Destroy();
+        EXPECT_EQ(ZX_OK, status, "unmapping object\n");
+    }
+    END_TEST;
+}
+
+// Maps a vm object with large pages enabled, faults it in and checks that a
+// decommit in the middle of a large page only unmaps that one page.
+static bool vmo_large_page_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = LARGE_PAGE_SIZE * 2;
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    fbl::RefPtr<VmMapping> mapping;
+    status = ka->RootVmar()->CreateVmMapping(0, alloc_size, 0, VMAR_FLAG_LARGE_PAGES, vmo, 0,
+                                             kArchRwFlags, "test", &mapping);
+    REQUIRE_EQ(status, ZX_OK, "mapping object\n");
+    auto cleanup = fbl::MakeAutoCall([&]() { mapping->Destroy(); });
+
+    const vaddr_t base = mapping->base();
+    EXPECT_TRUE(IS_LARGE_PAGE_ALIGNED(base), "mapping is large page aligned\n");
+
+    volatile uint8_t* first = reinterpret_cast<volatile uint8_t*>(base);
+    volatile uint8_t* last = reinterpret_cast<volatile uint8_t*>(base + LARGE_PAGE_SIZE - 1);
+    *first = 0x5a;
+
+    paddr_t first_pa, last_pa;
+    status = ka->arch_aspace().Query(base, &first_pa, nullptr);
+    EXPECT_EQ(ZX_OK, status, "first page mapped\n");
+    status = ka->arch_aspace().Query(base + LARGE_PAGE_SIZE - PAGE_SIZE, &last_pa, nullptr);
+    if (status != ZX_OK) {
+        // The pmm could not find a contiguous run, so the fault fell back to
+        // a single page and there is nothing more to check.
+        unittest_printf("no large page available, skipping\n");
+    } else {
+        EXPECT_TRUE(IS_LARGE_PAGE_ALIGNED(first_pa), "large page aligned\n");
+        EXPECT_EQ(first_pa + LARGE_PAGE_SIZE - PAGE_SIZE, last_pa, "large page contiguous\n");
+        *last = 0xa5;
+
+        // Decommitting one page must split the large page rather than drop it.
+        size_t decommitted;
+        status = mapping->DecommitRange(PAGE_SIZE, PAGE_SIZE, &decommitted);
+        EXPECT_EQ(ZX_OK, status, "decommit\n");
+        EXPECT_EQ(ZX_ERR_NOT_FOUND, ka->arch_aspace().Query(base + PAGE_SIZE, nullptr, nullptr),
+                  "decommitted page unmapped\n");
+        EXPECT_EQ(ZX_OK, ka->arch_aspace().Query(base, nullptr, nullptr), "first page mapped\n");
+        EXPECT_EQ(ZX_OK, ka->arch_aspace().Query(base + 2 * PAGE_SIZE, nullptr, nullptr),
+                  "next page mapped\n");
+        EXPECT_EQ(0x5a, *first, "first byte kept\n");
+        EXPECT_EQ(0xa5, *last, "last byte kept\n");
+    }
+    END_TEST;
+}
+
 // Creates a vm object, maps it, drops ref before unmapping.
 static bool vmo_dropped_ref_test(void* context) {
     BEGIN_TEST;
@@ -755,6 +873,214 @@ static bool vmo_read_write_smoke_test(void* context) {
     END_TEST;
 }
 
+// Builds a chain of clones, drops every reference but the last clone's and
+// checks that it still sees the same contents once the chain has collapsed.
+static bool vmo_clone_collapse_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 4;
+
+    fbl::AllocChecker ac;
+    fbl::Array<uint8_t> buf(new (&ac) uint8_t[PAGE_SIZE], PAGE_SIZE);
+    REQUIRE_TRUE(ac.check(), "allocating buffer\n");
+
+    auto fill_page = [&buf](fbl::RefPtr<VmObject>& vmo, uint64_t offset, uint8_t value) {
+        memset(buf.get(), value, PAGE_SIZE);
+        size_t written;
+        return vmo->Write(buf.get(), offset, PAGE_SIZE, &written);
+    };
+    auto check_page = [&buf](fbl::RefPtr<VmObject>& vmo, uint64_t offset, uint8_t value) {
+        size_t read;
+        if (vmo->Read(buf.get(), offset, PAGE_SIZE, &read) != ZX_OK || read != PAGE_SIZE)
+            return false;
+        for (size_t i = 0; i < PAGE_SIZE; i++) {
+            if (buf[i] != value)
+                return false;
+        }
+        return true;
+    };
+
+    fbl::RefPtr<VmObject> root;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &root);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    for (uint64_t off = 0; off < alloc_size; off += PAGE_SIZE) {
+        EXPECT_EQ(ZX_OK, fill_page(root, off, 'a'), "writing root\n");
+    }
+
+    fbl::RefPtr<VmObject> middle;
+    status = root->CloneCOW(0, alloc_size, false, &middle);
+    REQUIRE_EQ(status, ZX_OK, "first clone\n");
+    EXPECT_EQ(ZX_OK, fill_page(middle, PAGE_SIZE, 'b'), "writing middle\n");
+
+    fbl::RefPtr<VmObject> leaf;
+    status = middle->CloneCOW(PAGE_SIZE, alloc_size - PAGE_SIZE, false, &leaf);
+    REQUIRE_EQ(status, ZX_OK, "second clone\n");
+    EXPECT_EQ(ZX_OK, fill_page(leaf, 2 * PAGE_SIZE, 'c'), "writing leaf\n");
+
+    EXPECT_EQ(1u, leaf->AllocatedPages(), "leaf pages before collapse\n");
+
+    // Only the leaf refers to the rest of the chain now.  The root stays
+    // alive as the leaf's parent, since it owns the lock they share.
+    VmObject* root_object = root.get();
+    root.reset();
+    middle.reset();
+
+    // The first pass collapses the chain, the second reads the result.
+    for (int pass = 0; pass < 2; pass++) {
+        EXPECT_TRUE(check_page(leaf, 0, 'b'), "page from middle\n");
+        EXPECT_TRUE(check_page(leaf, PAGE_SIZE, 'a'), "page from root\n");
+        EXPECT_TRUE(check_page(leaf, 2 * PAGE_SIZE, 'c'), "page from leaf\n");
+    }
+
+    // The leaf now holds every page it sees and the emptied root is all that
+    // is left of the chain above it.
+    EXPECT_EQ(3u, leaf->AllocatedPages(), "leaf pages after collapse\n");
+    EXPECT_EQ(0u, root_object->AllocatedPages(), "root pages after collapse\n");
+    EXPECT_EQ(1u, root_object->num_children(), "root children after collapse\n");
+    EXPECT_EQ(ZX_OK, fill_page(leaf, PAGE_SIZE, 'd'), "writing absorbed page\n");
+    EXPECT_TRUE(check_page(leaf, PAGE_SIZE, 'd'), "absorbed page written\n");
+    END_TEST;
+}
+
+// Commits a clone whose parent has gone away, so that the lookups fold the
+// parent's pages in rather than copying them.
+static bool vmo_clone_collapse_commit_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 4;
+
+    fbl::RefPtr<VmObject> parent;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, &parent);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    uint64_t committed;
+    status = parent->CommitRange(0, 2 * PAGE_SIZE, &committed);
+    REQUIRE_EQ(status, ZX_OK, "committing parent\n");
+
+    fbl::RefPtr<VmObject> child;
+    status = parent->CloneCOW(0, alloc_size, false, &child);
+    REQUIRE_EQ(status, ZX_OK, "clone\n");
+    parent.reset();
+
+    // Only the two pages the parent never had are new.
+    status = child->CommitRange(0, alloc_size, &committed);
+    EXPECT_EQ(ZX_OK, status, "committing child\n");
+    EXPECT_EQ(2u * PAGE_SIZE, committed, "committed after collapse\n");
+    EXPECT_EQ(4u, child->AllocatedPages(), "child pages after commit\n");
+    END_TEST;
+}
+
+static bool vmo_page_merge_test(void* context) {
+    BEGIN_TEST;
+
+    fbl::AllocChecker ac;
+    fbl::Array<uint8_t> buf(new (&ac) uint8_t[PAGE_SIZE], PAGE_SIZE);
+    REQUIRE_TRUE(ac.check(), "allocating buffer\n");
+
+    auto fill_page = [&buf](fbl::RefPtr<VmObject>& vmo, uint8_t value) {
+        memset(buf.get(), value, PAGE_SIZE);
+        size_t written;
+        return vmo->Write(buf.get(), 0, PAGE_SIZE, &written);
+    };
+    auto check_page = [&buf](fbl::RefPtr<VmObject>& vmo, uint8_t value) {
+        size_t read;
+        if (vmo->Read(buf.get(), 0, PAGE_SIZE, &read) != ZX_OK || read != PAGE_SIZE)
+            return false;
+        for (size_t i = 0; i < PAGE_SIZE; i++) {
+            if (buf[i] != value)
+                return false;
+        }
+        return true;
+    };
+    auto page_pa = [](fbl::RefPtr<VmObject>& vmo) {
+        fbl::AutoLock a(vmo->lock());
+        paddr_t pa = 0;
+        vmo->GetPageLocked(0, 0, nullptr, nullptr, &pa);
+        return pa;
+    };
+
+    fbl::RefPtr<VmObject> vmo1, vmo2;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, VmObjectPaged::kMergeable,
+                                               PAGE_SIZE, &vmo1);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, VmObjectPaged::kMergeable,
+                                   PAGE_SIZE, &vmo2);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    EXPECT_EQ(ZX_OK, fill_page(vmo1, 'm'), "writing first vmo\n");
+    EXPECT_EQ(ZX_OK, fill_page(vmo2, 'm'), "writing second vmo\n");
+
+    // The scanner may need a few passes to get around to both VMOs.
+    for (int pass = 0; pass < 64 && page_pa(vmo1) != page_pa(vmo2); pass++) {
+        page_merge_scan(64);
+    }
+    EXPECT_EQ(page_pa(vmo1), page_pa(vmo2), "pages merged\n");
+    EXPECT_TRUE(check_page(vmo1, 'm'), "merged page reads back\n");
+
+    // Writing either VMO gives it its own page again.
+    EXPECT_EQ(ZX_OK, fill_page(vmo2, 'n'), "writing merged page\n");
+    EXPECT_NE(page_pa(vmo1), page_pa(vmo2), "pages unmerged\n");
+    EXPECT_TRUE(check_page(vmo1, 'm'), "other vmo unchanged\n");
+    EXPECT_TRUE(check_page(vmo2, 'n'), "written vmo changed\n");
+    END_TEST;
+}
+
+static bool vmo_compression_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 4;
+
+    fbl::AllocChecker ac;
+    fbl::Array<uint8_t> buf(new (&ac) uint8_t[alloc_size], alloc_size);
+    REQUIRE_TRUE(ac.check(), "allocating buffer\n");
+
+    // Three pages that compress well, one of them all zeroes, and one that
+    // doesn't compress at all.
+    memset(buf.get(), 'a', PAGE_SIZE);
+    memset(buf.get() + PAGE_SIZE, 0, PAGE_SIZE);
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        buf[2 * PAGE_SIZE + i] = static_cast<uint8_t>(i / 16);
+    }
+    uint32_t x = 12345;
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        x = x * 1103515245 + 12345;
+        buf[3 * PAGE_SIZE + i] = static_cast<uint8_t>(x >> 16);
+    }
+
+    fbl::RefPtr<VmObject> vmo;
+    zx_status_t status = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, VmObjectPaged::kCompressible,
+                                               alloc_size, &vmo);
+    REQUIRE_EQ(status, ZX_OK, "vmobject creation\n");
+    size_t bytes;
+    EXPECT_EQ(ZX_OK, vmo->Write(buf.get(), 0, alloc_size, &bytes), "writing vmo\n");
+    auto paged = static_cast<VmObjectPaged*>(vmo.get());
+
+    // The first pass sees the pages just written as referenced; the second
+    // finds them unreferenced and compresses all but the last.
+    uint64_t next;
+    size_t compressed;
+    EXPECT_EQ(4u, paged->CompressColdPages(0, 4, 1, &next, &compressed), "first pass\n");
+    EXPECT_EQ(0u, compressed, "nothing compressed by first pass\n");
+    EXPECT_EQ(UINT64_MAX, next, "first pass reached the end\n");
+    EXPECT_EQ(4u, paged->CompressColdPages(0, 4, 1, &next, &compressed), "second pass\n");
+    EXPECT_EQ(3u, compressed, "pages compressed by second pass\n");
+    EXPECT_EQ(1u, vmo->AllocatedPages(), "incompressible page kept\n");
+    EXPECT_EQ(3u, vmo->CompressedPages(), "compressed pages\n");
+
+    // Reading brings every page back as it was.
+    fbl::Array<uint8_t> check(new (&ac) uint8_t[alloc_size], alloc_size);
+    REQUIRE_TRUE(ac.check(), "allocating buffer\n");
+    EXPECT_EQ(ZX_OK, vmo->Read(check.get(), 0, alloc_size, &bytes), "reading vmo\n");
+    EXPECT_EQ(0, memcmp(buf.get(), check.get(), alloc_size), "contents survived\n");
+    EXPECT_EQ(4u, vmo->AllocatedPages(), "pages decompressed\n");
+    EXPECT_EQ(0u, vmo->CompressedPages(), "nothing left compressed\n");
+
+    // Compressed pages are dropped along with the range they are in.
+    EXPECT_EQ(4u, paged->CompressColdPages(0, 4, 1, &next, &compressed), "third pass\n");
+    EXPECT_EQ(4u, paged->CompressColdPages(0, 4, 1, &next, &compressed), "fourth pass\n");
+    EXPECT_EQ(3u, compressed, "pages compressed again\n");
+    uint64_t decommitted;
+    EXPECT_EQ(ZX_OK, vmo->DecommitRange(0, alloc_size, &decommitted), "decommit\n");
+    EXPECT_EQ(alloc_size, decommitted, "decommitted everything\n");
+    EXPECT_EQ(0u, vmo->CompressedPages(), "compressed pages dropped\n");
+    END_TEST;
+}
+
 static bool vmo_cache_test(void* context) {
     BEGIN_TEST;
 
@@ -971,6 +1297,7 @@ UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
 VM_UNITTEST(pmm_large_alloc_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
+VM_UNITTEST(pmm_free_count_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
 VM_UNITTEST(multiple_regions_test)
@@ -988,10 +1315,16 @@ VM_UNITTEST(vmo_odd_size_commit_test)
 VM_UNITTEST(vmo_contiguous_commit_test)
 VM_UNITTEST(vmo_precommitted_map_test)
 VM_UNITTEST(vmo_demand_paged_map_test)
+VM_UNITTEST(vmo_fault_around_test)
+VM_UNITTEST(vmo_large_page_test)
 VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
+VM_UNITTEST(vmo_clone_collapse_test)
+VM_UNITTEST(vmo_clone_collapse_commit_test)
+VM_UNITTEST(vmo_page_merge_test)
+VM_UNITTEST(vmo_compression_test)
 VM_UNITTEST(vmo_cache_test)
 VM_UNITTEST(vmo_lookup_test)
 VM_UNITTEST(arch_noncontiguous_map)
@@ -18,8 +18,11 @@
 #include <threads.h>
 
 static zx_status_t ktrace_read(void* ctx, void* buf, size_t count, zx_off_t off, size_t* actual) {
+    // The kernel keeps a cursor into the trace and sequential reads continue
+    // from it, even while tracing is running. Its offset is 32 bits and
+    // wraps, so a long running stream can be read past 4GB.
     uint32_t length;
-    zx_status_t status = zx_ktrace_read(get_root_resource(), buf, off, count, &length);
+    zx_status_t status = zx_ktrace_read(get_root_resource(), buf, (uint32_t)off, count, &length);
     if (status == ZX_OK) {
         *actual = length;
     }
@@ -65,12 +68,15 @@ static zx_status_t ktrace_ioctl(void* ctx, uint32_t op,
         *out_actual = sizeof(uint32_t);
         return ZX_OK;
     }
-    case IOCTL_KTRACE_START: {
+    case IOCTL_KTRACE_START:
+    case IOCTL_KTRACE_START_CIRCULAR: {
         if (cmdlen != sizeof(uint32_t)) {
             return ZX_ERR_INVALID_ARGS;
         }
         uint32_t group_mask = *(uint32_t *)cmd;
-        return zx_ktrace_control(get_root_resource(), KTRACE_ACTION_START, group_mask, NULL);
+        uint32_t action = (op == IOCTL_KTRACE_START) ? KTRACE_ACTION_START
+                                                     : KTRACE_ACTION_START_CIRCULAR;
+        return zx_ktrace_control(get_root_resource(), action, group_mask, NULL);
     }
     case IOCTL_KTRACE_STOP: {
         zx_ktrace_control(get_root_resource(), KTRACE_ACTION_STOP, 0, NULL);
@@ -0,0 +1,38 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <zircon/compiler.h>
+
+__BEGIN_CDECLS
+
+// The kernel publishes its counters as two read-only VMOs, which devmgr
+// installs as /boot/kernel/counters/desc and /boot/kernel/counters/arena.
+//
+// The desc VMO holds a kcounters_desc_t followed by |num_counters|
+// kcounter_desc_entry_t, sorted by name. The arena VMO holds |max_cpus|
+// arrays of |num_counters| values, one array per cpu, so counter i's value
+// on cpu c is ((const uint64_t*)arena)[c * num_counters + i]. The kernel
+// updates the arena in place without atomics; a collector maps it once and
+// sums each counter across the cpus whenever it takes a sample. Get the
+// arena with fdio_get_exact_vmo(), since a copy-on-write clone of it would
+// not see new values.
+
+#define KCOUNTERS_MAGIC         0x52544e434b5a4d21ull // "!MZKCNTR"
+#define KCOUNTER_NAME_LEN       64
+
+typedef struct kcounters_desc {
+    uint64_t magic;
+    uint32_t max_cpus;
+    uint32_t num_counters;
+} kcounters_desc_t;
+
+typedef struct kcounter_desc_entry {
+    // Nul-terminated, and truncated if need be.
+    char name[KCOUNTER_NAME_LEN];
+} kcounter_desc_entry_t;
+
+__END_CDECLS
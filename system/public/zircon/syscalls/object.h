@@ -149,6 +149,11 @@ typedef struct zx_info_task_stats {
     //
     // This number is strictly smaller than mem_shared_bytes.
     size_t mem_scaled_shared_bytes;
+
+    // Memory of this task that the kernel holds compressed rather than
+    // committed, counted at its uncompressed size. It is not included in the
+    // fields above, and is committed again when next touched.
+    size_t mem_compressed_bytes;
 } zx_info_task_stats_t;
 
 typedef struct zx_info_vmar {
@@ -12,6 +12,9 @@ __BEGIN_CDECLS
 #define ZX_WAIT_ASYNC_ONCE          0u
 #define ZX_WAIT_ASYNC_REPEATING     1u
 
+// Most packets zx_port_wait_many() returns in one call.
+#define ZX_PORT_WAIT_MANY_MAX_PACKETS 16u
+
 // packet types.
 #define ZX_PKT_TYPE_USER            0x00u
 #define ZX_PKT_TYPE_SIGNAL_ONE      0x01u
@@ -170,6 +170,16 @@ typedef struct {
     uint32_t rd_num_handles;
 } zx_channel_call_args_t;
 
+// One message for zx_channel_write_many() or zx_channel_read_many().  For
+// reads, |num_bytes| and |num_handles| give the room in |bytes| and |handles|
+// and are updated to the size of the message read.
+typedef struct {
+    void* bytes;
+    zx_handle_t* handles;
+    uint32_t num_bytes;
+    uint32_t num_handles;
+} zx_channel_msg_t;
+
 // Maximum number of wait items allowed for zx_object_wait_many()
 // TODO(ZX-1349) Re-lower this.
 #define ZX_WAIT_MANY_MAX_ITEMS 16
@@ -215,6 +225,9 @@ typedef uint32_t zx_rights_t;
     (ZX_RIGHT_GET_POLICY | ZX_RIGHT_SET_POLICY)
 
 
+// VM Object creation options
+#define ZX_VMO_MERGEABLE                 1u
+
 // VM Object opcodes
 #define ZX_VMO_OP_COMMIT                 1u
 #define ZX_VMO_OP_DECOMMIT               2u
@@ -241,6 +254,8 @@ typedef uint32_t zx_rights_t;
 #define ZX_VM_FLAG_CAN_MAP_WRITE      (1u << 8)
 #define ZX_VM_FLAG_CAN_MAP_EXECUTE    (1u << 9)
 #define ZX_VM_FLAG_MAP_RANGE          (1u << 10)
+#define ZX_VM_FLAG_NO_FAULT_AROUND    (1u << 11)
+#define ZX_VM_FLAG_ALLOW_LARGE_PAGES  (1u << 12)
 
 // clock ids
 #define ZX_CLOCK_MONOTONIC        (0u)
@@ -277,6 +292,7 @@ typedef uint64_t zx_off_t;
 
 #define ZX_CHANNEL_MAX_MSG_BYTES            65536u
 #define ZX_CHANNEL_MAX_MSG_HANDLES          64u
+#define ZX_CHANNEL_MAX_MSGS_PER_CALL        16u
 
 // Socket options and limits.
 // These options can be passed to zx_socket_write()
@@ -9,8 +9,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <launchpad/launchpad.h>
 #include <zircon/compiler.h>
+#include <zircon/process.h>
+#include <zircon/processargs.h>
 #include <zircon/syscalls.h>
 #include <fbl/algorithm.h>
 #include <fbl/unique_ptr.h>
@@ -112,9 +116,207 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
            test_args.size, test_args.handles, test_args.queue, its_per_second);
 }
 
+// Measures writing and reading |batch| messages of |size| bytes at a time.
+// A batch of zero uses one zx_channel_write() and zx_channel_read() per
+// message, for comparison with zx_channel_write_many() and
+// zx_channel_read_many().
+void do_batch_test(uint32_t duration, uint32_t size, uint32_t batch) {
+    __UNUSED zx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    zx_handle_t mp[2] = {ZX_HANDLE_INVALID, ZX_HANDLE_INVALID};
+    status = zx_channel_create(0u, &mp[0], &mp[1]);
+    assert(status == ZX_OK);
+
+    const uint32_t msgs_per_call = batch ? batch : 1u;
+    fbl::unique_ptr<uint8_t[]> data(new uint8_t[fbl::max(size, 1u) * msgs_per_call]);
+    memset(data.get(), 0, fbl::max(size, 1u) * msgs_per_call);
+    zx_channel_msg_t wr_msgs[ZX_CHANNEL_MAX_MSGS_PER_CALL] = {};
+    zx_channel_msg_t rd_msgs[ZX_CHANNEL_MAX_MSGS_PER_CALL] = {};
+    for (uint32_t i = 0; i < msgs_per_call; i++) {
+        wr_msgs[i].bytes = data.get() + i * size;
+        wr_msgs[i].num_bytes = size;
+        rd_msgs[i].bytes = data.get() + i * size;
+    }
+
+    static constexpr uint32_t big_it_size = 10000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++) {
+            if (batch == 0u) {
+                status = zx_channel_write(mp[0], 0u, data.get(), size, nullptr, 0u);
+                assert(status == ZX_OK);
+
+                uint32_t r_size;
+                status = zx_channel_read(mp[1], 0u, data.get(), nullptr, size, 0u,
+                                         &r_size, nullptr);
+                assert(status == ZX_OK);
+                assert(r_size == size);
+                continue;
+            }
+
+            status = zx_channel_write_many(mp[0], 0u, wr_msgs, batch);
+            assert(status == ZX_OK);
+
+            for (uint32_t j = 0; j < batch; j++)
+                rd_msgs[j].num_bytes = size;
+            uint32_t actual;
+            status = zx_channel_read_many(mp[1], 0u, rd_msgs, batch, &actual);
+            assert(status == ZX_OK);
+            assert(actual == batch);
+        }
+
+        end_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    status = zx_handle_close(mp[0]);
+    assert(status == ZX_OK);
+    status = zx_handle_close(mp[1]);
+    assert(status == ZX_OK);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double msgs_per_second =
+        static_cast<double>(big_its) * big_it_size * msgs_per_call / real_duration;
+    if (batch == 0u) {
+        printf("write/read %" PRIu32 " bytes, one message per call: "
+                   "%.0f messages/second\n",
+               size, msgs_per_second);
+    } else {
+        printf("write/read %" PRIu32 " bytes, batches of %2" PRIu32 ": "
+                   "%.0f messages/second\n",
+               size, batch, msgs_per_second);
+    }
+}
+
+// Sweeps the batch size from one message to the most a call can carry.
+void do_batch_sweep(uint32_t duration, uint32_t size) {
+    do_batch_test(duration, size, 0u);
+    for (uint32_t batch = 1u; batch <= ZX_CHANNEL_MAX_MSGS_PER_CALL; batch *= 2)
+        do_batch_test(duration, size, batch);
+}
+
+constexpr char kEchoServerArg[] = "--echo-server";
+
+// Runs in the child process started by |do_round_trip_test()|: echoes every
+// message received on the channel passed as PA_USER0 until the peer closes.
+int run_echo_server() {
+    zx_handle_t channel = zx_get_startup_handle(PA_HND(PA_USER0, 0));
+    if (channel == ZX_HANDLE_INVALID)
+        return EXIT_FAILURE;
+
+    fbl::unique_ptr<uint8_t[]> data(new uint8_t[ZX_CHANNEL_MAX_MSG_BYTES]);
+    for (;;) {
+        uint32_t r_size;
+        zx_status_t status = zx_channel_read(channel, 0u, data.get(), nullptr,
+                                             ZX_CHANNEL_MAX_MSG_BYTES, 0u, &r_size, nullptr);
+        if (status == ZX_ERR_SHOULD_WAIT) {
+            status = zx_object_wait_one(channel, ZX_CHANNEL_READABLE | ZX_CHANNEL_PEER_CLOSED,
+                                        ZX_TIME_INFINITE, nullptr);
+            if (status != ZX_OK)
+                break;
+            continue;
+        }
+        if (status != ZX_OK)
+            break;
+        if (zx_channel_write(channel, 0u, data.get(), r_size, nullptr, 0u) != ZX_OK)
+            break;
+    }
+
+    zx_handle_close(channel);
+    return EXIT_SUCCESS;
+}
+
+// Measures zx_channel_call() round trips to an echo server running in another
+// process, so that every round trip switches address spaces twice.
+void do_round_trip_test(const char* argv0, uint32_t duration, uint32_t size) {
+    __UNUSED zx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    zx_handle_t mp[2] = {ZX_HANDLE_INVALID, ZX_HANDLE_INVALID};
+    status = zx_channel_create(0u, &mp[0], &mp[1]);
+    assert(status == ZX_OK);
+
+    launchpad_t* lp;
+    if (launchpad_create(ZX_HANDLE_INVALID, "channel-perf-echo", &lp) != ZX_OK) {
+        fprintf(stderr, "failed to create echo server launchpad\n");
+        exit(EXIT_FAILURE);
+    }
+    if (launchpad_load_from_file(lp, argv0) != ZX_OK) {
+        fprintf(stderr, "failed to load echo server from %s: %s\n",
+                argv0, launchpad_error_message(lp));
+        launchpad_destroy(lp);
+        exit(EXIT_FAILURE);
+    }
+    const char* args[] = {argv0, kEchoServerArg};
+    launchpad_set_args(lp, fbl::count_of(args), args);
+    launchpad_clone(lp, LP_CLONE_ALL);
+    launchpad_add_handle(lp, mp[1], PA_HND(PA_USER0, 0));
+    zx_handle_t proc;
+    const char* errmsg;
+    if (launchpad_go(lp, &proc, &errmsg) != ZX_OK) {
+        fprintf(stderr, "failed to start echo server: %s\n", errmsg);
+        exit(EXIT_FAILURE);
+    }
+
+    // zx_channel_call() uses the first four bytes as the transaction id.
+    size = fbl::max(size, static_cast<uint32_t>(sizeof(zx_txid_t)));
+    fbl::unique_ptr<uint8_t[]> wr_data(new uint8_t[size]);
+    fbl::unique_ptr<uint8_t[]> rd_data(new uint8_t[size]);
+    memset(wr_data.get(), 0, size);
+
+    zx_channel_call_args_t args_call = {};
+    args_call.wr_bytes = wr_data.get();
+    args_call.wr_num_bytes = size;
+    args_call.rd_bytes = rd_data.get();
+    args_call.rd_num_bytes = size;
+
+    static constexpr uint32_t big_it_size = 1000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++) {
+            uint32_t r_size;
+            uint32_t r_handles;
+            status = zx_channel_call(mp[0], 0u, ZX_TIME_INFINITE, &args_call,
+                                     &r_size, &r_handles, nullptr);
+            assert(status == ZX_OK);
+            assert(r_size == size);
+        }
+
+        end_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    // Closing our end makes the echo server exit.
+    status = zx_handle_close(mp[0]);
+    assert(status == ZX_OK);
+    status = zx_object_wait_one(proc, ZX_PROCESS_TERMINATED, ZX_TIME_INFINITE, nullptr);
+    assert(status == ZX_OK);
+    status = zx_handle_close(proc);
+    assert(status == ZX_OK);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
+    printf("call %" PRIu32 " bytes to another process: %.0f round trips/second\n",
+           size, its_per_second);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
+    if (argc == 2 && !strcmp(argv[1], kEchoServerArg))
+        return run_echo_server();
+
     static constexpr char help[] =
         "Usage: %s [options ...]\n"
         "\n"
@@ -122,6 +324,8 @@ int main(int argc, char** argv) {
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
         "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -r    measure round trips to another process (uses -S, ignores -H/-Q)\n"
+        "  -b    sweep the number of messages per call (uses -S, ignores -H/-Q)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
@@ -129,6 +333,8 @@ int main(int argc, char** argv) {
         "  -Q N  set message pre-queue count to N messages (default: 0)\n";
 
     bool run_suite = false;  // -o/-s
+    bool round_trip = false; // -r
+    bool batch = false;      // -b
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
     // Ignored when running a suite:
@@ -139,7 +345,7 @@ int main(int argc, char** argv) {
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hosrbn:d:S:H:Q:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -161,6 +367,12 @@ int main(int argc, char** argv) {
             case 's':
                 run_suite = true;
                 break;
+            case 'r':
+                round_trip = true;
+                break;
+            case 'b':
+                batch = true;
+                break;
             case 'n':
                 assert(optarg);
                 repeats = value;
@@ -217,6 +429,18 @@ int main(int argc, char** argv) {
             };
             for (size_t i = 0; i < fbl::count_of(suite); i++)
                 do_test(duration, suite[i]);
+
+            static constexpr uint32_t round_trip_suite[] = {16, 100, 1000};
+            for (size_t i = 0; i < fbl::count_of(round_trip_suite); i++)
+                do_round_trip_test(argv[0], duration, round_trip_suite[i]);
+
+            static constexpr uint32_t batch_suite[] = {16, 100, 1000};
+            for (size_t i = 0; i < fbl::count_of(batch_suite); i++)
+                do_batch_sweep(duration, batch_suite[i]);
+        } else if (batch) {
+            do_batch_sweep(duration, test_args.size);
+        } else if (round_trip) {
+            do_round_trip_test(argv[0], duration, test_args.size);
         } else {
             do_test(duration, test_args);
         }
@@ -0,0 +1,168 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures how handle-taking syscalls scale with the number of threads in
+// one process. Each thread repeatedly calls zx_object_wait_one() with an
+// already-satisfied signal, so nearly all of the time goes to the syscall
+// path and resolving the handle.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <zircon/compiler.h>
+#include <zircon/syscalls.h>
+#include <fbl/atomic.h>
+#include <fbl/unique_ptr.h>
+
+namespace {
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+struct TestState {
+    fbl::atomic<uint32_t> ready;
+    fbl::atomic<bool> go;
+    fbl::atomic<bool> stop;
+};
+
+struct Worker {
+    TestState* state;
+    zx_handle_t event;
+    uint64_t calls;
+};
+
+int worker_thread(void* arg) {
+    auto worker = static_cast<Worker*>(arg);
+    TestState* state = worker->state;
+
+    state->ready.fetch_add(1);
+    while (!state->go.load())
+        ;
+
+    uint64_t calls = 0;
+    while (!state->stop.load(fbl::memory_order_relaxed)) {
+        for (uint32_t i = 0; i < 1000; i++) {
+            zx_signals_t observed;
+            __UNUSED zx_status_t status =
+                zx_object_wait_one(worker->event, ZX_EVENT_SIGNALED, 0u, &observed);
+            assert(status == ZX_OK);
+        }
+        calls += 1000;
+    }
+    worker->calls = calls;
+    return 0;
+}
+
+zx_handle_t make_signaled_event() {
+    zx_handle_t event;
+    __UNUSED zx_status_t status = zx_event_create(0u, &event);
+    assert(status == ZX_OK);
+    status = zx_object_signal(event, 0u, ZX_EVENT_SIGNALED);
+    assert(status == ZX_OK);
+    return event;
+}
+
+// Runs |num_threads| threads for |duration| seconds. If |shared| is set they
+// all use one handle, otherwise each thread has its own.
+void do_test(uint32_t duration, uint32_t num_threads, bool shared) {
+    TestState state;
+    state.ready.store(0);
+    state.go.store(false);
+    state.stop.store(false);
+
+    zx_handle_t shared_event = make_signaled_event();
+
+    fbl::unique_ptr<Worker[]> workers(new Worker[num_threads]);
+    fbl::unique_ptr<thrd_t[]> threads(new thrd_t[num_threads]);
+    for (uint32_t i = 0; i < num_threads; i++) {
+        workers[i].state = &state;
+        workers[i].event = shared ? shared_event : make_signaled_event();
+        workers[i].calls = 0;
+        __UNUSED int ret = thrd_create(&threads[i], worker_thread, &workers[i]);
+        assert(ret == thrd_success);
+    }
+    while (state.ready.load() != num_threads)
+        ;
+
+    zx_time_t start_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    state.go.store(true);
+    zx_nanosleep(zx_deadline_after(ZX_SEC(duration)));
+    state.stop.store(true);
+
+    uint64_t calls = 0;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        thrd_join(threads[i], nullptr);
+        calls += workers[i].calls;
+        if (!shared)
+            zx_handle_close(workers[i].event);
+    }
+    zx_time_t end_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    zx_handle_close(shared_event);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double calls_per_second = static_cast<double>(calls) / real_duration;
+    printf("%3" PRIu32 " threads, %s handle%s: %.0f calls/second (%.0f per thread)\n",
+           num_threads, shared ? "shared" : "private", shared ? "" : "s",
+           calls_per_second, calls_per_second / num_threads);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -d N  set test duration to N seconds (default: 2)\n"
+        "  -t N  run with up to N threads (default: twice the number of cpus)\n";
+
+    uint32_t duration = 2;                                // -d
+    uint32_t max_threads = 2 * zx_system_get_num_cpus();  // -t
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hd:t:")) != -1) {
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v == 0 || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'd':
+                duration = value;
+                break;
+            case 't':
+                max_threads = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    for (uint32_t n = 1; n <= max_threads; n *= 2)
+        do_test(duration, n, false);
+    for (uint32_t n = 1; n <= max_threads; n *= 2)
+        do_test(duration, n, true);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures how many packets per second one thread can take from a port that
+// another thread keeps fed, dequeuing them one at a time with zx_port_wait()
+// and in batches of increasing size with zx_port_wait_many().
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <zircon/compiler.h>
+#include <zircon/syscalls.h>
+#include <zircon/syscalls/port.h>
+#include <fbl/atomic.h>
+
+namespace {
+
+// The producer stops queueing while this many packets are in the port.
+constexpr uint64_t kMaxOutstanding = 1024;
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+struct TestState {
+    zx_handle_t port;
+    fbl::atomic<uint64_t> queued;
+    fbl::atomic<uint64_t> dequeued;
+    fbl::atomic<bool> stop;
+};
+
+int producer_thread(void* arg) {
+    auto state = static_cast<TestState*>(arg);
+
+    zx_port_packet_t packet = {};
+    packet.type = ZX_PKT_TYPE_USER;
+    while (!state->stop.load(fbl::memory_order_relaxed)) {
+        uint64_t queued = state->queued.load(fbl::memory_order_relaxed);
+        if (queued - state->dequeued.load(fbl::memory_order_relaxed) >= kMaxOutstanding) {
+            thrd_yield();
+            continue;
+        }
+        packet.key = queued;
+        __UNUSED zx_status_t status = zx_port_queue(state->port, &packet, 1u);
+        assert(status == ZX_OK);
+        state->queued.store(queued + 1, fbl::memory_order_relaxed);
+    }
+    return 0;
+}
+
+// Dequeues packets for |duration| seconds, up to |batch| per call. A batch of
+// zero uses zx_port_wait().
+void do_test(uint32_t duration, size_t batch) {
+    TestState state;
+    __UNUSED zx_status_t status = zx_port_create(0u, &state.port);
+    assert(status == ZX_OK);
+    state.queued.store(0);
+    state.dequeued.store(0);
+    state.stop.store(false);
+
+    thrd_t producer;
+    __UNUSED int ret = thrd_create(&producer, producer_thread, &state);
+    assert(ret == thrd_success);
+
+    zx_port_packet_t packets[ZX_PORT_WAIT_MANY_MAX_PACKETS];
+    zx_time_t start_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    zx_time_t end_ns = start_ns + ZX_SEC(duration);
+    zx_time_t now_ns = start_ns;
+    uint64_t dequeued = 0;
+    uint64_t calls = 0;
+    while (now_ns < end_ns) {
+        for (uint32_t i = 0; i < 1000; i++) {
+            size_t actual = 1u;
+            if (batch == 0u) {
+                status = zx_port_wait(state.port, ZX_TIME_INFINITE, packets, 1u);
+            } else {
+                status = zx_port_wait_many(state.port, ZX_TIME_INFINITE, packets, batch,
+                                           &actual);
+            }
+            assert(status == ZX_OK);
+            dequeued += actual;
+            state.dequeued.store(dequeued, fbl::memory_order_relaxed);
+        }
+        calls += 1000;
+        now_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    }
+
+    state.stop.store(true);
+    thrd_join(producer, nullptr);
+    zx_handle_close(state.port);
+
+    double real_duration = static_cast<double>(now_ns - start_ns) / 1000000000.0;
+    double packets_per_second = static_cast<double>(dequeued) / real_duration;
+    if (batch == 0u) {
+        printf("zx_port_wait:          %.0f packets/second\n", packets_per_second);
+    } else {
+        printf("zx_port_wait_many(%2zu): %.0f packets/second (%.2f packets per call)\n",
+               batch, packets_per_second, static_cast<double>(dequeued) / calls);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -d N  set test duration to N seconds (default: 2)\n";
+
+    uint32_t duration = 2;  // -d
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hd:")) != -1) {
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v == 0 || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'd':
+                duration = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    do_test(duration, 0u);
+    for (size_t batch = 1u; batch <= ZX_PORT_WAIT_MANY_MAX_PACKETS; batch *= 2)
+        do_test(duration, batch);
+
+    return EXIT_SUCCESS;
+}
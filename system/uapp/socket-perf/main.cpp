@@ -0,0 +1,166 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures how many bytes per second one thread can read from a stream socket
+// that another thread keeps writing to, for a range of write sizes. Writes
+// larger than a couple of KB go through the kernel's page-sized buffers.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <zircon/compiler.h>
+#include <zircon/syscalls.h>
+#include <fbl/atomic.h>
+#include <fbl/unique_ptr.h>
+
+namespace {
+
+constexpr size_t kReadSize = 1024 * 1024;
+constexpr size_t kMaxWriteSize = 1024 * 1024;
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+struct TestState {
+    zx_handle_t socket;
+    size_t write_size;
+    fbl::atomic<bool> stop;
+};
+
+// Writes |write_size| bytes per call until told to stop or the reader goes
+// away. A short write is finished off before starting the next one.
+int writer_thread(void* arg) {
+    auto state = static_cast<TestState*>(arg);
+
+    fbl::unique_ptr<uint8_t[]> buffer(new uint8_t[state->write_size]);
+    for (size_t i = 0; i < state->write_size; i++)
+        buffer[i] = static_cast<uint8_t>(i);
+
+    size_t pos = 0;
+    while (!state->stop.load(fbl::memory_order_relaxed)) {
+        size_t actual = 0;
+        zx_status_t status = zx_socket_write(state->socket, 0u, buffer.get() + pos,
+                                             state->write_size - pos, &actual);
+        if (status == ZX_ERR_SHOULD_WAIT) {
+            zx_signals_t pending;
+            status = zx_object_wait_one(state->socket,
+                                        ZX_SOCKET_WRITABLE | ZX_SOCKET_PEER_CLOSED,
+                                        ZX_TIME_INFINITE, &pending);
+            if (status != ZX_OK || (pending & ZX_SOCKET_PEER_CLOSED))
+                break;
+            continue;
+        }
+        if (status != ZX_OK)
+            break;
+        pos = (pos + actual) % state->write_size;
+    }
+    return 0;
+}
+
+// Reads for |duration| seconds while another thread writes |write_size|
+// bytes at a time.
+void do_test(uint32_t duration, size_t write_size) {
+    zx_handle_t reader;
+    TestState state;
+    __UNUSED zx_status_t status = zx_socket_create(ZX_SOCKET_STREAM, &reader, &state.socket);
+    assert(status == ZX_OK);
+    state.write_size = write_size;
+    state.stop.store(false);
+
+    thrd_t writer;
+    __UNUSED int ret = thrd_create(&writer, writer_thread, &state);
+    assert(ret == thrd_success);
+
+    fbl::unique_ptr<uint8_t[]> buffer(new uint8_t[kReadSize]);
+    zx_time_t start_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    zx_time_t end_ns = start_ns + ZX_SEC(duration);
+    zx_time_t now_ns = start_ns;
+    uint64_t bytes = 0;
+    while (now_ns < end_ns) {
+        size_t actual = 0;
+        status = zx_socket_read(reader, 0u, buffer.get(), kReadSize, &actual);
+        if (status == ZX_ERR_SHOULD_WAIT) {
+            status = zx_object_wait_one(reader, ZX_SOCKET_READABLE, end_ns, nullptr);
+            assert(status == ZX_OK || status == ZX_ERR_TIMED_OUT);
+        } else {
+            assert(status == ZX_OK);
+            bytes += actual;
+        }
+        now_ns = zx_time_get(ZX_CLOCK_MONOTONIC);
+    }
+
+    // Closing our end wakes the writer if it is waiting for room.
+    state.stop.store(true);
+    zx_handle_close(reader);
+    thrd_join(writer, nullptr);
+    zx_handle_close(state.socket);
+
+    double real_duration = static_cast<double>(now_ns - start_ns) / 1000000000.0;
+    printf("write size %7zu: %10.1f MB/second\n",
+           write_size, static_cast<double>(bytes) / real_duration / (1024.0 * 1024.0));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -d N  set test duration to N seconds (default: 2)\n"
+        "  -s N  only test writes of N bytes (default: 64 bytes to 1MB)\n";
+
+    uint32_t duration = 2;  // -d
+    uint32_t size = 0;      // -s
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+hd:s:")) != -1) {
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v == 0 || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'd':
+                duration = value;
+                break;
+            case 's':
+                if (value > kMaxWriteSize)
+                    argument_error(argv[0], "write size too large");
+                size = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+
+    if (size != 0) {
+        do_test(duration, size);
+    } else {
+        for (size_t write_size = 64u; write_size <= kMaxWriteSize; write_size *= 4)
+            do_test(duration, write_size);
+    }
+
+    return EXIT_SUCCESS;
+}
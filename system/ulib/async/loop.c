@@ -7,10 +7,12 @@
 #include <assert.h>
 #include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <zircon/assert.h>
 #include <zircon/listnode.h>
 #include <zircon/syscalls.h>
+#include <zircon/syscalls/port.h>
 
 #include <async/receiver.h>
 #include <async/task.h>
@@ -19,6 +21,9 @@
 // The port wait key associated with the dispatcher's control messages.
 #define KEY_CONTROL (0u)
 
+// The most packets taken from the port by one batched wait.
+#define PACKET_BATCH_SIZE (16u)
+
 static zx_status_t async_loop_begin_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait);
 static zx_status_t async_loop_post_task(async_t* async, async_task_t* task);
@@ -47,15 +52,24 @@ typedef struct async_loop {
     _Atomic async_loop_state_t state;
     atomic_uint active_threads; // number of active dispatch threads
 
-    mtx_t lock; // guards the lists and the dispatching tasks flag
+    mtx_t lock; // guards the lists, the pending packets and the dispatching tasks flag
     bool dispatching_tasks; // true while the loop is busy dispatching tasks
     list_node_t wait_list; // most recently added first
     list_node_t task_list; // pending tasks, earliest deadline first
     list_node_t due_list; // due tasks, earliest deadline first
     list_node_t thread_list; // earliest created thread first
+
+    // Packets taken from the port by a batched wait but not yet dispatched,
+    // earliest first: |pending[pending_head]| through |pending_count| entries.
+    size_t pending_head;
+    size_t pending_count;
+    zx_port_packet_t pending[PACKET_BATCH_SIZE];
 } async_loop_t;
 
 static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline);
+static zx_status_t async_loop_next_packet(async_loop_t* loop, zx_time_t deadline,
+                                          zx_port_packet_t* out_packet);
+static bool async_loop_drop_pending_locked(async_loop_t* loop, uint64_t key);
 static zx_status_t async_loop_dispatch_wait(async_loop_t* loop, async_wait_t* wait,
                                             zx_status_t status, const zx_packet_signal_t* signal);
 static zx_status_t async_loop_dispatch_tasks(async_loop_t* loop);
@@ -220,7 +234,7 @@ static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
         return ZX_ERR_CANCELED;
 
     zx_port_packet_t packet;
-    zx_status_t status = zx_port_wait(loop->port, deadline, &packet, 0);
+    zx_status_t status = async_loop_next_packet(loop, deadline, &packet);
     if (status != ZX_OK)
         return status;
 
@@ -252,6 +266,64 @@ static zx_status_t async_loop_run_once(async_loop_t* loop, zx_time_t deadline) {
     return ZX_ERR_INTERNAL;
 }
 
+static zx_status_t async_loop_next_packet(async_loop_t* loop, zx_time_t deadline,
+                                          zx_port_packet_t* out_packet) {
+    // Packets left over from an earlier batch come first.
+    mtx_lock(&loop->lock);
+    if (loop->pending_count) {
+        *out_packet = loop->pending[loop->pending_head++];
+        loop->pending_count--;
+        mtx_unlock(&loop->lock);
+        return ZX_OK;
+    }
+    mtx_unlock(&loop->lock);
+
+    // With several threads running the loop, take one packet at a time so
+    // the rest stay in the port where any idle thread can pick them up.
+    if (atomic_load_explicit(&loop->active_threads, memory_order_acquire) > 1u)
+        return zx_port_wait(loop->port, deadline, out_packet, 0);
+
+    zx_port_packet_t packets[PACKET_BATCH_SIZE];
+    size_t count;
+    zx_status_t status = zx_port_wait_many(loop->port, deadline, packets, countof(packets),
+                                           &count);
+    if (status != ZX_OK)
+        return status;
+
+    // Stash the rest before dispatching the first, so that a handler which
+    // cancels a wait whose packet is among them finds it there.  Only a thread
+    // running the loop alone gets here, so nobody else has stashed any.
+    *out_packet = packets[0];
+    if (count > 1u) {
+        mtx_lock(&loop->lock);
+        ZX_DEBUG_ASSERT(loop->pending_count == 0u);
+        memcpy(loop->pending, &packets[1], (count - 1u) * sizeof(zx_port_packet_t));
+        loop->pending_head = 0u;
+        loop->pending_count = count - 1u;
+        mtx_unlock(&loop->lock);
+    }
+    return ZX_OK;
+}
+
+// Removes the wait completion packet for |key| from the pending packets, if
+// there is one.
+static bool async_loop_drop_pending_locked(async_loop_t* loop, uint64_t key) {
+    bool dropped = false;
+    size_t end = loop->pending_head + loop->pending_count;
+    size_t next = loop->pending_head;
+    for (size_t i = loop->pending_head; i < end; i++) {
+        if (loop->pending[i].key == key && loop->pending[i].type == ZX_PKT_TYPE_SIGNAL_ONE) {
+            dropped = true;
+            continue;
+        }
+        if (next != i)
+            loop->pending[next] = loop->pending[i];
+        next++;
+    }
+    loop->pending_count = next - loop->pending_head;
+    return dropped;
+}
+
 static zx_status_t async_loop_dispatch_wait(async_loop_t* loop, async_wait_t* wait,
                                             zx_status_t status, const zx_packet_signal_t* signal) {
     async_loop_invoke_prologue(loop);
@@ -456,13 +528,16 @@ static zx_status_t async_loop_cancel_wait(async_t* async, async_wait_t* wait) {
     // Note: We need to process cancelations even while the loop is being
     // destroyed in case the client is counting on the handler not being
     // invoked again past this point.
+    // The packet may also have been taken from the port already by a batched
+    // wait and be pending dispatch.
     zx_status_t status = zx_port_cancel(loop->port, wait->object,
                                         (uintptr_t)wait);
-    if (status == ZX_OK && (wait->flags & ASYNC_FLAG_HANDLE_SHUTDOWN)) {
-        mtx_lock(&loop->lock);
+    mtx_lock(&loop->lock);
+    if (status == ZX_ERR_NOT_FOUND && async_loop_drop_pending_locked(loop, (uintptr_t)wait))
+        status = ZX_OK;
+    if (status == ZX_OK && (wait->flags & ASYNC_FLAG_HANDLE_SHUTDOWN))
         list_delete(wait_to_node(wait));
-        mtx_unlock(&loop->lock);
-    }
+    mtx_unlock(&loop->lock);
     return status;
 }
 
@@ -4,7 +4,10 @@
 
 #pragma once
 
+#include <threads.h>
+
 #include <zircon/compiler.h>
+#include <zircon/syscalls/port.h>
 #include <zircon/types.h>
 
 __BEGIN_CDECLS
@@ -19,8 +22,18 @@ struct port_handler {
     zx_status_t (*func)(port_handler_t* ph, zx_signals_t signals, uint32_t evt);
 };
 
+// The most packets port_dispatch() takes from the port at once.
+#define PORT_DISPATCH_BATCH 16
+
 typedef struct {
     zx_handle_t handle;
+
+    // Packets port_dispatch() has taken from the port but not yet
+    // handled, earliest first.
+    mtx_t lock;
+    size_t pending_head;
+    size_t pending_count;
+    zx_port_packet_t pending[PORT_DISPATCH_BATCH];
 } port_t;
 
 // Initialize a port
@@ -38,6 +51,10 @@ zx_status_t port_wait_repeating(port_t* port, port_handler_t* ph);
 // If the port wait returns and error or timeout, returns that.
 // If once is true, returns ZX_OK after handling a packet.
 //
+// Packets are taken from the port in batches; those not yet
+// handled are kept in the port_t for the next call.  Only one
+// thread may dispatch a port at a time.
+//
 // If a packet is received, the callback for the port handler
 // is invoked.  If that callback returns ZX_OK, port_wait()
 // is invoked on that port handler again.
@@ -21,6 +21,9 @@
 #endif
 
 zx_status_t port_init(port_t* port) {
+    mtx_init(&port->lock, mtx_plain);
+    port->pending_head = 0;
+    port->pending_count = 0;
     zx_status_t r = zx_port_create(0, &port->handle);
     zprintf("port_init(%p) port=%x\n", port, port->handle);
     return r;
@@ -43,9 +46,35 @@ zx_status_t port_wait_repeating(port_t* port, port_handler_t* ph) {
 }
 
 
+// Removes the signal packets for |ph| from those port_dispatch() has taken
+// from the port but not yet handled.
+static bool port_drop_pending(port_t* port, port_handler_t* ph) {
+    bool dropped = false;
+    mtx_lock(&port->lock);
+    size_t end = port->pending_head + port->pending_count;
+    size_t next = port->pending_head;
+    for (size_t i = port->pending_head; i < end; i++) {
+        zx_port_packet_t* pkt = &port->pending[i];
+        if (pkt->key == (uintptr_t)ph && pkt->type != ZX_PKT_TYPE_USER) {
+            dropped = true;
+            continue;
+        }
+        if (next != i) {
+            port->pending[next] = *pkt;
+        }
+        next++;
+    }
+    port->pending_count = next - port->pending_head;
+    mtx_unlock(&port->lock);
+    return dropped;
+}
+
 zx_status_t port_cancel(port_t* port, port_handler_t* ph) {
     zx_status_t r = zx_port_cancel(port->handle, ph->handle,
                                    (uint64_t)(uintptr_t)ph);
+    if (port_drop_pending(port, ph) && (r == ZX_ERR_NOT_FOUND)) {
+        r = ZX_OK;
+    }
     zprintf("port_cancel(%p, %p) obj=%x port=%x: r = %d\n",
             port, ph, ph->handle, port->handle, r);
     return r;
@@ -61,11 +90,42 @@ zx_status_t port_queue(port_t* port, port_handler_t* ph, uint32_t evt) {
     return r;
 }
 
+// Takes the next packet, waiting for a batch from the port if none
+// are left over from the last one.
+static zx_status_t port_next_packet(port_t* port, zx_time_t deadline, zx_port_packet_t* out) {
+    mtx_lock(&port->lock);
+    if (port->pending_count > 0) {
+        *out = port->pending[port->pending_head++];
+        port->pending_count--;
+        mtx_unlock(&port->lock);
+        return ZX_OK;
+    }
+    mtx_unlock(&port->lock);
+
+    zx_port_packet_t pkts[PORT_DISPATCH_BATCH];
+    size_t count;
+    zx_status_t r = zx_port_wait_many(port->handle, deadline, pkts, PORT_DISPATCH_BATCH, &count);
+    if (r != ZX_OK) {
+        return r;
+    }
+
+    // keep the rest where port_cancel() can find them
+    *out = pkts[0];
+    if (count > 1) {
+        mtx_lock(&port->lock);
+        memcpy(port->pending, &pkts[1], (count - 1) * sizeof(zx_port_packet_t));
+        port->pending_head = 0;
+        port->pending_count = count - 1;
+        mtx_unlock(&port->lock);
+    }
+    return ZX_OK;
+}
+
 zx_status_t port_dispatch(port_t* port, zx_time_t deadline, bool once) {
     for (;;) {
         zx_port_packet_t pkt;
         zx_status_t r;
-        if ((r = zx_port_wait(port->handle, deadline, &pkt, 0)) != ZX_OK) {
+        if ((r = port_next_packet(port, deadline, &pkt)) != ZX_OK) {
             if (r != ZX_ERR_TIMED_OUT) {
                 printf("port_dispatch: port wait failed %d\n", r);
             }
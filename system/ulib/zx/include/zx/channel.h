@@ -42,6 +42,16 @@ public:
                                 num_handles);
     }
 
+    zx_status_t read_many(uint32_t flags, zx_channel_msg_t* msgs, uint32_t count,
+                          uint32_t* actual) const {
+        return zx_channel_read_many(get(), flags, msgs, count, actual);
+    }
+
+    zx_status_t write_many(uint32_t flags, const zx_channel_msg_t* msgs,
+                           uint32_t count) const {
+        return zx_channel_write_many(get(), flags, msgs, count);
+    }
+
     zx_status_t call(uint32_t flags, zx_time_t deadline,
                      const zx_channel_call_args_t* args,
                      uint32_t* actual_bytes, uint32_t* actual_handles,
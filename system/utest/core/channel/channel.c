@@ -855,6 +855,108 @@ static bool channel_disallow_write_to_self(void) {
     END_TEST;
 }
 
+static bool channel_write_read_many(void) {
+    BEGIN_TEST;
+
+    zx_handle_t channel[2];
+    ASSERT_EQ(zx_channel_create(0, &channel[0], &channel[1]), ZX_OK, "");
+
+    zx_handle_t event;
+    ASSERT_EQ(zx_event_create(0u, &event), ZX_OK, "");
+
+    // Three messages, the second carrying the event.
+    uint32_t out[3] = { 1u, 2u, 3u };
+    zx_channel_msg_t wr[3] = {
+        { &out[0], NULL, sizeof(uint32_t), 0u },
+        { &out[1], &event, sizeof(uint32_t), 1u },
+        { &out[2], NULL, sizeof(uint32_t), 0u },
+    };
+    EXPECT_EQ(zx_channel_write_many(channel[0], 0u, wr, 0u), ZX_ERR_INVALID_ARGS, "");
+    EXPECT_EQ(zx_channel_write_many(channel[0], 0u, wr, ZX_CHANNEL_MAX_MSGS_PER_CALL + 1u),
+              ZX_ERR_OUT_OF_RANGE, "");
+
+    // A bad handle in a later message writes nothing and keeps the event.
+    zx_handle_t bad = ZX_HANDLE_INVALID;
+    wr[2].handles = &bad;
+    wr[2].num_handles = 1u;
+    EXPECT_EQ(zx_channel_write_many(channel[0], 0u, wr, 3u), ZX_ERR_BAD_HANDLE, "");
+    EXPECT_EQ(zx_object_signal(event, 0u, ZX_EVENT_SIGNALED), ZX_OK, "event was transferred");
+    uint32_t actual = 0u;
+    zx_channel_msg_t rd[3] = {};
+    EXPECT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_ERR_SHOULD_WAIT, "");
+
+    wr[2].handles = NULL;
+    wr[2].num_handles = 0u;
+    ASSERT_EQ(zx_channel_write_many(channel[0], 0u, wr, 3u), ZX_OK, "");
+
+    // The first entry is too small: nothing is read and its size is reported.
+    EXPECT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_ERR_BUFFER_TOO_SMALL, "");
+    EXPECT_EQ(rd[0].num_bytes, sizeof(uint32_t), "");
+
+    // Reading stops at the message that doesn't fit its entry.
+    uint32_t in[3] = {};
+    zx_handle_t received = ZX_HANDLE_INVALID;
+    for (int i = 0; i < 3; i++) {
+        rd[i].bytes = &in[i];
+        rd[i].num_bytes = sizeof(uint32_t);
+    }
+    EXPECT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_OK, "");
+    EXPECT_EQ(actual, 1u, "");
+    EXPECT_EQ(in[0], 1u, "");
+
+    rd[0].handles = &received;
+    rd[0].num_handles = 1u;
+    rd[0].num_bytes = sizeof(uint32_t);
+    rd[1].num_bytes = sizeof(uint32_t);
+    rd[2].num_bytes = sizeof(uint32_t);
+    EXPECT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_OK, "");
+    EXPECT_EQ(actual, 2u, "");
+    EXPECT_EQ(in[0], 2u, "");
+    EXPECT_EQ(in[1], 3u, "");
+    EXPECT_EQ(rd[0].num_handles, 1u, "");
+    EXPECT_EQ(rd[1].num_handles, 0u, "");
+    EXPECT_EQ(zx_object_signal(received, ZX_EVENT_SIGNALED, 0u), ZX_OK, "");
+
+    // A message whose data can't be copied out stays in the channel, along
+    // with the ones after it; those before it are still read.
+    wr[1].handles = &received;
+    ASSERT_EQ(zx_channel_write_many(channel[0], 0u, wr, 3u), ZX_OK, "");
+    rd[0].handles = NULL;
+    rd[0].num_handles = 0u;
+    rd[1].handles = &received;
+    rd[1].num_handles = 1u;
+    for (int i = 0; i < 3; i++) {
+        rd[i].num_bytes = sizeof(uint32_t);
+    }
+    rd[1].bytes = (void*)1;
+    EXPECT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_OK, "");
+    EXPECT_EQ(actual, 1u, "");
+    EXPECT_EQ(in[0], 1u, "");
+
+    rd[0].bytes = (void*)1;
+    rd[0].handles = &received;
+    rd[0].num_handles = 1u;
+    rd[1].handles = NULL;
+    rd[1].num_handles = 0u;
+    EXPECT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_ERR_INVALID_ARGS, "");
+
+    in[0] = in[1] = 0u;
+    rd[0].bytes = &in[0];
+    rd[1].bytes = &in[1];
+    EXPECT_EQ(zx_channel_read_many(channel[1], 0u, rd, 3u, &actual), ZX_OK, "");
+    EXPECT_EQ(actual, 2u, "");
+    EXPECT_EQ(in[0], 2u, "");
+    EXPECT_EQ(in[1], 3u, "");
+    EXPECT_EQ(rd[0].num_handles, 1u, "");
+    EXPECT_EQ(zx_object_signal(received, 0u, ZX_EVENT_SIGNALED), ZX_OK, "");
+
+    EXPECT_EQ(zx_handle_close(received), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[0]), ZX_OK, "");
+    EXPECT_EQ(zx_handle_close(channel[1]), ZX_OK, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(channel_tests)
 RUN_TEST(channel_test)
 RUN_TEST(channel_read_error_test)
@@ -868,6 +970,7 @@ RUN_TEST(channel_call2)
 RUN_TEST(bad_channel_call_finish)
 RUN_TEST(channel_nest)
 RUN_TEST(channel_disallow_write_to_self)
+RUN_TEST(channel_write_read_many)
 END_TEST_CASE(channel_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -526,6 +526,91 @@ static bool test_event_signaling() {
     END_TEST;
 }
 
+// Each pair of threads ping-pongs ownership of its own futex word, so with
+// many pairs the kernel sees wait and wake traffic on many unrelated futexes
+// in one process at once.
+struct alignas(64) FutexPingPong {
+    int turn;
+    uint32_t rounds;
+};
+
+struct FutexPingPongSide {
+    FutexPingPong* pair;
+    int self;
+};
+
+static int futex_ping_pong_thread(void* arg) {
+    auto side = static_cast<FutexPingPongSide*>(arg);
+    int* turn = &side->pair->turn;
+    const int other = !side->self;
+
+    for (uint32_t i = 0; i < __atomic_load_n(&side->pair->rounds, __ATOMIC_ACQUIRE); i++) {
+        int value;
+        while ((value = __atomic_load_n(turn, __ATOMIC_ACQUIRE)) != side->self)
+            zx_futex_wait(turn, value, ZX_TIME_INFINITE);
+        __atomic_store_n(turn, other, __ATOMIC_RELEASE);
+        zx_futex_wake(turn, 1);
+    }
+    return 0;
+}
+
+static bool test_futex_ping_pong_bench() {
+    BEGIN_TEST;
+
+    static const uint32_t kRounds = 20000;
+    static const uint32_t kMaxPairs = 32;
+
+    for (uint32_t num_pairs = 1; num_pairs <= kMaxPairs; num_pairs *= 2) {
+        FutexPingPong pairs[kMaxPairs];
+        FutexPingPongSide sides[kMaxPairs][2];
+        thrd_t threads[kMaxPairs][2];
+
+        // Create the pairs, stopping at the first thread that fails. A pair
+        // left with one thread is told to stop and joined right away, so
+        // every thread is joined before any assertion can return.
+        bool created = true;
+        uint32_t started = 0;
+        zx_time_t start = zx_time_get(ZX_CLOCK_MONOTONIC);
+        for (; started < num_pairs; started++) {
+            FutexPingPong* pair = &pairs[started];
+            pair->turn = 0;
+            pair->rounds = kRounds;
+            for (int j = 0; j < 2; j++) {
+                sides[started][j].pair = pair;
+                sides[started][j].self = j;
+            }
+            if (thrd_create_with_name(&threads[started][0], futex_ping_pong_thread,
+                                      &sides[started][0], "futex ping pong") != thrd_success) {
+                created = false;
+                break;
+            }
+            if (thrd_create_with_name(&threads[started][1], futex_ping_pong_thread,
+                                      &sides[started][1], "futex ping pong") != thrd_success) {
+                __atomic_store_n(&pair->rounds, 0u, __ATOMIC_RELEASE);
+                __atomic_store_n(&pair->turn, 0, __ATOMIC_RELEASE);
+                zx_futex_wake(&pair->turn, INT_MAX);
+                EXPECT_EQ(thrd_join(threads[started][0], NULL), thrd_success, "");
+                created = false;
+                break;
+            }
+        }
+        for (uint32_t i = 0; i < started; i++) {
+            EXPECT_EQ(thrd_join(threads[i][0], NULL), thrd_success, "");
+            EXPECT_EQ(thrd_join(threads[i][1], NULL), thrd_success, "");
+        }
+        ASSERT_TRUE(created, "failed to create ping pong threads");
+        zx_time_t elapsed = zx_time_get(ZX_CLOCK_MONOTONIC) - start;
+
+        uint64_t handoffs = 2ull * kRounds * num_pairs;
+        unittest_printf("%2u pairs on %2u futexes: %" PRIu64 " handoffs in %" PRIu64
+                        " ns, %" PRIu64 " handoffs/sec\n",
+                        num_pairs, num_pairs, handoffs, elapsed,
+                        elapsed ? handoffs * ZX_SEC(1) / elapsed : 0);
+    }
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(futex_tests)
 RUN_TEST(test_futex_wait_value_mismatch);
 RUN_TEST(test_futex_wait_timeout);
@@ -545,6 +630,7 @@ RUN_TEST(test_futex_thread_killed);
 RUN_TEST(test_futex_thread_suspended);
 RUN_TEST(test_futex_misaligned);
 RUN_TEST(test_event_signaling);
+RUN_TEST_PERFORMANCE(test_futex_ping_pong_bench);
 END_TEST_CASE(futex_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -139,6 +139,58 @@ static bool wait_count_invalid_test() {
     END_TEST;
 }
 
+static bool wait_many_test(void) {
+    BEGIN_TEST;
+
+    zx_handle_t port;
+    zx_status_t status = zx_port_create(0u, &port);
+    EXPECT_EQ(status, ZX_OK);
+
+    zx_port_packet_t out[ZX_PORT_WAIT_MANY_MAX_PACKETS + 1] = {};
+    size_t actual = 0u;
+
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, 0u, &actual);
+    EXPECT_EQ(status, ZX_ERR_INVALID_ARGS);
+
+    status = zx_port_wait_many(port, zx_deadline_after(ZX_USEC(1)), out, 4u, &actual);
+    EXPECT_EQ(status, ZX_ERR_TIMED_OUT);
+
+    // Queue more than one call returns, keyed by their order.
+    const size_t queued = ZX_PORT_WAIT_MANY_MAX_PACKETS + 3u;
+    for (size_t i = 0u; i < queued; ++i) {
+        zx_port_packet_t in = {};
+        in.key = i;
+        status = zx_port_queue(port, &in, 1u);
+        EXPECT_EQ(status, ZX_OK);
+    }
+
+    // A short buffer takes only what fits.
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, 2u, &actual);
+    EXPECT_EQ(status, ZX_OK);
+    EXPECT_EQ(actual, 2u);
+    EXPECT_EQ(out[0].key, 0u);
+    EXPECT_EQ(out[1].key, 1u);
+
+    // A long one is clamped to the maximum.
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, fbl::count_of(out), &actual);
+    EXPECT_EQ(status, ZX_OK);
+    EXPECT_EQ(actual, ZX_PORT_WAIT_MANY_MAX_PACKETS);
+    for (size_t i = 0u; i < actual; ++i)
+        EXPECT_EQ(out[i].key, i + 2u);
+
+    // The rest come back without waiting for more, and |actual| is optional.
+    status = zx_port_wait_many(port, ZX_TIME_INFINITE, out, fbl::count_of(out), nullptr);
+    EXPECT_EQ(status, ZX_OK);
+    EXPECT_EQ(out[0].key, queued - 1u);
+
+    status = zx_port_wait_many(port, 0u, out, fbl::count_of(out), &actual);
+    EXPECT_EQ(status, ZX_ERR_TIMED_OUT);
+
+    EXPECT_EQ(zx_handle_close(port), ZX_OK);
+
+    END_TEST;
+}
+
 static bool queue_and_close_test(void) {
     BEGIN_TEST;
     zx_status_t status;
@@ -746,6 +798,7 @@ RUN_TEST(wait_count_valid_test<0u>)
 RUN_TEST(wait_count_valid_test<1u>)
 RUN_TEST(wait_count_invalid_test<2u>)
 RUN_TEST(wait_count_invalid_test<23u>)
+RUN_TEST(wait_many_test)
 RUN_TEST(queue_and_close_test)
 RUN_TEST(async_wait_channel_test)
 RUN_TEST(async_wait_event_test_single)
@@ -475,6 +475,57 @@ static bool socket_short_write(void) {
     END_TEST;
 }
 
+static bool socket_large_stream(void) {
+    BEGIN_TEST;
+
+    zx_status_t status;
+    size_t count;
+
+    zx_handle_t h0, h1;
+    status = zx_socket_create(0, &h0, &h1);
+    ASSERT_EQ(status, ZX_OK, "");
+
+    // A small write first, so the large one starts part way into a buffer
+    // and carries on into page-sized ones.
+    const size_t buffer_size = 64 * 1024 + 17;
+    unsigned char* buffer = malloc(buffer_size);
+    for (size_t i = 0; i < buffer_size; i++)
+        buffer[i] = (unsigned char)(i * 7);
+
+    status = zx_socket_write(h0, 0u, buffer, 100u, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, 100u, "");
+    status = zx_socket_write(h0, 0u, buffer + 100, buffer_size - 100, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, buffer_size - 100, "");
+
+    status = zx_socket_read(h1, 0u, NULL, 0, &count);
+    EXPECT_EQ(status, ZX_OK, "");
+    EXPECT_EQ(count, buffer_size, "");
+
+    // Read it back in pieces that don't line up with any buffer size.
+    unsigned char* rbuf = malloc(buffer_size);
+    size_t pos = 0;
+    while (pos < buffer_size) {
+        size_t len = buffer_size - pos < 3001u ? buffer_size - pos : 3001u;
+        status = zx_socket_read(h1, 0u, rbuf + pos, len, &count);
+        ASSERT_EQ(status, ZX_OK, "");
+        ASSERT_EQ(count, len, "");
+        pos += count;
+    }
+    EXPECT_EQ(memcmp(buffer, rbuf, buffer_size), 0, "");
+
+    status = zx_socket_read(h1, 0u, rbuf, buffer_size, &count);
+    EXPECT_EQ(status, ZX_ERR_SHOULD_WAIT, "");
+
+    free(rbuf);
+    free(buffer);
+    zx_handle_close(h0);
+    zx_handle_close(h1);
+
+    END_TEST;
+}
+
 static bool socket_datagram(void) {
     BEGIN_TEST;
 
@@ -808,6 +859,7 @@ RUN_TEST(socket_bytes_outstanding)
 RUN_TEST(socket_bytes_outstanding_shutdown_write)
 RUN_TEST(socket_bytes_outstanding_shutdown_read)
 RUN_TEST(socket_short_write)
+RUN_TEST(socket_large_stream)
 RUN_TEST(socket_datagram)
 RUN_TEST(socket_datagram_no_short_write)
 RUN_TEST(socket_control_plane_absent)
@@ -0,0 +1,136 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fbl/algorithm.h>
+#include <fbl/unique_ptr.h>
+#include <fdio/io.h>
+#include <unittest/unittest.h>
+#include <zircon/kcounters.h>
+#include <zircon/process.h>
+#include <zircon/syscalls.h>
+
+static const char kDescPath[] = "/boot/kernel/counters/desc";
+static const char kArenaPath[] = "/boot/kernel/counters/arena";
+
+static bool get_vmo(const char* path, zx_handle_t* vmo) {
+    BEGIN_HELPER;
+    int fd = open(path, O_RDONLY);
+    ASSERT_GE(fd, 0, path);
+    zx_status_t status = fdio_get_exact_vmo(fd, vmo);
+    close(fd);
+    ASSERT_EQ(status, ZX_OK, path);
+    END_HELPER;
+}
+
+static bool read_desc(kcounters_desc_t* header, fbl::unique_ptr<kcounter_desc_entry_t[]>* entries) {
+    BEGIN_HELPER;
+    zx_handle_t vmo;
+    ASSERT_TRUE(get_vmo(kDescPath, &vmo));
+
+    size_t actual;
+    ASSERT_EQ(zx_vmo_read(vmo, header, 0, sizeof(*header), &actual), ZX_OK);
+    ASSERT_EQ(actual, sizeof(*header));
+    ASSERT_EQ(header->magic, KCOUNTERS_MAGIC);
+    ASSERT_GT(header->max_cpus, 0u);
+    ASSERT_GT(header->num_counters, 0u);
+
+    size_t size = header->num_counters * sizeof(kcounter_desc_entry_t);
+    entries->reset(new kcounter_desc_entry_t[header->num_counters]);
+    ASSERT_EQ(zx_vmo_read(vmo, entries->get(), sizeof(*header), size, &actual), ZX_OK);
+    ASSERT_EQ(actual, size);
+
+    zx_handle_close(vmo);
+    END_HELPER;
+}
+
+static bool desc_is_sorted() {
+    BEGIN_TEST;
+
+    kcounters_desc_t header;
+    fbl::unique_ptr<kcounter_desc_entry_t[]> entries;
+    ASSERT_TRUE(read_desc(&header, &entries));
+
+    for (uint32_t i = 0; i < header.num_counters; i++) {
+        const char* name = entries[i].name;
+        EXPECT_NONNULL(memchr(name, '\0', KCOUNTER_NAME_LEN), "name not terminated");
+        if (i > 0) {
+            EXPECT_LT(strcmp(entries[i - 1].name, name), 0, "names not sorted");
+        }
+    }
+
+    END_TEST;
+}
+
+// Sums counter |index| over all cpus.
+static uint64_t counter_value(const volatile uint64_t* arena, const kcounters_desc_t& header,
+                              uint32_t index) {
+    uint64_t sum = 0;
+    for (uint32_t cpu = 0; cpu < header.max_cpus; cpu++) {
+        sum += arena[cpu * header.num_counters + index];
+    }
+    return sum;
+}
+
+static bool arena_tracks_kernel() {
+    BEGIN_TEST;
+
+    kcounters_desc_t header;
+    fbl::unique_ptr<kcounter_desc_entry_t[]> entries;
+    ASSERT_TRUE(read_desc(&header, &entries));
+
+    uint32_t index = header.num_counters;
+    for (uint32_t i = 0; i < header.num_counters; i++) {
+        if (!strcmp(entries[i].name, "kernel.dispatcher.create")) {
+            index = i;
+            break;
+        }
+    }
+    ASSERT_LT(index, header.num_counters, "kernel.dispatcher.create not found");
+
+    zx_handle_t vmo;
+    ASSERT_TRUE(get_vmo(kArenaPath, &vmo));
+    uint64_t size;
+    ASSERT_EQ(zx_vmo_get_size(vmo, &size), ZX_OK);
+    ASSERT_GE(size, uint64_t{header.max_cpus} * header.num_counters * sizeof(uint64_t));
+
+    // The arena is read-only.
+    uintptr_t addr;
+    EXPECT_NE(zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, size,
+                          ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &addr),
+              ZX_OK);
+    ASSERT_EQ(zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, size, ZX_VM_FLAG_PERM_READ, &addr),
+              ZX_OK);
+    zx_handle_close(vmo);
+    auto arena = reinterpret_cast<const volatile uint64_t*>(addr);
+
+    // Creating objects must show up in the mapping without any syscall to
+    // refresh it.
+    uint64_t before = counter_value(arena, header, index);
+    zx_handle_t events[4];
+    for (zx_handle_t& event : events) {
+        ASSERT_EQ(zx_event_create(0u, &event), ZX_OK);
+    }
+    uint64_t after = counter_value(arena, header, index);
+    EXPECT_GE(after - before, fbl::count_of(events));
+
+    for (zx_handle_t event : events) {
+        zx_handle_close(event);
+    }
+    EXPECT_EQ(zx_vmar_unmap(zx_vmar_root_self(), addr, size), ZX_OK);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(kcounter_tests)
+RUN_TEST(desc_is_sorted)
+RUN_TEST(arena_tracks_kernel)
+END_TEST_CASE(kcounter_tests)
+
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
@@ -7,12 +7,14 @@
 #include <inttypes.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <threads.h>
 #include <unistd.h>
 
 #include <zircon/compiler.h>
 #include <zircon/process.h>
 #include <zircon/syscalls.h>
 #include <fbl/algorithm.h>
+#include <fbl/atomic.h>
 
 #include "bench.h"
 
@@ -46,6 +48,110 @@ inline zx_time_t time_it(T func) {
     return ticks_to_ns(ticks);
 }
 
+// Each fault storm thread write faults kFaultStormSize bytes. Without a shared vmo every
+// thread maps its own, so the only thing the threads share is the kernel's page
+// allocator. With one, the threads fault disjoint slices of a single mapping and so
+// also contend on that vmo and the address space.
+static const size_t kFaultStormSize = 16 * 1024 * 1024;
+
+struct fault_storm_state {
+    fbl::atomic<uint32_t> ready;
+    fbl::atomic<uint32_t> failed;
+    fbl::atomic<uint32_t> next_slice;
+    fbl::atomic<bool> go;
+    uintptr_t shared_ptr;
+};
+
+static int fault_storm_thread(void* arg) {
+    auto state = static_cast<fault_storm_state*>(arg);
+
+    zx_handle_t vmo = ZX_HANDLE_INVALID;
+    uintptr_t ptr;
+    if (state->shared_ptr) {
+        ptr = state->shared_ptr + state->next_slice.fetch_add(1) * kFaultStormSize;
+    } else {
+        if (zx_vmo_create(kFaultStormSize, 0, &vmo) != ZX_OK) {
+            state->failed.fetch_add(1);
+            return -1;
+        }
+        if (zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, kFaultStormSize,
+                        ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE, &ptr) != ZX_OK) {
+            zx_handle_close(vmo);
+            state->failed.fetch_add(1);
+            return -1;
+        }
+    }
+
+    state->ready.fetch_add(1);
+    while (!state->go.load())
+        ;
+
+    for (size_t i = 0; i < kFaultStormSize; i += PAGE_SIZE) {
+        ((volatile char *)ptr)[i] = 99;
+    }
+
+    if (vmo != ZX_HANDLE_INVALID) {
+        zx_vmar_unmap(zx_vmar_root_self(), ptr, kFaultStormSize);
+        zx_handle_close(vmo);
+    }
+    return 0;
+}
+
+static void fault_storm(uint32_t num_threads, bool shared) {
+    fault_storm_state state;
+    state.ready.store(0);
+    state.failed.store(0);
+    state.next_slice.store(0);
+    state.go.store(false);
+    state.shared_ptr = 0;
+
+    const char* kind = shared ? "one shared vmo" : "separate vmos";
+    zx_handle_t vmo = ZX_HANDLE_INVALID;
+    size_t shared_size = num_threads * kFaultStormSize;
+    if (shared) {
+        if (zx_vmo_create(shared_size, 0, &vmo) != ZX_OK ||
+            zx_vmar_map(zx_vmar_root_self(), 0, vmo, 0, shared_size,
+                        ZX_VM_FLAG_PERM_READ | ZX_VM_FLAG_PERM_WRITE,
+                        &state.shared_ptr) != ZX_OK) {
+            printf("\t%u threads, %s: failed to set up the vmo, skipping\n", num_threads, kind);
+            zx_handle_close(vmo);
+            return;
+        }
+    }
+
+    thrd_t threads[num_threads];
+    uint32_t started = 0;
+    for (; started < num_threads; started++) {
+        if (thrd_create(&threads[started], fault_storm_thread, &state) != thrd_success)
+            break;
+    }
+    while (state.ready.load() + state.failed.load() != started)
+        ;
+
+    zx_time_t t = time_it([&](){
+        state.go.store(true);
+        for (uint32_t i = 0; i < started; i++) {
+            thrd_join(threads[i], nullptr);
+        }
+    });
+
+    if (shared) {
+        zx_vmar_unmap(zx_vmar_root_self(), state.shared_ptr, shared_size);
+        zx_handle_close(vmo);
+    }
+
+    if (started != num_threads || state.failed.load() != 0) {
+        printf("\t%u threads, %s: failed to set up %u of them, skipping\n",
+               num_threads, kind, num_threads - state.ready.load());
+        return;
+    }
+
+    size_t pages = num_threads * kFaultStormSize / PAGE_SIZE;
+    printf("\t%u threads took %" PRIu64 " nsecs to write fault %zu pages of %s, "
+           "%" PRIu64 " pages/sec\n",
+           num_threads, t, pages, kind, t ? pages * ZX_SEC(1) / t : 0);
+}
+
 int vmo_run_benchmark() {
     zx_time_t t;
     //zx_handle_t vmo;
@@ -188,6 +294,16 @@ int vmo_run_benchmark() {
 
     zx_handle_close(vmo);
 
+    // write fault separate vmos, then disjoint slices of one vmo, from an increasing
+    // number of threads at once
+    uint32_t num_cpus = zx_system_get_num_cpus();
+    for (uint32_t num_threads = 1; num_threads <= num_cpus * 2; num_threads *= 2) {
+        fault_storm(num_threads, false);
+    }
+    for (uint32_t num_threads = 1; num_threads <= num_cpus * 2; num_threads *= 2) {
+        fault_storm(num_threads, true);
+    }
+
     printf("done with benchmark\n");
 
     return 0;